@@ -35,6 +35,7 @@
  */
 
 #include <sys/ioctl.h>
+#include <sys/mman.h>
 #include <sys/mtio.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -43,11 +44,13 @@
 #include <err.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <zlib.h>
 
 #include "extern.h"
 #include "pax.h"
@@ -73,14 +76,125 @@ static struct stat arsb;  /* stat of archive device at open */
 static int invld_rec;     /* tape has out of spec record size */
 static int wr_trail = 1;  /* trailer was rewritten in append */
 static int can_unlnk = 0; /* do we unlink null archives?  */
+static char *armap;       /* window of the archive file mapped */
+static off_t armoff;      /* archive offset of the window */
+static size_t armlen;     /* size of the window */
+static long armpgsz;      /* page size the window is aligned to */
+static int armsig;        /* ar_mbus() handles SIGBUS */
+static volatile sig_atomic_t armbus; /* the file ended inside the window */
 const char *arcname;      /* printable name of archive */
 const char *gzip_program; /* name of gzip program */
 static pid_t zpid = -1;   /* pid of child process */
 int force_one_volume;     /* 1 if we ignore volume changes */
+int gzip_builtin = 1;     /* do gzip (de)compression in process */
 
+/*
+ * state of the in process gzip (de)compression of an archive volume
+ */
+#define ZRD 1                 /* arz: inflating an archive being read */
+#define ZWR 2                 /* arz: deflating an archive being written */
+static int arz;               /* in process (de)compression mode */
+static z_stream zs;           /* zlib stream */
+static char *zbuf;            /* compressed data buffer */
+static int zbufsz;            /* size of zbuf */
+static int zblen;             /* compressed bytes waiting in zbuf */
+static int zeof;              /* end of file on compressed input */
+static int zmend;             /* at the end of a gzip member */
+static int zsend;             /* no more data in this volume */
+static int zfirst;            /* no gzip member started yet */
+static const char *zerr;      /* why decompression failed */
+static off_t zcpos;           /* archive offset of compressed data */
+static off_t zupos;           /* offset in uncompressed data */
+static u_char zmagic[2];      /* first bytes of a piped archive */
+static int zmlen;             /* bytes of zmagic read from the archive */
+static struct {
+	off_t cpos;           /* archive offset of member */
+	off_t upos;           /* uncompressed offset of member */
+} zmbr[2];                    /* current and previous gzip member */
+
+/*
+ * Parallel compression. The data to write is cut into blocks of ZBLK
+ * bytes which a pool of threads compress into gzip members of their own.
+ * The members are written in order by the thread calling gz_write(), so
+ * the archive is a series of gzip members that any gunzip can read.
+ * Each member carries its compressed size in a gzip extra field, so when
+ * reading, the members can be split off without inflating them and
+ * given to the threads to decompress. Other members are decompressed by
+ * the calling thread.
+ */
+#define ZBLK (1024*1024)      /* uncompressed size of a member */
+#define ZMAXMBR (16*ZBLK)     /* largest member handed to the threads */
+#define ZHDRSZ 20             /* size of a marked member header */
+#define ZTRLSZ 8              /* size of a gzip member trailer */
+#define ZJ_FREE 0             /* zjob: not in use (or being filled) */
+#define ZJ_READY 1            /* zjob: waiting for a thread */
+#define ZJ_BUSY 2             /* zjob: being compressed */
+#define ZJ_DONE 3             /* zjob: compressed, to be written */
+int gzthreads = 1;            /* # of compression threads */
+static struct zjob {
+	char *in;             /* uncompressed data */
+	char *out;            /* gzip member */
+	int inlen;            /* bytes in in */
+	int outlen;           /* bytes in out, -1 if (de)compression failed */
+	int incap;            /* size of in (reading) */
+	int outcap;           /* size of out (reading) */
+	int off;              /* bytes of out returned (reading) */
+	off_t cpos;           /* archive offset of member (reading) */
+	const char *msg;      /* why decompression failed */
+	const char *err;      /* failure to report after out (reading) */
+	int state;            /* ZJ_ state */
+} *zjob;
+static int nzjob;             /* # of jobs, 0 if not running */
+static int zjmode;            /* ZRD or ZWR */
+static int zjhead;            /* oldest queued job */
+static int zjlen;             /* # of queued jobs */
+static int zjend;             /* threads must stop */
+static int zjlast;            /* next member is not for the threads */
+static int zpar;              /* members are decompressed by the threads */
+static const u_char zhdr[ZHDRSZ - 4] = {
+	0x1f, 0x8b, Z_DEFLATED, 0x04, /* gzip magic, deflate, FEXTRA */
+	0, 0, 0, 0, 0, 3,             /* no mtime, no xfl, unix */
+	8, 0, 'P', 'X', 4, 0          /* extra field: "PX", 4 bytes of size */
+};
+static uLong zjcap;           /* size of out */
+static pthread_t *zthr;       /* compression threads */
+static int nzthr;             /* # of threads running */
+static pthread_mutex_t zjmtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t zjwork = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t zjdone = PTHREAD_COND_INITIALIZER;
+
+static int ar_iosz(int);
+static void ar_mbus(int, siginfo_t *, void *);
 static int get_phys(void);
 extern sigset_t s_mask;
 static void ar_start_gzip(int, const char *, int);
+static int gz_magic(void);
+static int gz_feed(int);
+static int gz_open(void);
+static void gz_close(int);
+static int gz_read(char *, int);
+static int gz_sread(char *, int);
+static int gz_fill(int);
+static int gz_write(char *, int);
+static int gz_flush(void);
+static int gz_out(char *, int);
+static void gz_pstart(void);
+static void gz_pstop(void);
+static int gz_pwrite(char *, int);
+static int gz_pqueue(void);
+static int gz_pretire(int);
+static void *gz_pthread(void *);
+static void gz_pdeflate(z_stream *, struct zjob *);
+static void gz_pinflate(z_stream *, struct zjob *);
+static void gz_psalvage(struct zjob *);
+static int gz_pread(char *, int);
+static int gz_pqmember(void);
+static int gz_pmarked(u_int32_t *);
+static void gz_put32(u_char *, u_int32_t);
+static u_int32_t gz_get32(const u_char *);
+static int gz_reread(int, off_t, int);
+static int gz_rev(off_t);
+static int gz_append(void);
 
 /*
  * ar_open()
@@ -99,7 +213,7 @@ ar_open(const char *name)
 	if (arfd != -1)
 		(void)close(arfd);
 	arfd = -1;
-	can_unlnk = did_io = io_ok = invld_rec = 0;
+	can_unlnk = did_io = io_ok = invld_rec = arz = 0;
 	artyp = ISREG;
 	flcnt = 0;
 
@@ -114,7 +228,9 @@ ar_open(const char *name)
 			arcname = STDN;
 		} else if ((arfd = open(name, EXT_MODE, DMOD)) == -1)
 			syswarn(1, errno, "Failed open to read on %s", name);
-		if (arfd != -1 && gzip_program != NULL)
+		if (arfd != -1 && ar_zlib() && gz_magic())
+			arz = ZRD;
+		else if (arfd != -1 && gzip_program != NULL)
 			ar_start_gzip(arfd, gzip_program, 0);
 		break;
 	case ARCHIVE:
@@ -125,7 +241,9 @@ ar_open(const char *name)
 			syswarn(1, errno, "Failed open to write on %s", name);
 		else
 			can_unlnk = 1;
-		if (arfd != -1 && gzip_program != NULL)
+		if (arfd != -1 && ar_zlib())
+			arz = ZWR;
+		else if (arfd != -1 && gzip_program != NULL)
 			ar_start_gzip(arfd, gzip_program, 1);
 		break;
 	case APPND:
@@ -135,6 +253,8 @@ ar_open(const char *name)
 		} else if ((arfd = open(name, APP_MODE, DMOD)) == -1)
 			syswarn(
 			    1, errno, "Failed open to read/write on %s", name);
+		if (arfd != -1 && ar_zlib())
+			arz = ZRD;
 		break;
 	case COPY:
 		/*
@@ -190,7 +310,24 @@ ar_open(const char *name)
 	 * if we are writing, we are done
 	 */
 	if (act == ARCHIVE) {
-		blksz = rdblksz = wrblksz;
+		rdblksz = wrblksz;
+		blksz = ar_iosz(wrblksz);
+		if (arz && (gz_open() < 0))
+			return (-1);
+		lstrval = 1;
+		return (0);
+	}
+
+	/*
+	 * a compressed archive has no record structure we could find, so
+	 * read it in large blocks. Appends use the user specified write block
+	 * size or the default for files to pad the rewritten trailer.
+	 */
+	if (arz) {
+		rdblksz = wrblksz ? wrblksz : FILEBLK;
+		blksz = (act == APPND) ? rdblksz : MAXIMUM(iosz, MAXBLK);
+		if (gz_open() < 0)
+			return (-1);
 		lstrval = 1;
 		return (0);
 	}
@@ -246,6 +383,8 @@ ar_open(const char *name)
 		 */
 		if ((act == APPND) || (artyp == ISCHR))
 			blksz = rdblksz;
+		else if (artyp == ISPIPE)
+			blksz = MAXIMUM(iosz, MAXBLK);
 		else
 			blksz = MAXBLK;
 		break;
@@ -276,7 +415,7 @@ ar_open(const char *name)
 		if (act == APPND)
 			blksz = rdblksz;
 		else
-			blksz = MAXBLK;
+			blksz = MAXIMUM(iosz, MAXBLK);
 		break;
 	default:
 		/*
@@ -289,6 +428,24 @@ ar_open(const char *name)
 	return (0);
 }
 
+/*
+ * ar_iosz()
+ *	Regular files and pipes have no record structure, so we write as many
+ *	whole records per call as fit in the i/o size. Devices keep the record
+ *	size, as does a volume with a byte limit (-B) so the limit is not
+ *	overrun by more than a record.
+ * Return:
+ *	the number of bytes to write per call, a multiple of recsz
+ */
+
+static int
+ar_iosz(int recsz)
+{
+	if (!ar_isstream() || (wrlimit > 0) || (iosz <= recsz))
+		return (recsz);
+	return ((iosz / recsz) * recsz);
+}
+
 /*
  * ar_close(int int_sig)
  *	closes archive device, increments volume number, and prints i/o summary
@@ -303,8 +460,14 @@ ar_close(int in_sig)
 		did_io = io_ok = flcnt = 0;
 		return;
 	}
-	if (!in_sig)
+	if (!in_sig) {
+		rd_fin();
 		fflush(listf);
+	}
+	if (armap != NULL) {
+		(void)munmap(armap, armlen);
+		armap = NULL;
+	}
 
 	/*
 	 * Close archive file. This may take a LONG while on tapes (we may be
@@ -318,6 +481,12 @@ ar_close(int in_sig)
 		    vfpart ? "\n" : "", argv0);
 	}
 
+	/*
+	 * finish the compressed stream of the volume
+	 */
+	if (arz)
+		gz_close(in_sig);
+
 	/*
 	 * if nothing was written to the archive (and we created it), we remove
 	 * it
@@ -418,6 +587,8 @@ ar_drain(void)
 	int res;
 	char drbuf[MAXBLK];
 
+	rd_fin();
+
 	/*
 	 * we only drain from a pipe/socket. Other devices can be closed
 	 * without reading up to end of file. We sure hope that pipe is closed
@@ -455,6 +626,9 @@ ar_set_wr(void)
 	 */
 	wr_trail = 0;
 
+	if (arz)
+		return (gz_append());
+
 	/*
 	 * Add any device dependent code as required here
 	 */
@@ -489,6 +663,11 @@ ar_app_ok(void)
 		paxwarn(1, "Cannot append to an archive obtained from a pipe.");
 		return (-1);
 	}
+	if (arz && (artyp != ISREG)) {
+		paxwarn(1, "Cannot append to a compressed archive that is "
+		    "not a regular file.");
+		return (-1);
+	}
 
 	if (!invld_rec)
 		return (0);
@@ -498,6 +677,20 @@ ar_app_ok(void)
 	return (-1);
 }
 
+/*
+ * ar_isstream()
+ *	check if the archive volume is a regular file or a pipe, which have no
+ *	record structure to preserve.
+ * Return:
+ *	1 if so, 0 otherwise
+ */
+
+int
+ar_isstream(void)
+{
+	return ((artyp == ISREG) || (artyp == ISPIPE));
+}
+
 /*
  * ar_read()
  *	read up to a specified number of bytes from the archive into the
@@ -518,6 +711,23 @@ ar_read(char *buf, int cnt)
 	if (lstrval <= 0)
 		return (lstrval);
 
+	/*
+	 * a compressed archive is read as a stream whatever the device
+	 */
+	if (arz) {
+		if ((res = gz_read(buf, cnt)) > 0) {
+			io_ok = 1;
+			return (res);
+		}
+		lstrval = res;
+		if (res < 0)
+			paxwarn(1, "Failed read on archive volume %d: %s",
+			    arvol, (zerr != NULL) ? zerr : strerror(errno));
+		else
+			paxwarn(0, "End of archive volume %d reached", arvol);
+		return (res);
+	}
+
 	/*
 	 * how we read must be based on device type
 	 */
@@ -579,6 +789,214 @@ ar_read(char *buf, int cnt)
 	return (res);
 }
 
+/*
+ * ar_rdahead()
+ *	read for the archive read-ahead thread (only used on files and
+ *	pipes). Unlike ar_read() a failed read or end of file is not recorded
+ *	or reported, the caller stops and the read is redone with ar_read().
+ * Return:
+ *	Number of bytes in buffer. 0 for end of file, -1 for a read error.
+ */
+
+int
+ar_rdahead(char *buf, int cnt)
+{
+	int res;
+
+	if (lstrval <= 0)
+		return (lstrval);
+	if ((res = arz ? gz_read(buf, cnt) : read(arfd, buf, cnt)) > 0)
+		io_ok = 1;
+	return (res);
+}
+
+/*
+ * ar_mapok()
+ *	check if the archive volume can be read by mapping it: a regular file
+ *	that is read as it is stored.
+ * Return:
+ *	1 if so, 0 otherwise
+ */
+
+int
+ar_mapok(void)
+{
+	return ((artyp == ISREG) && !arz && (act != APPND) && (lstrval > 0));
+}
+
+/*
+ * ar_patchok()
+ *	check if data already written can be changed with ar_patch(): the
+ *	archive is a single regular file written as it is stored.
+ * Return:
+ *	1 if so, 0 otherwise
+ */
+
+int
+ar_patchok(void)
+{
+	return ((artyp == ISREG) && !arz && (wrlimit == 0));
+}
+
+/*
+ * ar_patch()
+ *	rewrite cnt bytes of the archive volume, which were written back bytes
+ *	before the current position.
+ * Return:
+ *	0 if ok, -1 otherwise
+ */
+
+int
+ar_patch(off_t back, char *data, int cnt)
+{
+	off_t off;
+
+	if (!ar_patchok() || ((off = lseek(arfd, 0, SEEK_CUR)) < back))
+		return (-1);
+	if (pwrite(arfd, data, cnt, off - back) != cnt) {
+		syswarn(1, errno, "Unable to rewrite data on %s", arcname);
+		return (-1);
+	}
+	return (0);
+}
+
+/*
+ * ar_mread()
+ *	read the archive file by mapping it. The window mapped covers up to
+ *	MAPBLK bytes from the current file offset, which is moved past them,
+ *	and (except at the start of the file) at least BLKMULT bytes in front
+ *	of it, so a header just read can be pushed back (see pback()).
+ *	The file offset stays the archive position, so ar_fow() and friends
+ *	work as usual. The mapping is private, data changed in the buffer
+ *	(e.g. byte swaps) never reaches the archive. Touching a page past the
+ *	end of the file is a SIGBUS, so the size is checked every time: a
+ *	file that is being written (or was truncated) is read instead. Should
+ *	it get shorter while a window is in use, ar_mbus() steps in.
+ * Return:
+ *	Number of bytes mapped at *ptr, 0 for end of file (not recorded, the
+ *	caller reads to find out) and -1 if the file cannot be mapped.
+ */
+
+int
+ar_mread(char **ptr)
+{
+	struct sigaction sa;
+	struct stat sb;
+	off_t cpos;
+	off_t mpos;
+	long pgsz;
+	int cnt;
+
+	if (armbus) {
+		armbus = 0;
+		paxwarn(1, "Archive %s got shorter while being read", arcname);
+		lstrval = -1;
+		return (-1);
+	}
+	if ((lstrval <= 0) || ((cpos = lseek(arfd, 0, SEEK_CUR)) < 0))
+		return (-1);
+	if ((fstat(arfd, &sb) < 0) || (sb.st_size != arsb.st_size))
+		return (-1);
+	if (cpos >= arsb.st_size)
+		return (0);
+
+	/*
+	 * map a new window unless the current one has data at cpos and
+	 * pushback space in front of it
+	 */
+	if ((armap == NULL) || (cpos >= armoff + (off_t)armlen) ||
+	    ((armoff > 0) && (cpos < armoff + BLKMULT)) || (cpos < armoff)) {
+		if (armap != NULL) {
+			(void)munmap(armap, armlen);
+			armap = NULL;
+		}
+		if ((pgsz = sysconf(_SC_PAGESIZE)) <= 0)
+			return (-1);
+		if (!armsig) {
+			memset(&sa, 0, sizeof(sa));
+			sigemptyset(&sa.sa_mask);
+			sa.sa_sigaction = ar_mbus;
+			sa.sa_flags = SA_SIGINFO;
+			if (sigaction(SIGBUS, &sa, NULL) < 0)
+				return (-1);
+			armsig = 1;
+		}
+		mpos = (cpos > BLKMULT) ? cpos - BLKMULT : 0;
+		mpos -= mpos % pgsz;
+		armlen = MINIMUM(arsb.st_size - mpos, MAPBLK + (cpos - mpos));
+		armap = mmap(NULL, armlen, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+		    arfd, mpos);
+		if (armap == MAP_FAILED) {
+			armap = NULL;
+			return (-1);
+		}
+		armoff = mpos;
+		armpgsz = pgsz;
+		(void)madvise(armap, armlen, MADV_SEQUENTIAL);
+	}
+
+	cnt = MINIMUM(armoff + (off_t)armlen - cpos, MAPBLK);
+	if (lseek(arfd, cpos + cnt, SEEK_SET) < 0)
+		return (-1);
+	*ptr = armap + (cpos - armoff);
+	io_ok = 1;
+	return (cnt);
+}
+
+/*
+ * ar_munmap()
+ *	stop reading the archive file by mapping it. The last cnt bytes
+ *	mapped were not used, the file offset is moved back over them.
+ */
+
+void
+ar_munmap(int cnt)
+{
+	if ((cnt > 0) && (lseek(arfd, -(off_t)cnt, SEEK_CUR) < 0)) {
+		syswarn(1, errno, "Reverse positioning on archive failed");
+		lstrval = -1;
+	}
+	if (armap != NULL) {
+		(void)munmap(armap, armlen);
+		armap = NULL;
+	}
+	if (armbus) {
+		armbus = 0;
+		paxwarn(1, "Archive %s got shorter while being read", arcname);
+		lstrval = -1;
+	}
+}
+
+/*
+ * ar_mbus()
+ *	SIGBUS handler for reading the archive file by mapping it: the file
+ *	got shorter than the window in use. The pages of the window from the
+ *	one touched on are replaced by zeros, so the access completes and the
+ *	read error is reported by ar_mread() or ar_munmap(). A SIGBUS for
+ *	anything else is fatal as usual.
+ */
+
+static void
+ar_mbus(int sig, siginfo_t *si, void *ctx)
+{
+	char *pt = si->si_addr;
+	char *pg;
+
+	if ((armap == NULL) || (pt < armap) || (pt >= armap + armlen)) {
+		(void)signal(SIGBUS, SIG_DFL);
+		armsig = 0;
+		return;
+	}
+	pg = armap + ((pt - armap) / armpgsz) * armpgsz;
+	if (mmap(pg, armlen - (pg - armap), PROT_READ | PROT_WRITE,
+	    MAP_PRIVATE | MAP_ANON | MAP_FIXED, -1, 0) == MAP_FAILED) {
+		(void)signal(SIGBUS, SIG_DFL);
+		armsig = 0;
+		return;
+	}
+	armbus = 1;
+}
+
 /*
  * ar_write()
  *	Write a specified number of bytes in supplied buffer to the archive
@@ -603,6 +1021,22 @@ ar_write(char *buf, int bsz)
 	if (lstrval <= 0)
 		return (lstrval);
 
+	/*
+	 * data that went into a compressed stream cannot be moved to the next
+	 * volume, so any failure ends the archive
+	 */
+	if (arz) {
+		if (gz_write(buf, bsz) == bsz) {
+			wr_trail = 1;
+			io_ok = 1;
+			return (bsz);
+		}
+		syswarn(1, errno, "Failed write to archive volume: %d", arvol);
+		lstrval = -1;
+		done = 1;
+		return (-1);
+	}
+
 	if ((res = write(arfd, buf, bsz)) == bsz) {
 		wr_trail = 1;
 		io_ok = 1;
@@ -733,7 +1167,10 @@ ar_rdsync(void)
 	if (io_ok)
 		did_io = 1;
 
-	switch (artyp) {
+	/*
+	 * there is no way to find the next gzip block in a compressed archive
+	 */
+	switch (arz ? ISPIPE : artyp) {
 	case ISTAPE:
 		/*
 		 * if the last i/o was a successful data transfer, we assume
@@ -816,9 +1253,10 @@ ar_fow(off_t sksz, off_t *skipped)
 	 * Safer to read forward on devices where it is hard to find the end of
 	 * the media without reading to it. With tapes we cannot be sure of the
 	 * number of physical blocks to skip (we do not know physical block
-	 * size at this point), so we must only read forward on tapes!
+	 * size at this point), so we must only read forward on tapes! The
+	 * compressed data of an archive can only be read forward.
 	 */
-	if (artyp != ISREG)
+	if ((artyp != ISREG) || arz)
 		return (0);
 
 	/*
@@ -868,6 +1306,15 @@ ar_rev(off_t sksz)
 	if (lstrval < 0)
 		return (lstrval);
 
+	if (arz && (artyp != ISPIPE)) {
+		if ((sksz > 0) && (gz_rev(sksz) < 0)) {
+			lstrval = -1;
+			return (-1);
+		}
+		lstrval = 1;
+		return (0);
+	}
+
 	switch (artyp) {
 	case ISPIPE:
 		if (sksz <= 0)
@@ -1108,6 +1555,11 @@ ar_next(void)
 	static int freeit = 0;
 	sigset_t o_mask;
 
+	/*
+	 * offsets in the member index only hold within one volume
+	 */
+	idx_drop();
+
 	/*
 	 * WE MUST CLOSE THE DEVICE. A lot of devices must see last close, (so
 	 * things like writing EOF etc will be done) (Watch out ar_close() can
@@ -1290,6 +1742,8 @@ ar_start_gzip(int fd, const char *path, int wr)
 			dup2(fd, STDOUT_FILENO);
 			gzip_flags = "-c";
 		} else {
+			if (zmlen > 0)
+				fd = gz_feed(fd);
 			dup2(fds[1], STDOUT_FILENO);
 			dup2(fd, STDIN_FILENO);
 			gzip_flags = "-dc";
@@ -1305,3 +1759,1094 @@ ar_start_gzip(int fd, const char *path, int wr)
 		/* NOTREACHED */
 	}
 }
+
+/*
+ * gz_feed()
+ *	in the child about to run gzip_program: hand it the bytes gz_magic()
+ *	read of a piped archive and then the rest of it, through a pipe filled
+ *	by a process of its own
+ * Return:
+ *	the file descriptor to read the whole archive from
+ */
+
+static int
+gz_feed(int fd)
+{
+	char buf[FILEBLK];
+	ssize_t n;
+	int fds[2];
+
+	if (pipe(fds) == -1)
+		err(1, "could not pipe");
+	switch (fork()) {
+	case -1:
+		err(1, "could not fork");
+	case 0:
+		close(fds[0]);
+		if (write(fds[1], zmagic, zmlen) != zmlen)
+			_exit(1);
+		while ((n = read(fd, buf, sizeof(buf))) > 0)
+			if (write(fds[1], buf, n) != n)
+				_exit(1);
+		_exit(n < 0);
+	default:
+		close(fds[1]);
+		close(fd);
+		return (fds[0]);
+	}
+}
+
+/*
+ * gz_magic()
+ *	check if the archive about to be read starts like a gzip file, so it
+ *	can be inflated in process. Anything else (compress(1) data, say) is
+ *	left to gzip_program. The bytes are read ahead of a pipe, and are
+ *	handed to whoever decompresses it.
+ * Return:
+ *	1 if the archive is gzip (or too short to tell), 0 otherwise
+ */
+
+static int
+gz_magic(void)
+{
+	u_char m[2];
+	off_t pos;
+	ssize_t n, res = 0;
+
+	zmlen = 0;
+	if ((pos = lseek(arfd, 0, SEEK_CUR)) >= 0) {
+		if ((n = pread(arfd, m, sizeof(m), pos)) < 0)
+			return (1);
+	} else {
+		for (n = 0; n < (ssize_t)sizeof(zmagic); n += res)
+			if ((res = read(arfd, zmagic + n,
+			    sizeof(zmagic) - n)) <= 0)
+				break;
+		zmlen = (int)n;
+		memcpy(m, zmagic, n);
+	}
+	return ((n < (ssize_t)sizeof(m)) || ((m[0] == 0x1f) && (m[1] == 0x8b)));
+}
+
+/*
+ * ar_zlib()
+ *	check if the archive is compressed by pax itself (with zlib) rather
+ *	than by running gzip_program. Only gzip is built in, the other
+ *	compressors (and gzip if the user asks for it) are run as a child.
+ * Return:
+ *	1 if compression is done in process, 0 otherwise
+ */
+
+int
+ar_zlib(void)
+{
+	return ((gzip_program != NULL) && gzip_builtin &&
+	    (strcmp(gzip_program, "gzip") == 0));
+}
+
+/*
+ * gz_open()
+ *	set up the in process compression (arz == ZWR) or decompression
+ *	(arz == ZRD) of the archive volume just opened. The compressed data
+ *	is moved in blocks of blksz, so writes to devices are whole records.
+ * Return:
+ *	0 if ready, -1 otherwise (the volume is closed)
+ */
+
+static int
+gz_open(void)
+{
+	int zret;
+
+	if ((zbuf == NULL) || (zbufsz != blksz)) {
+		free(zbuf);
+		zbufsz = blksz;
+		if ((zbuf = malloc(zbufsz)) == NULL) {
+			paxwarn(1, "Unable to allocate memory for compression");
+			goto out;
+		}
+	}
+	memset(&zs, 0, sizeof(zs));
+	if (arz == ZWR)
+		zret = deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+		    MAX_WBITS + 16, 8, Z_DEFAULT_STRATEGY);
+	else
+		zret = inflateInit2(&zs, MAX_WBITS + 16);
+	if (zret != Z_OK) {
+		paxwarn(1, "Unable to start gzip %scompression: %s",
+		    (arz == ZWR) ? "" : "de", zError(zret));
+		goto out;
+	}
+	if (gzthreads > 1)
+		gz_pstart();
+	zblen = zeof = zsend = zpar = zjlast = 0;
+	zmend = zfirst = 1;
+	zerr = NULL;
+	zupos = 0;
+	if ((artyp != ISREG) || ((zcpos = lseek(arfd, 0, SEEK_CUR)) < 0))
+		zcpos = 0;
+	zmbr[0].cpos = zcpos;
+	zmbr[0].upos = 0;
+	zmbr[1].cpos = -1;
+
+	/*
+	 * the bytes gz_magic() read ahead of a piped archive come first
+	 */
+	if ((arz == ZRD) && (zmlen > 0)) {
+		memcpy(zbuf, zmagic, zmlen);
+		zs.next_in = (Bytef *)zbuf;
+		zs.avail_in = zmlen;
+		zcpos += zmlen;
+		zmlen = 0;
+	}
+	return (0);
+
+out:
+	arz = 0;
+	(void)close(arfd);
+	arfd = -1;
+	can_unlnk = 0;
+	return (-1);
+}
+
+/*
+ * gz_close()
+ *	end the (de)compression of the archive volume. When writing, what is
+ *	left of the compressed stream is flushed and the last write to a
+ *	device is padded to a whole record. Nothing is written (or freed) in
+ *	a signal handler.
+ */
+
+static void
+gz_close(int in_sig)
+{
+	int zret;
+
+	if (in_sig)
+		return;
+	if (arz == ZRD) {
+		if (nzjob > 0)
+			gz_pstop();
+		(void)inflateEnd(&zs);
+		arz = 0;
+		return;
+	}
+
+	/*
+	 * if nothing went into the stream, leave the volume empty
+	 */
+	zs.avail_in = 0;
+	zret = (zs.total_in > 0) ? Z_OK : Z_STREAM_END;
+	if (nzjob > 0) {
+		if ((zjob[(zjhead + zjlen) % nzjob].inlen > 0) &&
+		    (gz_pqueue() < 0))
+			zret = Z_ERRNO;
+		else if (gz_pretire(0) < 0)
+			zret = Z_ERRNO;
+		gz_pstop();
+	}
+	while (zret == Z_OK) {
+		zs.next_out = (Bytef *)zbuf + zblen;
+		zs.avail_out = zbufsz - zblen;
+		zret = deflate(&zs, Z_FINISH);
+		zblen = zbufsz - zs.avail_out;
+		if ((zret == Z_OK) && (gz_flush() < 0))
+			zret = Z_ERRNO;
+	}
+	if ((zret != Z_ERRNO) && !ar_isstream() && (zblen % rdblksz)) {
+		memset(zbuf + zblen, 0, rdblksz - (zblen % rdblksz));
+		zblen += rdblksz - (zblen % rdblksz);
+	}
+	if ((zret == Z_ERRNO) || (gz_flush() < 0))
+		syswarn(1, errno, "Failed write to archive volume: %d", arvol);
+	(void)deflateEnd(&zs);
+	arz = 0;
+}
+
+/*
+ * gz_read()
+ *	read up to cnt bytes of uncompressed data from the archive volume. The
+ *	volume may hold several gzip members one after the other, anything
+ *	after the last member is ignored (it is usually record padding).
+ *	Errors in the compressed data stick, so the read-ahead thread and the
+ *	main thread see the same failure.
+ * Return:
+ *	Number of bytes in buffer. 0 for end of file, -1 for a read error or
+ *	flawed compressed data (zerr says which).
+ */
+
+static int
+gz_read(char *buf, int cnt)
+{
+	int res = 0;
+	int par;
+	int n;
+
+	if (zerr != NULL)
+		return (-1);
+	while ((res < cnt) && !zsend) {
+		/*
+		 * gz_sread() and gz_pread() stop early when the next member
+		 * is for the other one
+		 */
+		par = zpar;
+		if (par)
+			n = gz_pread(buf + res, cnt - res);
+		else
+			n = gz_sread(buf + res, cnt - res);
+		if (n < 0)
+			return ((res > 0) ? res : -1);
+		res += n;
+		if ((n == 0) && (zpar == par))
+			break;
+	}
+	return (res);
+}
+
+/*
+ * gz_sread()
+ *	decompress up to cnt bytes in the calling thread
+ * Return:
+ *	Number of bytes in buffer, -1 for a read error or flawed compressed
+ *	data
+ */
+
+static int
+gz_sread(char *buf, int cnt)
+{
+	int res;
+	int zret;
+	int rderr = 0;
+
+	zs.next_out = (Bytef *)buf;
+	zs.avail_out = cnt;
+	while ((zs.avail_out > 0) && !zsend) {
+		if ((zs.avail_in == 0) && !zeof) {
+			if (gz_fill(1) < 0) {
+				rderr = errno;
+				break;
+			}
+			continue;
+		}
+		if (zmend) {
+			/*
+			 * only another gzip member may follow a member (an
+			 * empty volume is ok)
+			 */
+			if ((zs.avail_in == 0) ||
+			    (!zfirst && (zs.next_in[0] != 0x1f))) {
+				zsend = 1;
+				break;
+			}
+			if (nzjob > 0) {
+				if (gz_fill(ZHDRSZ) < 0) {
+					rderr = errno;
+					break;
+				}
+				if (gz_pmarked(NULL)) {
+					zpar = 1;
+					break;
+				}
+			}
+			if (!zfirst) {
+				zmbr[1] = zmbr[0];
+				zmbr[0].cpos = zcpos - zs.avail_in;
+				zmbr[0].upos = zupos + (cnt - zs.avail_out);
+			}
+			(void)inflateReset(&zs);
+			zmend = zfirst = 0;
+		}
+		if (zs.avail_in == 0) {
+			zerr = "unexpected end of compressed data";
+			break;
+		}
+		if ((zret = inflate(&zs, Z_NO_FLUSH)) == Z_STREAM_END)
+			zmend = 1;
+		else if (zret != Z_OK) {
+			zerr = (zs.msg != NULL) ? zs.msg : zError(zret);
+			break;
+		}
+	}
+	res = cnt - zs.avail_out;
+	zupos += res;
+	if ((res > 0) || (zpar || zsend))
+		return (res);
+	if (rderr)
+		errno = rderr;
+	return (-1);
+}
+
+/*
+ * gz_fill()
+ *	make sure at least cnt bytes of compressed data are ready for
+ *	reading, unless the volume ends first
+ * Return:
+ *	0 if ok (or end of file), -1 for a read error
+ */
+
+static int
+gz_fill(int cnt)
+{
+	int res;
+
+	while ((zs.avail_in < (uInt)cnt) && !zeof) {
+		if (zs.avail_in > 0)
+			memmove(zbuf, zs.next_in, zs.avail_in);
+		zs.next_in = (Bytef *)zbuf;
+		if ((res = read(arfd, zbuf + zs.avail_in,
+		    zbufsz - zs.avail_in)) < 0)
+			return (-1);
+		if (res == 0)
+			zeof = 1;
+		zcpos += res;
+		zs.avail_in += res;
+	}
+	return (0);
+}
+
+/*
+ * gz_write()
+ *	compress cnt bytes into the archive volume. Compressed data is written
+ *	whenever a block of it is ready.
+ * Return:
+ *	cnt if ok, -1 if writing the archive failed
+ */
+
+static int
+gz_write(char *buf, int cnt)
+{
+	if (nzjob > 0)
+		return (gz_pwrite(buf, cnt));
+	zs.next_in = (Bytef *)buf;
+	zs.avail_in = cnt;
+	while (zs.avail_in > 0) {
+		zs.next_out = (Bytef *)zbuf + zblen;
+		zs.avail_out = zbufsz - zblen;
+		(void)deflate(&zs, Z_NO_FLUSH);
+		zblen = zbufsz - zs.avail_out;
+		if ((zblen == zbufsz) && (gz_flush() < 0))
+			return (-1);
+	}
+	return (cnt);
+}
+
+/*
+ * gz_flush()
+ *	write the compressed data waiting in zbuf to the archive volume
+ * Return:
+ *	0 if ok, -1 otherwise
+ */
+
+static int
+gz_flush(void)
+{
+	ssize_t res;
+	char *pt = zbuf;
+
+	while (zblen > 0) {
+		if ((res = write(arfd, pt, zblen)) <= 0) {
+			if (res == 0)
+				errno = ENOSPC;
+			return (-1);
+		}
+		pt += res;
+		zblen -= res;
+	}
+	return (0);
+}
+
+/*
+ * gz_out()
+ *	add cnt bytes of compressed data to zbuf, writing it out whenever it
+ *	is full
+ * Return:
+ *	0 if ok, -1 otherwise
+ */
+
+static int
+gz_out(char *buf, int cnt)
+{
+	int n;
+
+	while (cnt > 0) {
+		n = MINIMUM(cnt, zbufsz - zblen);
+		memcpy(zbuf + zblen, buf, n);
+		zblen += n;
+		buf += n;
+		cnt -= n;
+		if ((zblen == zbufsz) && (gz_flush() < 0))
+			return (-1);
+	}
+	return (0);
+}
+
+/*
+ * gz_pstart()
+ *	start the (de)compression threads for the mode in arz. If we cannot,
+ *	(de)compression just stays in the calling thread. The buffers for
+ *	decompression are sized as members come in.
+ */
+
+static void
+gz_pstart(void)
+{
+	sigset_t all, omask;
+	int i;
+
+	nzjob = 2 * gzthreads;
+	zjmode = arz;
+	if ((zjob = calloc(nzjob, sizeof(*zjob))) == NULL ||
+	    (zthr = calloc(gzthreads, sizeof(*zthr))) == NULL)
+		goto bad;
+	if (zjmode == ZWR) {
+		zjcap = deflateBound(&zs, ZBLK) + ZHDRSZ;
+		for (i = 0; i < nzjob; i++)
+			if (((zjob[i].in = malloc(ZBLK)) == NULL) ||
+			    ((zjob[i].out = malloc(zjcap)) == NULL))
+				goto bad;
+	}
+	zjhead = zjlen = zjend = 0;
+
+	/*
+	 * signals are handled by the main thread only
+	 */
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &omask);
+	for (nzthr = 0; nzthr < gzthreads; nzthr++)
+		if (pthread_create(&zthr[nzthr], NULL, gz_pthread, NULL) != 0)
+			break;
+	pthread_sigmask(SIG_SETMASK, &omask, NULL);
+	if (nzthr > 0)
+		return;
+
+bad:
+	gz_pstop();
+}
+
+/*
+ * gz_pstop()
+ *	stop the (de)compression threads (anything queued is lost) and go
+ *	back to (de)compression in the calling thread
+ */
+
+static void
+gz_pstop(void)
+{
+	int i;
+
+	pthread_mutex_lock(&zjmtx);
+	zjend = 1;
+	pthread_cond_broadcast(&zjwork);
+	pthread_mutex_unlock(&zjmtx);
+	for (i = 0; i < nzthr; i++)
+		pthread_join(zthr[i], NULL);
+	nzthr = 0;
+	if (zjob != NULL)
+		for (i = 0; i < nzjob; i++) {
+			free(zjob[i].in);
+			free(zjob[i].out);
+		}
+	free(zjob);
+	zjob = NULL;
+	free(zthr);
+	zthr = NULL;
+	nzjob = 0;
+}
+
+/*
+ * gz_pwrite()
+ *	gz_write() with compression threads. The data is added to the block
+ *	being filled, which is queued for a thread once full.
+ * Return:
+ *	cnt if ok, -1 if writing the archive failed
+ */
+
+static int
+gz_pwrite(char *buf, int cnt)
+{
+	struct zjob *zj;
+	int left = cnt;
+	int n;
+
+	while (left > 0) {
+		zj = &zjob[(zjhead + zjlen) % nzjob];
+		n = MINIMUM(left, ZBLK - zj->inlen);
+		memcpy(zj->in + zj->inlen, buf, n);
+		zj->inlen += n;
+		buf += n;
+		left -= n;
+		if ((zj->inlen == ZBLK) && (gz_pqueue() < 0))
+			return (-1);
+	}
+	return (cnt);
+}
+
+/*
+ * gz_pqueue()
+ *	queue the block being filled for the compression threads. The members
+ *	already compressed are written, and if all blocks are in use we wait
+ *	for the oldest one so there is a block to fill next.
+ * Return:
+ *	0 if ok, -1 if writing the archive failed
+ */
+
+static int
+gz_pqueue(void)
+{
+	pthread_mutex_lock(&zjmtx);
+	zjob[(zjhead + zjlen) % nzjob].state = ZJ_READY;
+	++zjlen;
+	pthread_cond_signal(&zjwork);
+	pthread_mutex_unlock(&zjmtx);
+	return (gz_pretire(nzjob - 1));
+}
+
+/*
+ * gz_pretire()
+ *	write the compressed members at the head of the queue, in order,
+ *	waiting for the threads until no more than keep blocks are queued
+ * Return:
+ *	0 if ok, -1 if writing the archive failed
+ */
+
+static int
+gz_pretire(int keep)
+{
+	struct zjob *zj;
+
+	pthread_mutex_lock(&zjmtx);
+	while (zjlen > 0) {
+		zj = &zjob[zjhead];
+		if (zj->state != ZJ_DONE) {
+			if (zjlen <= keep)
+				break;
+			pthread_cond_wait(&zjdone, &zjmtx);
+			continue;
+		}
+		pthread_mutex_unlock(&zjmtx);
+		if (zj->outlen < 0) {
+			paxwarn(1, "Unable to compress archive data");
+			errno = ENOMEM;
+			return (-1);
+		}
+		if (gz_out(zj->out, zj->outlen) < 0)
+			return (-1);
+		pthread_mutex_lock(&zjmtx);
+		zj->inlen = 0;
+		zj->state = ZJ_FREE;
+		zjhead = (zjhead + 1) % nzjob;
+		--zjlen;
+	}
+	pthread_mutex_unlock(&zjmtx);
+	return (0);
+}
+
+/*
+ * gz_pthread()
+ *	(de)compression thread. Takes the oldest queued job no other thread
+ *	is working on.
+ */
+
+static void *
+gz_pthread(void *arg)
+{
+	struct zjob *zj;
+	z_stream strm;
+	int zok;
+	int i;
+
+	memset(&strm, 0, sizeof(strm));
+	if (zjmode == ZWR)
+		zok = deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+		    -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+	else
+		zok = inflateInit2(&strm, MAX_WBITS + 16) == Z_OK;
+
+	pthread_mutex_lock(&zjmtx);
+	while (!zjend) {
+		zj = NULL;
+		for (i = 0; i < zjlen; i++)
+			if (zjob[(zjhead + i) % nzjob].state == ZJ_READY) {
+				zj = &zjob[(zjhead + i) % nzjob];
+				break;
+			}
+		if (zj == NULL) {
+			pthread_cond_wait(&zjwork, &zjmtx);
+			continue;
+		}
+		zj->state = ZJ_BUSY;
+		pthread_mutex_unlock(&zjmtx);
+
+		if (!zok) {
+			zj->outlen = -1;
+			zj->msg = "out of memory";
+		} else if (zjmode == ZWR)
+			gz_pdeflate(&strm, zj);
+		else
+			gz_pinflate(&strm, zj);
+
+		pthread_mutex_lock(&zjmtx);
+		zj->state = ZJ_DONE;
+		pthread_cond_broadcast(&zjdone);
+	}
+	pthread_mutex_unlock(&zjmtx);
+	if (zok) {
+		if (zjmode == ZWR)
+			(void)deflateEnd(&strm);
+		else
+			(void)inflateEnd(&strm);
+	}
+	return (NULL);
+}
+
+/*
+ * gz_pdeflate()
+ *	compress a block into a gzip member, with the size of the member in
+ *	the extra field of its header (see zhdr)
+ */
+
+static void
+gz_pdeflate(z_stream *strm, struct zjob *zj)
+{
+	u_char *out = (u_char *)zj->out;
+	u_int32_t len;
+
+	zj->outlen = -1;
+	if (deflateReset(strm) != Z_OK)
+		return;
+	strm->next_in = (Bytef *)zj->in;
+	strm->avail_in = zj->inlen;
+	strm->next_out = out + ZHDRSZ;
+	strm->avail_out = zjcap - ZHDRSZ - ZTRLSZ;
+	if (deflate(strm, Z_FINISH) != Z_STREAM_END)
+		return;
+	len = ZHDRSZ + strm->total_out + ZTRLSZ;
+	memcpy(out, zhdr, sizeof(zhdr));
+	gz_put32(out + sizeof(zhdr), len);
+	gz_put32(out + len - ZTRLSZ,
+	    crc32(crc32(0L, Z_NULL, 0), (Bytef *)zj->in, zj->inlen));
+	gz_put32(out + len - 4, zj->inlen);
+	zj->outlen = len;
+}
+
+/*
+ * gz_pinflate()
+ *	decompress a marked gzip member, which must fill exactly the size in
+ *	its trailer (queued in outlen)
+ */
+
+static void
+gz_pinflate(z_stream *strm, struct zjob *zj)
+{
+	int zret;
+	int len = zj->outlen;
+
+	zj->outlen = -1;
+	zj->msg = "invalid compressed data";
+	if (inflateReset(strm) != Z_OK)
+		return;
+	strm->next_in = (Bytef *)zj->in;
+	strm->avail_in = zj->inlen;
+	strm->next_out = (Bytef *)zj->out;
+	strm->avail_out = len;
+	if (((zret = inflate(strm, Z_FINISH)) == Z_STREAM_END) &&
+	    (strm->avail_in == 0) && (strm->avail_out == 0))
+		zj->outlen = len;
+	else if (strm->msg != NULL)
+		zj->msg = strm->msg;
+}
+
+/*
+ * gz_pread()
+ *	gz_read() with decompression threads. Marked members are queued for
+ *	the threads as far ahead as there are jobs, and returned in order.
+ *	When the next member is not marked, what is queued is returned and
+ *	the rest is left to gz_sread(). A member that failed is decompressed
+ *	here as far as it goes, so the data before the flaw is not lost.
+ * Return:
+ *	Number of bytes in buffer, -1 for a read error or flawed compressed
+ *	data
+ */
+
+static int
+gz_pread(char *buf, int cnt)
+{
+	struct zjob *zj;
+	int res = 0;
+	int n;
+
+	while (res < cnt) {
+		while (!zjlast && (zjlen < nzjob)) {
+			if ((n = gz_pqmember()) < 0)
+				return ((res > 0) ? res : -1);
+			if (n == 0)
+				zjlast = 1;
+		}
+		if (zjlen == 0) {
+			zpar = zjlast = 0;
+			break;
+		}
+
+		zj = &zjob[zjhead];
+		pthread_mutex_lock(&zjmtx);
+		while (zj->state != ZJ_DONE)
+			pthread_cond_wait(&zjdone, &zjmtx);
+		pthread_mutex_unlock(&zjmtx);
+		if (zj->outlen < 0)
+			gz_psalvage(zj);
+		if (zj->off == 0) {
+			zmbr[1] = zmbr[0];
+			zmbr[0].cpos = zj->cpos;
+			zmbr[0].upos = zupos;
+		}
+		n = MINIMUM(cnt - res, zj->outlen - zj->off);
+		memcpy(buf + res, zj->out + zj->off, n);
+		zj->off += n;
+		zupos += n;
+		res += n;
+		if (zj->off == zj->outlen) {
+			pthread_mutex_lock(&zjmtx);
+			zj->state = ZJ_FREE;
+			zjhead = (zjhead + 1) % nzjob;
+			--zjlen;
+			pthread_mutex_unlock(&zjmtx);
+			if (zj->err != NULL) {
+				zerr = zj->err;
+				return ((res > 0) ? res : -1);
+			}
+		}
+	}
+	return (res);
+}
+
+/*
+ * gz_psalvage()
+ *	decompress a marked member the threads could not (or which was cut
+ *	short) as gz_sread() would have: the data up to the flaw is returned
+ *	as usual and the flaw is reported after it (in err)
+ */
+
+static void
+gz_psalvage(struct zjob *zj)
+{
+	z_stream strm;
+	const char *msg = zj->msg;
+	char *pt;
+	size_t nsz;
+	int zret = Z_OK;
+
+	zj->outlen = 0;
+	zj->err = msg;
+	memset(&strm, 0, sizeof(strm));
+	if (inflateInit2(&strm, MAX_WBITS + 16) != Z_OK) {
+		zj->err = "out of memory";
+		return;
+	}
+	strm.next_in = (Bytef *)zj->in;
+	strm.avail_in = zj->inlen;
+	while (zret == Z_OK) {
+		if (zj->outlen == zj->outcap) {
+			nsz = MINIMUM(MAXIMUM(2 * (size_t)zj->outcap, ZBLK),
+			    ZMAXMBR);
+			if (zj->outcap >= ZMAXMBR) {
+				msg = "gzip member too large";
+				break;
+			}
+			if ((pt = realloc(zj->out, nsz)) == NULL) {
+				msg = "out of memory";
+				break;
+			}
+			zj->out = pt;
+			zj->outcap = nsz;
+		}
+		strm.next_out = (Bytef *)zj->out + zj->outlen;
+		strm.avail_out = zj->outcap - zj->outlen;
+		zret = inflate(&strm, Z_SYNC_FLUSH);
+		zj->outlen = zj->outcap - strm.avail_out;
+		if ((zret == Z_BUF_ERROR) && (strm.avail_out == 0))
+			zret = Z_OK;
+	}
+	if ((zret == Z_STREAM_END) && (strm.avail_in == 0))
+		msg = NULL;
+	else if ((zret != Z_OK) && (zret != Z_BUF_ERROR) &&
+	    (zret != Z_STREAM_END))
+		msg = (strm.msg != NULL) ? strm.msg : zError(zret);
+	zj->err = msg;
+	(void)inflateEnd(&strm);
+}
+
+/*
+ * gz_pqmember()
+ *	split the next member off the compressed data and queue it for the
+ *	decompression threads, if it is marked. A member that is cut short
+ *	(or too large for the threads) is queued as failed, for gz_pread()
+ *	to decompress what it can of it.
+ * Return:
+ *	1 if queued, 0 if the next member is not marked (or there is none),
+ *	-1 for a read error or flawed compressed data
+ */
+
+static int
+gz_pqmember(void)
+{
+	struct zjob *zj;
+	u_int32_t msz;
+	u_int32_t isz;
+	char *pt;
+	int n;
+
+	if (gz_fill(ZHDRSZ) < 0)
+		return (-1);
+	if (!gz_pmarked(&msz))
+		return (0);
+	zj = &zjob[(zjhead + zjlen) % nzjob];
+	if ((u_int32_t)zj->incap < msz) {
+		if ((pt = realloc(zj->in, msz)) == NULL) {
+			zerr = "out of memory";
+			return (-1);
+		}
+		zj->in = pt;
+		zj->incap = msz;
+	}
+
+	zj->cpos = zcpos - zs.avail_in;
+	zj->off = 0;
+	zj->err = NULL;
+	for (zj->inlen = 0; (u_int32_t)zj->inlen < msz; zj->inlen += n) {
+		if (gz_fill(1) < 0) {
+			zerr = strerror(errno);
+			return (-1);
+		}
+		if (zs.avail_in == 0) {
+			zj->msg = "unexpected end of compressed data";
+			goto bad;
+		}
+		n = MINIMUM(zs.avail_in, msz - zj->inlen);
+		memcpy(zj->in + zj->inlen, zs.next_in, n);
+		zs.next_in += n;
+		zs.avail_in -= n;
+	}
+	zmend = 1;
+
+	if ((isz = gz_get32((u_char *)zj->in + msz - 4)) > ZMAXMBR) {
+		zj->msg = "gzip member too large";
+		goto bad;
+	}
+	if ((zj->out == NULL) || ((u_int32_t)zj->outcap < isz)) {
+		if ((pt = realloc(zj->out, MAXIMUM(isz, 1))) == NULL) {
+			zerr = "out of memory";
+			return (-1);
+		}
+		zj->out = pt;
+		zj->outcap = MAXIMUM(isz, 1);
+	}
+	zj->outlen = isz;
+
+	pthread_mutex_lock(&zjmtx);
+	zj->state = ZJ_READY;
+	++zjlen;
+	pthread_cond_signal(&zjwork);
+	pthread_mutex_unlock(&zjmtx);
+	return (1);
+
+bad:
+	zmend = 1;
+	zj->outlen = -1;
+	pthread_mutex_lock(&zjmtx);
+	zj->state = ZJ_DONE;
+	++zjlen;
+	pthread_mutex_unlock(&zjmtx);
+	return (1);
+}
+
+/*
+ * gz_pmarked()
+ *	check if the compressed data to read starts with the header of a
+ *	member written by gz_pdeflate() (of a size we hand to the threads)
+ * Return:
+ *	1 if so (the member size is stored in msz), 0 otherwise
+ */
+
+static int
+gz_pmarked(u_int32_t *msz)
+{
+	u_int32_t len;
+
+	if ((zs.avail_in < ZHDRSZ) ||
+	    (memcmp(zs.next_in, zhdr, sizeof(zhdr)) != 0))
+		return (0);
+	len = gz_get32(zs.next_in + sizeof(zhdr));
+	if ((len < ZHDRSZ + ZTRLSZ) || (len > ZMAXMBR))
+		return (0);
+	if (msz != NULL)
+		*msz = len;
+	return (1);
+}
+
+/*
+ * gz_put32(), gz_get32()
+ *	store and load the little endian 32 bit numbers of gzip headers
+ */
+
+static void
+gz_put32(u_char *pt, u_int32_t val)
+{
+	pt[0] = val & 0xff;
+	pt[1] = (val >> 8) & 0xff;
+	pt[2] = (val >> 16) & 0xff;
+	pt[3] = (val >> 24) & 0xff;
+}
+
+static u_int32_t
+gz_get32(const u_char *pt)
+{
+	return (pt[0] | (pt[1] << 8) | (pt[2] << 16) |
+	    ((u_int32_t)pt[3] << 24));
+}
+
+/*
+ * gz_reread()
+ *	decompress gzip member mbr of the volume again from its start up to
+ *	the uncompressed offset upos. The data is written to fd, or thrown
+ *	away when fd is -1.
+ * Return:
+ *	0 if ok, -1 otherwise
+ */
+
+static int
+gz_reread(int mbr, off_t upos, int fd)
+{
+	int res;
+	char scbuf[MAXBLK];
+
+	if (lseek(arfd, zmbr[mbr].cpos, SEEK_SET) == -1) {
+		syswarn(1, errno, "Unable to seek archive backwards");
+		return (-1);
+	}
+	if (nzjob > 0)
+		gz_pstop();
+	(void)inflateReset(&zs);
+	zs.avail_in = 0;
+	zeof = zmend = zsend = zfirst = zpar = zjlast = 0;
+	zerr = NULL;
+	zcpos = zmbr[mbr].cpos;
+	zupos = zmbr[mbr].upos;
+	if (mbr != 0) {
+		zmbr[0] = zmbr[1];
+		zmbr[1].cpos = -1;
+	}
+
+	while (zupos < upos) {
+		if ((res = gz_read(scbuf, MINIMUM(upos - zupos,
+		    (off_t)sizeof(scbuf)))) <= 0) {
+			paxwarn(1, "Unable to read compressed archive again: "
+			    "%s", (zerr != NULL) ? zerr : strerror(errno));
+			return (-1);
+		}
+		if ((fd >= 0) && (write(fd, scbuf, res) != res)) {
+			syswarn(1, errno, "Failed write to temporary file");
+			return (-1);
+		}
+	}
+	return (0);
+}
+
+/*
+ * gz_rev()
+ *	move back sksz bytes in the uncompressed data of the volume. The
+ *	start of the gzip member holding the new position is found and the
+ *	member is decompressed up to it.
+ * Return:
+ *	0 if moved, -1 otherwise
+ */
+
+static int
+gz_rev(off_t sksz)
+{
+	off_t upos;
+
+	if ((upos = zupos - sksz) < 0) {
+		if (arvol > 1) {
+			paxwarn(1, "Reverse position on previous volume.");
+			return (-1);
+		}
+		upos = 0;
+	}
+	if (upos >= zmbr[0].upos)
+		return (gz_reread(0, upos, -1));
+	if ((zmbr[1].cpos >= 0) && (upos >= zmbr[1].upos))
+		return (gz_reread(1, upos, -1));
+	paxwarn(1, "Unable to move back in compressed archive.");
+	return (-1);
+}
+
+/*
+ * gz_append()
+ *	switch a compressed archive from reading to writing at the current
+ *	position (see ar_set_wr()). The gzip member holding the position is
+ *	cut off the archive. The uncompressed data of that member before the
+ *	position goes through a temporary file and is compressed again, as the
+ *	start of the new member the appended data is added to.
+ * Return:
+ *	0 if all ready to write, -1 otherwise
+ */
+
+static int
+gz_append(void)
+{
+	int fd = -1;
+	int res = 0;
+	off_t upos = zupos;
+	char scbuf[MAXBLK];
+
+	if (upos > zmbr[0].upos) {
+		memcpy(tempbase, _TFILE_BASE, sizeof(_TFILE_BASE));
+		if ((fd = mkstemp(tempfile)) == -1) {
+			syswarn(1, errno, "Unable to create temporary file: %s",
+			    tempfile);
+			return (-1);
+		}
+		(void)unlink(tempfile);
+		if ((gz_reread(0, upos, fd) < 0) ||
+		    (lseek(fd, 0, SEEK_SET) == -1))
+			goto out;
+	}
+	if (nzjob > 0)
+		gz_pstop();
+	(void)inflateEnd(&zs);
+	arz = 0;
+	if ((ftruncate(arfd, zmbr[0].cpos) == -1) ||
+	    (lseek(arfd, zmbr[0].cpos, SEEK_SET) == -1)) {
+		syswarn(1, errno, "Unable to truncate archive file");
+		goto out;
+	}
+	memset(&zs, 0, sizeof(zs));
+	if ((res = deflateInit2(&zs, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+	    MAX_WBITS + 16, 8, Z_DEFAULT_STRATEGY)) != Z_OK) {
+		paxwarn(1, "Unable to start gzip compression: %s",
+		    zError(res));
+		goto out;
+	}
+	arz = ZWR;
+	zblen = 0;
+	if (gzthreads > 1)
+		gz_pstart();
+	if (fd >= 0) {
+		while ((res = read(fd, scbuf, sizeof(scbuf))) > 0)
+			if (gz_write(scbuf, res) < 0)
+				break;
+		if (res != 0) {
+			syswarn(1, errno, "Unable to compress archive again");
+			(void)deflateEnd(&zs);
+			arz = 0;
+			goto out;
+		}
+		(void)close(fd);
+	}
+	return (0);
+
+out:
+	if (fd >= 0)
+		(void)close(fd);
+	return (-1);
+}
@@ -39,8 +39,11 @@
 
 #include <errno.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <sha2.h>
 #include <signal.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
@@ -48,7 +51,25 @@
 #include "extern.h"
 #include "pax.h"
 
+struct pfjob;
+
 static void wr_archive(ARCHD *, int is_app);
+static int ls_sel(ARCHD *, time_t);
+static int vfy_start(void);
+static int vfy_member(ARCHD *);
+static void vfy_end(void);
+static int xt_start(void);
+static int xt_file(ARCHD *, int, off_t *);
+static void xt_sync(void);
+static void xt_end(void);
+static int wr_file(ARCHD *, int *, struct pfjob *, time_t, int *);
+static int wr_queued(size_t, int, time_t, int *);
+static int pf_start(void);
+static size_t pf_want(ARCHD *);
+static struct pfjob *pf_next(size_t, int);
+static int pf_add(ARCHD *, size_t);
+static void pf_free(struct pfjob *);
+static void pf_end(void);
 static int get_arc(void);
 static int next_head(ARCHD *);
 extern sigset_t s_mask;
@@ -71,7 +92,6 @@ void
 list(void)
 {
 	ARCHD *arcn;
-	int res;
 	ARCHD archd = {0};
 	time_t now;
 
@@ -88,11 +108,26 @@ list(void)
 		return;
 
 	now = time(NULL);
+	if (verify && (vfy_start() < 0))
+		return;
+
+	/*
+	 * with a valid member index, the members are listed from it and the
+	 * archive is not read any further. listopt= may need keywords from
+	 * the headers and verify the digests, so they always read the archive.
+	 */
+	if ((idx_start() == 1) && (listopt_get() == NULL) && !verify) {
+		while (idx_next(arcn) == 0) {
+			if (ls_sel(arcn, now) < 0)
+				break;
+		}
+		goto done;
+	}
 
 	/*
 	 * step through the archive until the format says it is done
 	 */
-	while (next_head(arcn) == 0) {
+	while ((idx_seek() == 0) && (next_head(arcn) == 0)) {
 		/* Skip archive members rejected by invalid= policy. */
 		if (arcn->invalid == PAX_INVALID_SKIP) {
 			if (flcnt > 0)
@@ -112,30 +147,9 @@ list(void)
 			continue;
 		}
 
-		/*
-		 * check for pattern, and user specified options match.
-		 * When all patterns are matched we are done.
-		 */
-		if ((res = pat_match(arcn)) < 0)
+		if (ls_sel(arcn, now) < 0)
 			break;
 
-		if ((res == 0) && (sel_chk(arcn) == 0)) {
-			/*
-			 * pattern resulted in a selected file
-			 */
-			if (pat_sel(arcn) < 0)
-				break;
-
-			/*
-			 * modify the name as requested by the user if name
-			 * survives modification, do a listing of the file
-			 */
-			if ((res = mod_name(arcn)) < 0)
-				break;
-			if (res == 0)
-				ls_list(arcn, now, stdout);
-		}
-
 		/*
 		 * skip to next archive format header using values calculated
 		 * by the format header read routine
@@ -144,14 +158,1094 @@ list(void)
 			break;
 	}
 
+done:
 	/*
 	 * all done, let format have a chance to cleanup, and make sure that
 	 * the patterns supplied by the user were all matched
 	 */
+	if (verify)
+		vfy_end();
 	(void)(*frmt->end_rd)();
+	idx_end();
 	(void)sigprocmask(SIG_BLOCK, &s_mask, NULL);
 	ar_close(0);
 	pat_chk();
+	arcn_free(arcn);
+}
+
+/*
+ * ls_sel()
+ *	list an archive member (or with -o verify check its digest) if it
+ *	matches the user supplied pattern(s) and options.
+ * Return:
+ *	0 if ok, -1 when all patterns are matched or on error (we are done)
+ */
+
+static int
+ls_sel(ARCHD *arcn, time_t now)
+{
+	int res;
+
+	/*
+	 * check for pattern, and user specified options match.
+	 * When all patterns are matched we are done.
+	 */
+	if ((res = pat_match(arcn)) < 0)
+		return (-1);
+
+	if ((res == 0) && (sel_chk(arcn) == 0)) {
+		/*
+		 * pattern resulted in a selected file
+		 */
+		if (pat_sel(arcn) < 0)
+			return (-1);
+
+		/*
+		 * modify the name as requested by the user if name
+		 * survives modification, do a listing of the file
+		 */
+		if ((res = mod_name(arcn)) < 0)
+			return (-1);
+		if ((res == 0) && verify)
+			return (vfy_member(arcn));
+		if (res == 0)
+			ls_list(arcn, now, stdout);
+	}
+	return (0);
+}
+
+/*
+ * verify (-o verify) checks the digests of the members with a pool of
+ * hashing threads. Each member is a job, the results are reported in
+ * archive order. When checking against the archive the member data is
+ * read here and handed to the job in chunks. A digest is sequential, so
+ * a job is hashed by one thread at a time, the threads spread over the
+ * members instead.
+ */
+
+#define VFYCHUNK (256 * 1024)	/* size of a chunk of member data */
+#define VFY_OK 0		/* digest matches */
+#define VFY_BAD 1		/* digest does not match */
+#define VFY_NONE 2		/* member has no digest */
+#define VFY_INV 3		/* member has an invalid digest */
+#define VFY_ERR 4		/* data could not be read */
+
+struct vchunk {
+	struct vchunk *next;
+	int len;			/* bytes in data */
+	char data[VFYCHUNK];
+};
+
+struct vjob {
+	struct vjob *next;		/* next job in archive order */
+	char *name;			/* member name */
+	u_char want[DGSTLEN];		/* digest stored in the archive */
+	SHA2_CTX ctx;			/* digest of the data so far */
+	struct vchunk *head;		/* data not hashed yet */
+	struct vchunk *tail;
+	int busy;			/* a thread is hashing it */
+	int eof;			/* all of the data is queued */
+	int done;			/* res is valid */
+	int res;			/* VFY_* */
+	int err;			/* errno for VFY_ERR */
+};
+
+int hashthreads;			/* hashing threads, 0 for # of cpus */
+static pthread_mutex_t vmtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t vwork = PTHREAD_COND_INITIALIZER;	/* job to hash */
+static pthread_cond_t vdone = PTHREAD_COND_INITIALIZER;	/* progress */
+static struct vjob *vhead;		/* jobs in archive order */
+static struct vjob *vtail;
+static int nvjob;			/* jobs not reported yet */
+static int maxvjob;			/* jobs in flight */
+static struct vchunk *vfree;		/* free chunks */
+static pthread_t *vthr;
+static int nvthr;
+static int vend;
+static u_long vcnt;			/* members verified */
+static u_long vbad;			/* members that failed */
+
+/*
+ * vfy_file()
+ *	hash a file in the file system for a job
+ */
+
+static void
+vfy_file(struct vjob *vj, char *buf)
+{
+	int fd, res;
+
+	if ((fd = open(vj->name, O_RDONLY)) < 0) {
+		vj->res = VFY_ERR;
+		vj->err = errno;
+		return;
+	}
+	while ((res = read(fd, buf, VFYCHUNK)) > 0)
+		SHA256Update(&vj->ctx, (u_int8_t *)buf, res);
+	if (res < 0) {
+		vj->res = VFY_ERR;
+		vj->err = errno;
+	}
+	(void)close(fd);
+}
+
+/*
+ * vfy_work()
+ *	hash the queued data of one job that no other thread is working on,
+ *	or for the file system the whole file (read into a free chunk).
+ *	Called and returns with vmtx held.
+ * Return:
+ *	1 if a job was worked on, 0 if there is nothing to do
+ */
+
+static int
+vfy_work(void)
+{
+	struct vjob *vj;
+	struct vchunk *head, *tail, *vc;
+	u_char got[DGSTLEN];
+
+	for (vj = vhead; vj != NULL; vj = vj->next)
+		if (!vj->busy && !vj->done && ((vj->head != NULL) || vj->eof))
+			break;
+	if (vj == NULL)
+		return (0);
+	vj->busy = 1;
+	head = vj->head;
+	tail = vj->tail;
+	vj->head = vj->tail = NULL;
+	if (verify == VFY_FS) {
+		head = tail = vfree;
+		vfree = head->next;
+		head->next = NULL;
+		head->len = 0;
+	}
+	pthread_mutex_unlock(&vmtx);
+
+	if (verify == VFY_FS)
+		vfy_file(vj, head->data);
+	for (vc = head; vc != NULL; vc = vc->next)
+		SHA256Update(&vj->ctx, (u_int8_t *)vc->data, vc->len);
+
+	pthread_mutex_lock(&vmtx);
+	if (head != NULL) {
+		tail->next = vfree;
+		vfree = head;
+	}
+	if (vj->eof && (vj->head == NULL)) {
+		SHA256Final(got, &vj->ctx);
+		if ((vj->res == VFY_OK) && memcmp(got, vj->want, DGSTLEN))
+			vj->res = VFY_BAD;
+		vj->done = 1;
+	}
+	vj->busy = 0;
+	pthread_cond_broadcast(&vdone);
+	return (1);
+}
+
+/*
+ * vfy_pthread()
+ *	a hashing thread
+ */
+
+static void *
+vfy_pthread(void *arg)
+{
+	pthread_mutex_lock(&vmtx);
+	while (!vend)
+		if (!vfy_work())
+			pthread_cond_wait(&vwork, &vmtx);
+	pthread_mutex_unlock(&vmtx);
+	return (NULL);
+}
+
+/*
+ * vfy_report()
+ *	report the finished jobs at the head of the queue, as long as there
+ *	are more than left. Called and returns with vmtx held.
+ */
+
+static void
+vfy_report(int left)
+{
+	struct vjob *vj;
+
+	while (((vj = vhead) != NULL) && (nvjob > left)) {
+		if (!vj->done) {
+			pthread_cond_wait(&vdone, &vmtx);
+			continue;
+		}
+		if ((vhead = vj->next) == NULL)
+			vtail = NULL;
+		--nvjob;
+		if (vj->res != VFY_NONE)
+			++vcnt;
+		if (vj->res == VFY_ERR)
+			syswarn(0, vj->err, "Unable to read %s", vj->name);
+		if ((vj->res != VFY_OK) && (vj->res != VFY_NONE))
+			++vbad;
+		else if (!vflag) {
+			free(vj->name);
+			free(vj);
+			continue;
+		}
+		safe_print(vj->name, stdout);
+		switch (vj->res) {
+		case VFY_OK:
+			(void)fputs(": OK\n", stdout);
+			break;
+		case VFY_NONE:
+			(void)fputs(": no digest\n", stdout);
+			break;
+		case VFY_INV:
+			(void)fputs(": invalid digest\n", stdout);
+			break;
+		default:
+			(void)fputs(": FAILED\n", stdout);
+			break;
+		}
+		free(vj->name);
+		free(vj);
+	}
+}
+
+/*
+ * vfy_start()
+ *	start the hashing threads for -o verify. If none can be started the
+ *	members are hashed in the calling thread.
+ * Return:
+ *	0 if ok, -1 otherwise
+ */
+
+static int
+vfy_start(void)
+{
+	struct vchunk *vc;
+	sigset_t all, omask;
+	long ncpu;
+	int i, nthr;
+
+	if ((nthr = hashthreads) == 0) {
+		ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+		nthr = (int)MINIMUM(MAXIMUM(ncpu, 1), MAXHASHTHREADS);
+	}
+
+	/*
+	 * enough jobs and chunks in flight to keep all threads busy while
+	 * the archive is read. There is always a chunk for each thread to
+	 * read a file into.
+	 */
+	maxvjob = 4 * nthr;
+	for (i = 0; i < 4 * nthr; i++) {
+		if ((vc = malloc(sizeof(*vc))) == NULL) {
+			paxwarn(1, "Unable to allocate memory for verify");
+			return (-1);
+		}
+		vc->next = vfree;
+		vfree = vc;
+	}
+	if ((nthr == 1) || ((vthr = calloc(nthr, sizeof(*vthr))) == NULL))
+		return (0);
+
+	/*
+	 * signals are handled by the main thread only
+	 */
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &omask);
+	for (nvthr = 0; nvthr < nthr; nvthr++)
+		if (pthread_create(&vthr[nvthr], NULL, vfy_pthread, NULL) != 0)
+			break;
+	pthread_sigmask(SIG_SETMASK, &omask, NULL);
+	return (0);
+}
+
+/*
+ * vfy_member()
+ *	queue a member for verify. When checking against the archive the
+ *	member data is read (and so not skipped by the caller).
+ * Return:
+ *	0 if ok, -1 if the archive could not be read
+ */
+
+static int
+vfy_member(ARCHD *arcn)
+{
+	struct vjob *vj;
+	struct vchunk *vc;
+	const char *hex;
+	int cnt, ret = 0;
+
+	if (!PAX_IS_REG(arcn->type))
+		return (0);
+	if (((vj = calloc(1, sizeof(*vj))) == NULL) ||
+	    ((vj->name = strdup(arcn->name)) == NULL)) {
+		free(vj);
+		paxwarn(1, "Unable to allocate memory for verify");
+		return (-1);
+	}
+	SHA256Init(&vj->ctx);
+	if ((hex = pax_kv_lookup(arcn, DGSTKEY)) == NULL)
+		vj->res = VFY_NONE;
+	else if (dgst_unhex(hex, vj->want) < 0)
+		vj->res = VFY_INV;
+	if (vj->res != VFY_OK)
+		vj->done = 1;
+
+	pthread_mutex_lock(&vmtx);
+	vfy_report(maxvjob - 1);
+	if (vtail == NULL)
+		vhead = vj;
+	else
+		vtail->next = vj;
+	vtail = vj;
+	++nvjob;
+
+	/*
+	 * hand the member data to the job a chunk at a time
+	 */
+	while ((verify == VFY_ARC) && !vj->done && (arcn->skip > 0)) {
+		while ((vc = vfree) == NULL)
+			pthread_cond_wait(&vdone, &vmtx);
+		vfree = vc->next;
+		pthread_mutex_unlock(&vmtx);
+		cnt = (int)MINIMUM(arcn->skip, VFYCHUNK);
+		if ((cnt = rd_wrbuf(vc->data, cnt)) > 0)
+			arcn->skip -= cnt;
+		pthread_mutex_lock(&vmtx);
+		if (cnt <= 0) {
+			vc->next = vfree;
+			vfree = vc;
+			vj->res = VFY_ERR;
+			vj->err = EIO;
+			ret = -1;
+			break;
+		}
+		vc->next = NULL;
+		vc->len = cnt;
+		if (vj->tail == NULL)
+			vj->head = vc;
+		else
+			vj->tail->next = vc;
+		vj->tail = vc;
+		pthread_cond_signal(&vwork);
+		if (nvthr == 0)
+			(void)vfy_work();
+	}
+	vj->eof = 1;
+	pthread_cond_signal(&vwork);
+
+	/*
+	 * without threads the job is done right here
+	 */
+	if (nvthr == 0)
+		while (vfy_work())
+			;
+	pthread_mutex_unlock(&vmtx);
+	return (ret);
+}
+
+/*
+ * vfy_end()
+ *	wait for and report all the queued members, stop the threads
+ */
+
+static void
+vfy_end(void)
+{
+	struct vchunk *vc;
+	int i;
+
+	pthread_mutex_lock(&vmtx);
+	vfy_report(0);
+	vend = 1;
+	pthread_cond_broadcast(&vwork);
+	pthread_mutex_unlock(&vmtx);
+	for (i = 0; i < nvthr; i++)
+		pthread_join(vthr[i], NULL);
+	free(vthr);
+	vthr = NULL;
+	nvthr = 0;
+	while ((vc = vfree) != NULL) {
+		vfree = vc->next;
+		free(vc);
+	}
+	(void)fflush(stdout);
+	if (vbad > 0)
+		paxwarn(1, "%lu of %lu files failed verification", vbad, vcnt);
+}
+
+/*
+ * With -o xthreads the data of regular files is written by a pool of
+ * threads while the archive is read. Everything that changes the name
+ * space (creating the file, hard links, directories and symlinks) is
+ * still done by extract() in archive order, so a job is just a file that
+ * is open: the threads write the data, set the owner, mode and times and
+ * close it. The member data is copied out of the archive buffer (it may
+ * be a mapped window, which goes away as the archive is read) and handed
+ * to the job in chunks. Like verify, a job is worked on by one thread at
+ * a time. The threads are woken for a batch of files rather than for each
+ * one, most files being small and waking a thread a system call and a
+ * context switch. The calls for each file are still made one at a time;
+ * only the wakeups are batched.
+ */
+
+#define XCHUNK (256 * 1024)	/* largest chunk of member data */
+#define XBATCH 8		/* files queued before waking the threads */
+
+struct xchunk {
+	struct xchunk *next;
+	int len;			/* bytes in data */
+	char data[];
+};
+
+struct xjob {
+	struct xjob *next;
+	ARCHD arcn;			/* the member, for file_close() */
+	int fd;				/* file being written */
+	struct xchunk *head;		/* data not written yet */
+	struct xchunk *tail;
+	int busy;			/* a thread is writing it */
+	int eof;			/* all of the data is queued */
+	int rerr;			/* the archive could not be read */
+	int werr;			/* the file could not be written */
+	int sz;				/* file system block size */
+	int rem;			/* file_write() state */
+	int isem;
+	u_int32_t crc;			/* crc of the data so far */
+};
+
+int xthreads;				/* # of extract threads, 0 for none */
+static pthread_mutex_t xmtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t xwork = PTHREAD_COND_INITIALIZER;	/* to write */
+static pthread_cond_t xdone = PTHREAD_COND_INITIALIZER;	/* progress */
+static struct xjob *xhead;		/* jobs not finished */
+static struct xjob *xtail;
+static int nxjob;			/* jobs not finished */
+static int nxkick;			/* jobs queued since the last wake up */
+static int maxxjob;			/* jobs in flight */
+static size_t xmem;			/* member data queued */
+static size_t maxxmem;			/* member data in flight */
+static pthread_t *xthr;
+static int nxthr;
+static int xend;
+
+/*
+ * xt_write()
+ *	write a chunk of data to the file of a job
+ */
+
+static void
+xt_write(struct xjob *xj, struct xchunk *xc)
+{
+	struct stat sb;
+
+	if (xj->sz == 0) {
+		xj->sz = MINFBSZ;
+		if (fstat(xj->fd, &sb) < 0)
+			syswarn(0, errno, "Unable to obtain block size for "
+			    "file %s", xj->arcn.name);
+		else if (sb.st_blksize > 0)
+			xj->sz = (int)sb.st_blksize;
+		xj->rem = xj->sz;
+	}
+	if (file_write(xj->fd, xc->data, xc->len, &xj->rem, &xj->isem, xj->sz,
+	    xj->arcn.name) != xc->len) {
+		xj->werr = 1;
+		return;
+	}
+	if (docrc)
+		xj->crc = crc_sum(xj->crc, xc->data, xc->len);
+}
+
+/*
+ * xt_close()
+ *	finish the file of a job, as rd_wrfile() and file_close() do
+ */
+
+static void
+xt_close(struct xjob *xj)
+{
+	if (!xj->rerr && !xj->werr) {
+		if (xj->isem && (xj->arcn.sb.st_size > 0))
+			file_flush(xj->fd, xj->arcn.name, xj->isem);
+		if (docrc && (xj->arcn.crc != xj->crc))
+			paxwarn(1, "Actual crc does not match expected crc %s",
+			    xj->arcn.name);
+	}
+	file_close(&xj->arcn, xj->fd);
+}
+
+/*
+ * xt_work()
+ *	write the queued data of one job no other thread is working on, and
+ *	finish the job when all of it is written. Called and returns with
+ *	xmtx held.
+ * Return:
+ *	1 if a job was worked on, 0 if there is nothing to do
+ */
+
+static int
+xt_work(void)
+{
+	struct xjob *xj, **xp, *prev;
+	struct xchunk *head, *xc;
+	size_t len = 0;
+
+	for (xj = xhead; xj != NULL; xj = xj->next)
+		if (!xj->busy && ((xj->head != NULL) || xj->eof))
+			break;
+	if (xj == NULL)
+		return (0);
+	xj->busy = 1;
+	head = xj->head;
+	xj->head = xj->tail = NULL;
+	pthread_mutex_unlock(&xmtx);
+
+	while ((xc = head) != NULL) {
+		head = xc->next;
+		if (!xj->werr)
+			xt_write(xj, xc);
+		len += xc->len;
+		free(xc);
+	}
+
+	pthread_mutex_lock(&xmtx);
+	xmem -= len;
+	if (!xj->eof || (xj->head != NULL)) {
+		xj->busy = 0;
+		pthread_cond_broadcast(&xdone);
+		return (1);
+	}
+
+	/*
+	 * all the data is written, the job is done. Jobs in front of it may
+	 * have gone meanwhile, so look for it again
+	 */
+	prev = NULL;
+	for (xp = &xhead; *xp != xj; xp = &(*xp)->next)
+		prev = *xp;
+	if ((*xp = xj->next) == NULL)
+		xtail = prev;
+	pthread_mutex_unlock(&xmtx);
+	xt_close(xj);
+	arcn_free(&xj->arcn);
+	free(xj);
+	pthread_mutex_lock(&xmtx);
+	--nxjob;
+	pthread_cond_broadcast(&xdone);
+	return (1);
+}
+
+/*
+ * xt_pthread()
+ *	an extract thread
+ */
+
+static void *
+xt_pthread(void *arg)
+{
+	pthread_mutex_lock(&xmtx);
+	while (!xend)
+		if (!xt_work())
+			pthread_cond_wait(&xwork, &xmtx);
+	pthread_mutex_unlock(&xmtx);
+	return (NULL);
+}
+
+/*
+ * xt_kick()
+ *	wake the extract threads for the jobs queued since they were last
+ *	woken. Called with xmtx held.
+ */
+
+static void
+xt_kick(void)
+{
+	if (nxkick == 0)
+		return;
+	nxkick = 0;
+	pthread_cond_broadcast(&xwork);
+}
+
+/*
+ * xt_start()
+ *	start the extract threads for -o xthreads. If none can be started
+ *	the files are written by extract() as usual.
+ * Return:
+ *	0 if ok, -1 otherwise
+ */
+
+static int
+xt_start(void)
+{
+	sigset_t all, omask;
+
+	if (xthreads == 0)
+		return (0);
+	if ((xthr = calloc(xthreads, sizeof(*xthr))) == NULL) {
+		paxwarn(1, "Unable to allocate memory for extract threads");
+		return (-1);
+	}
+
+	/*
+	 * enough jobs and data in flight to keep all threads busy while the
+	 * archive is read
+	 */
+	maxxjob = 16 * xthreads;
+	maxxmem = (size_t)4 * XCHUNK * xthreads;
+
+	/*
+	 * signals are handled by the main thread only
+	 */
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &omask);
+	for (nxthr = 0; nxthr < xthreads; nxthr++)
+		if (pthread_create(&xthr[nxthr], NULL, xt_pthread, NULL) != 0)
+			break;
+	pthread_sigmask(SIG_SETMASK, &omask, NULL);
+	return (0);
+}
+
+/*
+ * xt_file()
+ *	hand a regular file just created to the extract threads, reading
+ *	its data from the archive. The file descriptor belongs to the job
+ *	from now on.
+ * Return:
+ *	0 if ok (left is set to the data not read, as with rd_wrfile()), -1
+ *	if the archive could not be read
+ */
+
+static int
+xt_file(ARCHD *arcn, int fd, off_t *left)
+{
+	struct xjob *xj;
+	struct xchunk *xc;
+	off_t size = arcn->sb.st_size;
+	int cnt, want, ret = 0;
+
+	*left = 0;
+	if ((xj = calloc(1, sizeof(*xj))) == NULL) {
+		ret = rd_wrfile(arcn, fd, left);
+		file_close(arcn, fd);
+		return (ret);
+	}
+
+	/*
+	 * the job keeps a copy of the member, with names of its own and
+	 * without the parts that belong to the archive read (they go away
+	 * with the next header)
+	 */
+	xj->arcn = *arcn;
+	xj->arcn.name = xj->arcn.ln_name = NULL;
+	xj->arcn.nsize = xj->arcn.lnsize = 0;
+	xj->arcn.org_name = NULL;
+	xj->arcn.pat = NULL;
+	xj->arcn.xattr = NULL;
+	xj->arcn.gattr = NULL;
+	xj->arcn.sp = NULL;
+	if (arcn_dup(&xj->arcn, arcn) < 0) {
+		arcn_free(&xj->arcn);
+		free(xj);
+		ret = rd_wrfile(arcn, fd, left);
+		file_close(arcn, fd);
+		return (ret);
+	}
+	xj->fd = fd;
+	xj->isem = 1;
+
+	pthread_mutex_lock(&xmtx);
+	while (nxjob >= maxxjob) {
+		xt_kick();
+		pthread_cond_wait(&xdone, &xmtx);
+	}
+	if (xtail == NULL)
+		xhead = xj;
+	else
+		xtail->next = xj;
+	xtail = xj;
+	++nxjob;
+
+	while (size > 0) {
+		want = (int)MINIMUM(size, XCHUNK);
+		while ((xmem > 0) && (xmem + want > maxxmem)) {
+			xt_kick();
+			pthread_cond_wait(&xdone, &xmtx);
+		}
+		xmem += want;
+		pthread_mutex_unlock(&xmtx);
+		cnt = 0;
+		if ((xc = malloc(sizeof(*xc) + want)) == NULL)
+			paxwarn(1, "Unable to allocate memory to extract %s",
+			    arcn->name);
+		else if ((cnt = rd_wrbuf(xc->data, want)) <= 0) {
+			free(xc);
+			xc = NULL;
+			ret = -1;
+		}
+		pthread_mutex_lock(&xmtx);
+		if (xc == NULL) {
+			xmem -= want;
+			*left = size;
+			break;
+		}
+		xmem -= want - cnt;
+		size -= cnt;
+		xc->next = NULL;
+		xc->len = cnt;
+		if (xj->tail == NULL)
+			xj->head = xc;
+		else
+			xj->tail->next = xc;
+		xj->tail = xc;
+
+		/*
+		 * a large file is written while the rest of it is read
+		 */
+		if (size > 0)
+			pthread_cond_signal(&xwork);
+	}
+	xj->eof = 1;
+	if (size > 0)
+		xj->rerr = 1;
+	if (++nxkick >= XBATCH)
+		xt_kick();
+	pthread_mutex_unlock(&xmtx);
+	return (ret);
+}
+
+/*
+ * xt_sync()
+ *	wait until the extract threads finished all the jobs
+ */
+
+static void
+xt_sync(void)
+{
+	if (nxthr == 0)
+		return;
+	pthread_mutex_lock(&xmtx);
+	xt_kick();
+	while (nxjob > 0)
+		pthread_cond_wait(&xdone, &xmtx);
+	pthread_mutex_unlock(&xmtx);
+}
+
+/*
+ * xt_end()
+ *	finish all the jobs and stop the extract threads
+ */
+
+static void
+xt_end(void)
+{
+	int i;
+
+	xt_sync();
+	pthread_mutex_lock(&xmtx);
+	xend = 1;
+	pthread_cond_broadcast(&xwork);
+	pthread_mutex_unlock(&xmtx);
+	for (i = 0; i < nxthr; i++)
+		pthread_join(xthr[i], NULL);
+	free(xthr);
+	xthr = NULL;
+	nxthr = 0;
+}
+
+/*
+ * With -o rdthreads the files are read by a pool of threads while the file
+ * tree is walked. wr_archive() still selects, links and renames the files
+ * in traversal order, but queues them as jobs instead of storing them
+ * right away. The threads open the regular files and read those that fit
+ * the prefetch budget (-o prefetch) into memory, with their crc and digest.
+ * The jobs are stored in the order they were queued, by wr_file() as
+ * usual, just from memory. A file that does not fit, or changed while it
+ * was read, is only opened and is read when it is stored.
+ */
+
+#define PF_QUEUED 0		/* to be opened and read */
+#define PF_BUSY 1		/* a thread is reading it */
+#define PF_DONE 2		/* ready to be stored */
+#define PFJOBS 128		/* most jobs (open files) in flight */
+
+struct pfjob {
+	struct pfjob *next;		/* next job in traversal order */
+	ARCHD arcn;			/* the member */
+	int state;			/* PF_* */
+	int fd;				/* open file, -1 if none */
+	int err;			/* errno if the open failed */
+	size_t want;			/* prefetch budget reserved */
+	char *buf;			/* file data if all of it was read */
+	u_int32_t crc;			/* crc of the data in buf */
+	u_char dgst[DGSTLEN];		/* digest of the data in buf */
+};
+
+int rdthreads;				/* # of file read threads, 0 for none */
+size_t prefetch = PREFETCH;		/* file data read ahead (-o prefetch) */
+static pthread_mutex_t pfmtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pfwork = PTHREAD_COND_INITIALIZER;	/* job queued */
+static pthread_cond_t pfdone = PTHREAD_COND_INITIALIZER;	/* job done */
+static struct pfjob *pfhead;		/* jobs in traversal order */
+static struct pfjob *pftail;
+static int npfjob;			/* jobs queued */
+static int maxpfjob;			/* jobs in flight */
+static size_t pfmem;			/* prefetch budget in use */
+static pthread_t *pfthr;
+static int npfthr;
+static int pfend;
+
+/*
+ * pf_read()
+ *	open the file of a job and, if budget was reserved for it, read all
+ *	of it. The file must still be as it was when it was walked, otherwise
+ *	it is left to wr_file() to complain about.
+ */
+
+static void
+pf_read(struct pfjob *pj)
+{
+	SHA2_CTX ctx;
+	struct stat sb;
+	off_t size = pj->arcn.sb.st_size;
+	off_t cnt = 0;
+	ssize_t res = 0;
+	char c;
+
+	if ((pj->fd = open(pj->arcn.org_name, O_RDONLY)) < 0) {
+		pj->err = errno;
+		return;
+	}
+	if (pj->want == 0)
+		return;
+	if ((pj->buf = malloc(MAXIMUM(size, 1))) == NULL)
+		return;
+	while ((cnt < size) &&
+	    ((res = read(pj->fd, pj->buf + cnt, size - cnt)) > 0))
+		cnt += res;
+	if ((res < 0) || (cnt != size) || (read(pj->fd, &c, 1) != 0) ||
+	    (fstat(pj->fd, &sb) < 0) ||
+	    timespeccmp(&pj->arcn.sb.st_mtim, &sb.st_mtim, !=) ||
+	    (lseek(pj->fd, 0, SEEK_SET) < 0)) {
+		free(pj->buf);
+		pj->buf = NULL;
+		(void)lseek(pj->fd, 0, SEEK_SET);
+		return;
+	}
+	if (docrc)
+		pj->crc = crc_sum(0, pj->buf, (int)size);
+	if (dodgst) {
+		SHA256Init(&ctx);
+		SHA256Update(&ctx, (u_int8_t *)pj->buf, size);
+		SHA256Final(pj->dgst, &ctx);
+	}
+}
+
+/*
+ * pf_pthread()
+ *	a file read thread, works on the queued jobs in traversal order
+ */
+
+static void *
+pf_pthread(void *arg)
+{
+	struct pfjob *pj;
+
+	pthread_mutex_lock(&pfmtx);
+	while (!pfend) {
+		for (pj = pfhead; pj != NULL; pj = pj->next)
+			if (pj->state == PF_QUEUED)
+				break;
+		if (pj == NULL) {
+			pthread_cond_wait(&pfwork, &pfmtx);
+			continue;
+		}
+		pj->state = PF_BUSY;
+		pthread_mutex_unlock(&pfmtx);
+		pf_read(pj);
+		pthread_mutex_lock(&pfmtx);
+		if (pj->buf == NULL) {
+			pfmem -= pj->want;
+			pj->want = 0;
+		}
+		pj->state = PF_DONE;
+		pthread_cond_broadcast(&pfdone);
+	}
+	pthread_mutex_unlock(&pfmtx);
+	return (NULL);
+}
+
+/*
+ * pf_start()
+ *	start the file read threads for -o rdthreads. They are not used with
+ *	-i, the files would be read before the user is asked about them.
+ * Return:
+ *	0 if ok, -1 otherwise
+ */
+
+static int
+pf_start(void)
+{
+	sigset_t all, omask;
+
+	if ((rdthreads == 0) || iflag)
+		return (0);
+	if ((pfthr = calloc(rdthreads, sizeof(*pfthr))) == NULL) {
+		paxwarn(1, "Unable to allocate memory for read threads");
+		return (-1);
+	}
+	maxpfjob = MINIMUM(16 * rdthreads, PFJOBS);
+
+	/*
+	 * signals are handled by the main thread only
+	 */
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &omask);
+	for (npfthr = 0; npfthr < rdthreads; npfthr++)
+		if (pthread_create(&pfthr[npfthr], NULL, pf_pthread, NULL) != 0)
+			break;
+	pthread_sigmask(SIG_SETMASK, &omask, NULL);
+	return (0);
+}
+
+/*
+ * pf_want()
+ *	the prefetch budget to reserve for a member: regular files up to a
+ *	quarter of the budget (and no larger than the largest i/o) are read
+ *	into memory.
+ * Return:
+ *	bytes to reserve, 0 if the member is not read ahead
+ */
+
+static size_t
+pf_want(ARCHD *arcn)
+{
+	if (!PAX_IS_REG(arcn->type) ||
+	    (arcn->sb.st_size > (off_t)MINIMUM(prefetch / 4, MAXIOBLK)))
+		return (0);
+	return (MAXIMUM(arcn->sb.st_size, 1));
+}
+
+/*
+ * pf_next()
+ *	take the job at the head of the queue when it is done. If it is not,
+ *	it is waited for when the queue is full or want more budget is
+ *	needed than is left. With wait set it is always waited for.
+ * Return:
+ *	the job, NULL if there is none to store now
+ */
+
+static struct pfjob *
+pf_next(size_t want, int wait)
+{
+	struct pfjob *pj;
+
+	pthread_mutex_lock(&pfmtx);
+	while ((pj = pfhead) != NULL) {
+		if (pj->state == PF_DONE) {
+			if ((pfhead = pj->next) == NULL)
+				pftail = NULL;
+			--npfjob;
+			break;
+		}
+		if (!wait && (npfjob < maxpfjob) &&
+		    ((pfmem == 0) || (pfmem + want <= prefetch))) {
+			pj = NULL;
+			break;
+		}
+		pthread_cond_wait(&pfdone, &pfmtx);
+	}
+	pthread_mutex_unlock(&pfmtx);
+	return (pj);
+}
+
+/*
+ * pf_add()
+ *	queue a member, with the budget pf_next() made room for. Only the
+ *	regular files are given to the threads, the rest is ready to store.
+ * Return:
+ *	0 if ok, -1 if out of memory
+ */
+
+static int
+pf_add(ARCHD *arcn, size_t want)
+{
+	struct pfjob *pj;
+
+	if ((pj = calloc(1, sizeof(*pj))) == NULL) {
+		paxwarn(1, "Unable to allocate memory for read threads");
+		return (-1);
+	}
+	pj->arcn = *arcn;
+	pj->arcn.name = pj->arcn.ln_name = NULL;
+	pj->arcn.nsize = pj->arcn.lnsize = 0;
+	if ((arcn_dup(&pj->arcn, arcn) < 0) ||
+	    ((pj->arcn.org_name = strdup(arcn->org_name)) == NULL)) {
+		arcn_free(&pj->arcn);
+		free(pj);
+		paxwarn(1, "Unable to allocate memory for read threads");
+		return (-1);
+	}
+	pj->fd = -1;
+	pj->want = want;
+	pj->state = PAX_IS_REG(arcn->type) ? PF_QUEUED : PF_DONE;
+
+	pthread_mutex_lock(&pfmtx);
+	pfmem += want;
+	if (pftail == NULL)
+		pfhead = pj;
+	else
+		pftail->next = pj;
+	pftail = pj;
+	++npfjob;
+	if (pj->state == PF_QUEUED)
+		pthread_cond_signal(&pfwork);
+	pthread_mutex_unlock(&pfmtx);
+	return (0);
+}
+
+/*
+ * pf_free()
+ *	release a job that was taken off the queue, closing its file
+ */
+
+static void
+pf_free(struct pfjob *pj)
+{
+	rdfile_close(&pj->arcn, &pj->fd);
+	pthread_mutex_lock(&pfmtx);
+	pfmem -= pj->want;
+	pthread_mutex_unlock(&pfmtx);
+	free(pj->buf);
+	free(pj->arcn.org_name);
+	arcn_free(&pj->arcn);
+	free(pj);
+}
+
+/*
+ * pf_end()
+ *	drop the jobs that were not stored and stop the file read threads
+ */
+
+static void
+pf_end(void)
+{
+	struct pfjob *pj;
+	int i;
+
+	if (npfthr == 0)
+		return;
+	while ((pj = pf_next(0, 1)) != NULL)
+		pf_free(pj);
+	pthread_mutex_lock(&pfmtx);
+	pfend = 1;
+	pthread_cond_broadcast(&pfwork);
+	pthread_mutex_unlock(&pfmtx);
+	for (i = 0; i < npfthr; i++)
+		pthread_join(pfthr[i], NULL);
+	free(pfthr);
+	pfthr = NULL;
+	npfthr = 0;
 }
 
 static int
@@ -245,14 +1339,18 @@ extract(void)
 	 */
 	if (iflag && (name_start() < 0))
 		return;
+	if (xt_start() < 0)
+		return;
 
 	now = time(NULL);
 
 	/*
 	 * step through each entry on the archive until the format read routine
-	 * says it is done
+	 * says it is done. With a member index we go straight to the members
+	 * which may be selected.
 	 */
-	while (next_head(arcn) == 0) {
+	(void)idx_start();
+	while ((idx_seek() == 0) && (next_head(arcn) == 0)) {
 		/* Honor invalid=bypass by skipping unwanted members outright.
 		 */
 		if (arcn->invalid == PAX_INVALID_SKIP) {
@@ -296,8 +1394,11 @@ extract(void)
 		 * specified by pax. this operation can be confusing to the
 		 * user who might expect the test to be done on an existing
 		 * file AFTER the name mod. In honesty the pax spec is probably
-		 * flawed in this respect.
+		 * flawed in this respect. A file still being written by the
+		 * extract threads does not have its times yet.
 		 */
+		if (uflag || Dflag)
+			xt_sync();
 		if ((uflag || Dflag) &&
 		    cmp_file_times(uflag, Dflag, arcn, NULL)) {
 			(void)rd_skip(arcn->skip + arcn->pad);
@@ -322,6 +1423,8 @@ extract(void)
 		 * Non standard -Y and -Z flag. When the existing file is
 		 * same age or newer skip
 		 */
+		if (Yflag || Zflag)
+			xt_sync();
 		if ((Yflag || Zflag) &&
 		    cmp_file_times(Yflag, Zflag, arcn, NULL)) {
 			(void)rd_skip(arcn->skip + arcn->pad);
@@ -331,7 +1434,14 @@ extract(void)
 		if (vflag) {
 			if (vflag > 1)
 				ls_list(arcn, now, listf);
-			else {
+			else if (nxthr > 0) {
+				/*
+				 * the extract threads may warn at any time,
+				 * do not leave a line open for them
+				 */
+				(void)safe_print(arcn->name, listf);
+				(void)putc('\n', listf);
+			} else {
 				(void)safe_print(arcn->name, listf);
 				vfpart = 1;
 			}
@@ -340,10 +1450,12 @@ extract(void)
 		/*
 		 * if required, chdir around.
 		 */
-		if ((arcn->pat != NULL) && (arcn->pat->chdname != NULL))
+		if ((arcn->pat != NULL) && (arcn->pat->chdname != NULL)) {
 			if (chdir(arcn->pat->chdname) != 0)
 				syswarn(1, errno, "Cannot chdir to %s",
 				    arcn->pat->chdname);
+			pdir_flush();
+		}
 
 		/*
 		 * all ok, extract this member based on type
@@ -380,10 +1492,16 @@ extract(void)
 		}
 		/*
 		 * extract the file from the archive and skip over padding and
-		 * any unprocessed data
+		 * any unprocessed data. Sparse and byte swapped files are
+		 * always written here.
 		 */
-		res = rd_wrfile(arcn, fd, &cnt);
-		file_close(arcn, fd);
+		if ((nxthr > 0) && (arcn->spcnt == 0) && !swapbytes &&
+		    !swaphalf)
+			res = xt_file(arcn, fd, &cnt);
+		else {
+			res = rd_wrfile(arcn, fd, &cnt);
+			file_close(arcn, fd);
+		}
 		if (vflag && vfpart) {
 			(void)putc('\n', listf);
 			vfpart = 0;
@@ -395,10 +1513,12 @@ extract(void)
 		/*
 		 * if required, chdir around.
 		 */
-		if ((arcn->pat != NULL) && (arcn->pat->chdname != NULL))
+		if ((arcn->pat != NULL) && (arcn->pat->chdname != NULL)) {
 			if (fchdir(cwdfd) != 0)
 				syswarn(1, errno,
 				    "Can't fchdir to starting directory");
+			pdir_flush();
+		}
 	}
 
 	/*
@@ -406,12 +1526,15 @@ extract(void)
 	 * all patterns supplied by the user were matched; block off signals
 	 * to avoid chance for multiple entry into the cleanup code.
 	 */
+	xt_end();
 	(void)(*frmt->end_rd)();
+	idx_end();
 	(void)sigprocmask(SIG_BLOCK, &s_mask, NULL);
 	ar_close(0);
 	sltab_process(0);
 	proc_dir(0);
 	pat_chk();
+	arcn_free(arcn);
 }
 
 /*
@@ -426,9 +1549,8 @@ wr_archive(ARCHD *arcn, int is_app)
 	int res;
 	int hlk;
 	int wr_one;
-	off_t cnt;
-	int (*wrf)(ARCHD *);
 	int fd = -1;
+	size_t want;
 	time_t now;
 
 	/*
@@ -454,14 +1576,14 @@ wr_archive(ARCHD *arcn, int is_app)
 	} else if (((*frmt->st_wr)() < 0))
 		return;
 
-	wrf = frmt->wr;
-
 	/*
 	 * When we are doing interactive rename, we store the mapping of names
 	 * so we can fix up hard links files later in the archive.
 	 */
 	if (iflag && (name_start() < 0))
 		return;
+	if (pf_start() < 0)
+		return;
 
 	now = time(NULL);
 
@@ -513,6 +1635,27 @@ wr_archive(ARCHD *arcn, int is_app)
 			continue;
 		}
 
+		/*
+		 * with the read threads, queue the file behind the ones in
+		 * flight, storing those that are ready (or have to be, to make
+		 * room). A file that may be linked to later is stored right
+		 * away, so the link table is purged in time if it fails.
+		 */
+		if (npfthr > 0) {
+			if ((arcn->type != PAX_HRG) &&
+			    !(hlk && PAX_IS_REG(arcn->type) &&
+			    (arcn->sb.st_nlink > 1))) {
+				want = pf_want(arcn);
+				if (wr_queued(want, 0, now, &wr_one) < 0)
+					goto trailer;
+				if (pf_add(arcn, want) < 0)
+					break;
+				continue;
+			}
+			if (wr_queued(0, 1, now, &wr_one) < 0)
+				goto trailer;
+		}
+
 		if (PAX_IS_REG(arcn->type) || (arcn->type == PAX_HRG)) {
 			/*
 			 * we will have to read this file. by opening it now we
@@ -528,73 +1671,15 @@ wr_archive(ARCHD *arcn, int is_app)
 			}
 		}
 
-		if (docrc && (set_crc(arcn, fd) < 0)) {
-			/*
-			 * unable to obtain the crc we need, close the file,
-			 * purge link table entry
-			 */
-			rdfile_close(arcn, &fd);
-			purg_lnk(arcn);
-			continue;
-		}
-
-		if (vflag) {
-			if (vflag > 1)
-				ls_list(arcn, now, listf);
-			else {
-				(void)safe_print(arcn->name, listf);
-				vfpart = 1;
-			}
-		}
-		++flcnt;
-
-		/*
-		 * looks safe to store the file, have the format specific
-		 * routine write routine store the file header on the archive
-		 */
-		if ((res = (*wrf)(arcn)) < 0) {
-			rdfile_close(arcn, &fd);
-			break;
-		}
-		wr_one = 1;
-		if (res > 0) {
-			/*
-			 * format write says no file data needs to be stored
-			 * so we are done messing with this file
-			 */
-			if (vflag && vfpart) {
-				(void)putc('\n', listf);
-				vfpart = 0;
-			}
-			rdfile_close(arcn, &fd);
-			continue;
-		}
-
-		/*
-		 * Add file data to the archive, quit on write error. if we
-		 * cannot write the entire file contents to the archive we
-		 * must pad the archive to replace the missing file data
-		 * (otherwise during an extract the file header for the file
-		 * which FOLLOWS this one will not be where we expect it to
-		 * be).
-		 */
-		res = wr_rdfile(arcn, fd, &cnt);
-		rdfile_close(arcn, &fd);
-		if (vflag && vfpart) {
-			(void)putc('\n', listf);
-			vfpart = 0;
-		}
-		if (res < 0)
-			break;
-
-		/*
-		 * pad as required, cnt is number of bytes not written
-		 */
-		if (((cnt > 0) && (wr_skip(cnt) < 0)) ||
-		    ((arcn->pad > 0) && (wr_skip(arcn->pad) < 0)))
+		if (wr_file(arcn, &fd, NULL, now, &wr_one) < 0)
 			break;
 	}
 
+	/*
+	 * store what is still queued for the read threads
+	 */
+	(void)wr_queued(0, 1, now, &wr_one);
+
 trailer:
 	/*
 	 * tell format to write trailer; pad to block boundary; reset directory
@@ -602,6 +1687,7 @@ trailer:
 	 * were matched. block off signals to avoid chance for multiple entry
 	 * into the cleanup code
 	 */
+	pf_end();
 	if (wr_one) {
 		(*frmt->end_wr)();
 		wr_fin();
@@ -613,6 +1699,148 @@ trailer:
 	ftree_chk();
 }
 
+/*
+ * wr_file()
+ *	store a member selected by wr_archive(): its header and, for a regular
+ *	file, the data from the open file fd, or from memory if the read
+ *	threads read it ahead (pj). fd is closed when done. wr_one is set once
+ *	a header was written.
+ * Return:
+ *	0 if ok (or the file was skipped), -1 if the archive write failed
+ */
+
+static int
+wr_file(ARCHD *arcn, int *fd, struct pfjob *pj, time_t now, int *wr_one)
+{
+	int res;
+	off_t cnt;
+
+	if ((pj != NULL) && (pj->err != 0)) {
+		syswarn(1, pj->err, "Unable to open %s to read",
+		    arcn->org_name);
+		purg_lnk(arcn);
+		return (0);
+	}
+
+	/*
+	 * if the format can store sparse files, see if this is one. Only the
+	 * data extents of a sparse file are stored, so the data read ahead
+	 * (and its crc and digest) is of no use then.
+	 */
+	arcn->spcnt = 0;
+	if (frmt->sparse && PAX_IS_REG(arcn->type))
+		sp_map(arcn, *fd);
+	if ((pj != NULL) && (pj->buf != NULL) && (arcn->spcnt > 0)) {
+		free(pj->buf);
+		pj->buf = NULL;
+	}
+
+	if ((pj != NULL) && (pj->buf != NULL)) {
+		arcn->crc = pj->crc;
+		memcpy(arcn->dgst, pj->dgst, sizeof(arcn->dgst));
+	} else if ((docrc || (dodgst && PAX_IS_REG(arcn->type) &&
+	    (arcn->spcnt == 0))) && (set_crc(arcn, *fd) < 0)) {
+		/*
+		 * unable to obtain the crc we need, close the file,
+		 * purge link table entry
+		 */
+		rdfile_close(arcn, fd);
+		purg_lnk(arcn);
+		return (0);
+	}
+
+	if (vflag) {
+		if (vflag > 1)
+			ls_list(arcn, now, listf);
+		else {
+			(void)safe_print(arcn->name, listf);
+			vfpart = 1;
+		}
+	}
+	++flcnt;
+
+	/*
+	 * looks safe to store the file, have the format specific
+	 * routine write routine store the file header on the archive
+	 */
+	if ((res = (*frmt->wr)(arcn)) < 0) {
+		wr_spooled(-1);
+		rdfile_close(arcn, fd);
+		return (-1);
+	}
+	*wr_one = 1;
+	if (res > 0) {
+		/*
+		 * format write says no file data needs to be stored
+		 * so we are done messing with this file (and with what
+		 * set_crc() may have read of it)
+		 */
+		wr_spooled(-1);
+		if (vflag && vfpart) {
+			(void)putc('\n', listf);
+			vfpart = 0;
+		}
+		rdfile_close(arcn, fd);
+		return (0);
+	}
+
+	/*
+	 * Add file data to the archive, quit on write error. if we
+	 * cannot write the entire file contents to the archive we
+	 * must pad the archive to replace the missing file data
+	 * (otherwise during an extract the file header for the file
+	 * which FOLLOWS this one will not be where we expect it to
+	 * be).
+	 */
+	if ((pj != NULL) && (pj->buf != NULL)) {
+		res = wr_rdbuf(pj->buf, (int)arcn->sb.st_size);
+		cnt = 0;
+	} else
+		res = wr_rdfile(arcn, *fd, &cnt);
+	rdfile_close(arcn, fd);
+	if (vflag && vfpart) {
+		(void)putc('\n', listf);
+		vfpart = 0;
+	}
+	if (res < 0)
+		return (-1);
+
+	/*
+	 * pad as required, cnt is number of bytes not written
+	 */
+	if (((cnt > 0) && (wr_skip(cnt) < 0)) ||
+	    ((arcn->pad > 0) && (wr_skip(arcn->pad) < 0)))
+		return (-1);
+	if (docrc)
+		crc_patch(arcn);
+	if (dodgst)
+		dgst_patch(arcn);
+	return (0);
+}
+
+/*
+ * wr_queued()
+ *	store the members queued for the read threads that are ready, see
+ *	pf_next() for want and wait
+ * Return:
+ *	0 if ok, -1 if the archive write failed
+ */
+
+static int
+wr_queued(size_t want, int wait, time_t now, int *wr_one)
+{
+	struct pfjob *pj;
+	int res;
+
+	while ((pj = pf_next(want, wait)) != NULL) {
+		res = wr_file(&pj->arcn, &pj->fd, pj, now, wr_one);
+		pf_free(pj);
+		if (res < 0)
+			return (-1);
+	}
+	return (0);
+}
+
 /*
  * append()
  *	Add file to previously written archive. Archive format specified by the
@@ -773,6 +2001,7 @@ append(void)
 	 * go to the writing phase to add the new members
 	 */
 	wr_archive(arcn, 1);
+	arcn_free(arcn);
 }
 
 /*
@@ -796,6 +2025,7 @@ archive(void)
 		return;
 
 	wr_archive(&archd, 0);
+	arcn_free(&archd);
 }
 
 /*
@@ -868,7 +2098,8 @@ copy(void)
 	/*
 	 * set up to cp file trees
 	 */
-	cp_start();
+	if (cp_start() < 0)
+		return;
 
 	/*
 	 * while there are files to archive, process them
@@ -1019,6 +2250,7 @@ copy(void)
 	sltab_process(0);
 	proc_dir(0);
 	ftree_chk();
+	arcn_free(arcn);
 }
 
 /*
@@ -1059,6 +2291,7 @@ next_head(ARCHD *arcn)
 	pax_kv_free(&arcn->xattr);
 	arcn->gattr = NULL;
 	arcn->invalid = PAX_INVALID_NONE;
+	idx_mark();
 
 	/*
 	 * set up initial conditions, we want a whole frmt->hsz block as we
@@ -1083,8 +2316,10 @@ next_head(ARCHD *arcn)
 			 * end marker.  It's just stupid to error out on
 			 * them, so exit gracefully.
 			 */
-			if (first && ret == 0)
+			if (first && ret == 0) {
+				idx_done();
 				return (-1);
+			}
 			first = 0;
 
 			/*
@@ -1105,6 +2340,7 @@ next_head(ARCHD *arcn)
 				paxwarn(
 				    1, "Archive I/O error. Trying to recover.");
 				++in_resync;
+				idx_drop();
 			}
 
 			/*
@@ -1138,6 +2374,7 @@ next_head(ARCHD *arcn)
 				/*
 				 * valid trailer found, drain input as required
 				 */
+				idx_done();
 				ar_drain();
 				return (-1);
 			}
@@ -1172,6 +2409,7 @@ next_head(ARCHD *arcn)
 			paxwarn(
 			    1, "Invalid header, starting valid header search.");
 			++in_resync;
+			idx_drop();
 		}
 		memmove(hdbuf, hdbuf + 1, shftsz);
 		res = 1;
@@ -1187,10 +2425,12 @@ next_head(ARCHD *arcn)
 		/*
 		 * valid trailer found, drain input as required
 		 */
+		idx_done();
 		ar_drain();
 		return (-1);
 	}
 
+	idx_add(arcn);
 	++flcnt;
 	return (0);
 }
@@ -34,10 +34,17 @@
  * SUCH DAMAGE.
  */
 
+#include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
 
 #include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -50,31 +57,121 @@
  * routines which implement archive and file buffering
  */
 
+static int buf_alloc(void);
 static int buf_fill(void);
 static int buf_flush(int);
+static int cp_kern(int, int, int, off_t *);
+static void wrq_start(void);
+static int wrq_put(void);
+static int wrq_stop(void);
+static int wrq_sync(void);
+static void *wrq_thread(void *);
+static void rdq_start(void);
+static int rdq_take(int);
+static off_t rdq_skip(off_t);
+static void rdq_stop(void);
+static void *rdq_thread(void *);
 static void apply_swaps(char *, size_t, int);
 static void swap_bytes(char *, size_t);
 static void swap_halfwords(char *, size_t);
 
-#define MINFBSZ 512 /* default block size for hole detect */
 #define MAXFLT 10   /* default media read error limit */
 
 /*
- * Need to change bufmem to dynamic allocation when the upper
- * limit on blocking size is removed (though that will violate pax spec)
- * MAXBLK define and tests will also need to be updated.
+ * bufmem is allocated on first use. It holds the largest tape record
+ * (MAXBLK) or the i/o size used on files and pipes (iosz), whichever is
+ * larger, plus the pushback space in front of buf.
  */
-static char bufmem[MAXBLK + BLKMULT]; /* i/o buffer + pushback id space */
+static char *bufmem;                  /* i/o buffer + pushback id space */
 static char *buf;                     /* normal start of i/o buffer */
 static char *bufend;                  /* end or last char in i/o buffer */
 static char *bufpt;                   /* read/write point in i/o buffer */
 int blksz = MAXBLK;                   /* block input/output size in bytes */
+int iosz = IOBLK;                     /* i/o size for files and pipes */
 int wrblksz;                          /* user spec output size in bytes */
 int maxflt = MAXFLT;                  /* MAX consecutive media errors */
 int rdblksz;                          /* first read blksize (tapes only) */
 off_t wrlimit;                        /* # of bytes written per archive vol */
 off_t wrcnt;                          /* # of bytes written on current vol */
 off_t rdcnt;                          /* # of bytes read on current vol */
+int iobufs = IOBUFS;                  /* # of archive buffers in flight */
+
+/*
+ * Asynchronous archive writer. Full buffers are queued (in order) to a
+ * thread which writes them with ar_write() while we fill the next one.
+ * Anything other than a complete write stops the thread, and the data it
+ * did not write is replayed through the synchronous code, which knows how
+ * to deal with partial writes and volume changes.
+ */
+static struct wrqbuf {
+	char *mem;                    /* buffer */
+	int cnt;                      /* bytes queued for write */
+	int res;                      /* ar_write() result */
+} *wrq;
+static int nwrq;                      /* # of buffers, 0 if not running */
+static int wrqhead;                   /* oldest queued buffer */
+static int wrqlen;                    /* # of queued buffers */
+static int wrqfail;                   /* write of wrqhead came up short */
+static int wrqend;                    /* no more buffers will be queued */
+static pthread_t wrqthr;
+static pthread_mutex_t wrqmtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wrqwork = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t wrqdone = PTHREAD_COND_INITIALIZER;
+
+/*
+ * Archive read-ahead. A thread reads into a ring of buffers, each with
+ * its own pushback space, and we take them in order. The thread stops on
+ * the first read that does not return data; that read is then redone by
+ * the synchronous code, which reports and deals with errors and volume
+ * changes. To skip data we do not have yet,
+ * the thread is stopped so the archive can be positioned with ar_fow(),
+ * and started again afterwards.
+ */
+static struct rdqbuf {
+	char *mem;                    /* pushback space + buffer */
+	int res;                      /* ar_rdahead() result */
+} *rdq;
+static int nrdq;                      /* # of buffers, 0 if not running */
+static int rdqhead;                   /* oldest filled buffer */
+static int rdqlen;                    /* # of filled buffers */
+static int rdqend;                    /* thread must stop */
+static int rdqdone;                   /* thread has stopped */
+static int rdqeof;                    /* thread stopped on a read <= 0 */
+static int rdqrun;                    /* thread not joined yet */
+static pthread_t rdqthr;
+static pthread_mutex_t rdqmtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t rdqfree = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t rdqready = PTHREAD_COND_INITIALIZER;
+
+/*
+ * Archive files are not read into the buffer but mapped, buf then points
+ * into the mapped window (see ar_mread()) and skipping data within it is
+ * just moving bufpt. rd_fin() goes back to reading into bufmem.
+ */
+static int rdmap;                     /* buf is mapped from the archive */
+
+/*
+ * Extents of the sparse file being stored or extracted. There is only one
+ * such file at a time, so the space is reused for all of them.
+ */
+static SPARSE *spbuf;                 /* extent list */
+static int spmax;                     /* # of extents spbuf can hold */
+
+/*
+ * Formats with a checksum of the file data in the header (sv4crc) would
+ * have to read each file twice. Where the archive allows, the header is
+ * patched after the data went out instead (see wr_mark()). Otherwise
+ * files up to SPOOLMAX bytes are read once into the spool and stored from
+ * there.
+ */
+#define SPOOLMAX (8 * 1024 * 1024)
+static int wrvol;                     /* # of write volume changes */
+static int markvol;                   /* wrvol at the last wr_mark() */
+static char *spool;                   /* file data read by set_crc() */
+static size_t spoolsz;                /* size of spool */
+static off_t spoolcnt = -1;           /* bytes in spool, -1 if not used */
+static dev_t spooldev;                /* file in the spool */
+static ino_t spoolino;
 
 /*
  * wr_start()
@@ -86,7 +183,8 @@ off_t rdcnt;                          /* # of bytes read on current vol */
 int
 wr_start(void)
 {
-	buf = &(bufmem[BLKMULT]);
+	if (buf_alloc() < 0)
+		return (-1);
 	/*
 	 * Check to make sure the write block size meets pax specs. If the user
 	 * does not specify a blocksize, we use the format default blocksize.
@@ -121,8 +219,15 @@ wr_start(void)
 	if ((ar_open(arcname) < 0) && (ar_next() < 0))
 		return (-1);
 	wrcnt = 0;
-	bufend = buf + wrblksz;
+	bufend = buf + blksz;
 	bufpt = buf;
+
+	/*
+	 * overlap archive writes with reading the files. Not used with a
+	 * volume byte limit, which is checked before every write
+	 */
+	if ((iobufs > 1) && (wrlimit == 0))
+		wrq_start();
 	return (0);
 }
 
@@ -141,7 +246,8 @@ rd_start(void)
 	 * going to append and user specified a write block size, check it
 	 * right away
 	 */
-	buf = &(bufmem[BLKMULT]);
+	if (buf_alloc() < 0)
+		return (-1);
 	if ((act == APPND) && wrblksz) {
 		if (wrblksz > MAXBLK) {
 			paxwarn(1,
@@ -165,19 +271,32 @@ rd_start(void)
 	bufend = buf + rdblksz;
 	bufpt = bufend;
 	rdcnt = 0;
+
+	/*
+	 * map archive files, read ahead on pipes. Appends need the archive
+	 * position to match the buffer, so they always read synchronously
+	 */
+	if (ar_mapok())
+		rdmap = 1;
+	else if ((act != APPND) && (iobufs > 1) && ar_isstream())
+		rdq_start();
 	return (0);
 }
 
 /*
  * cp_start()
  *	set up buffer system for copying within the file system
+ * Return:
+ *	0 if ok, -1 otherwise
  */
 
-void
+int
 cp_start(void)
 {
-	buf = &(bufmem[BLKMULT]);
-	rdblksz = blksz = MAXBLK;
+	if (buf_alloc() < 0)
+		return (-1);
+	rdblksz = blksz = MAXIMUM(iosz, MAXBLK);
+	return (0);
 }
 
 /*
@@ -216,6 +335,7 @@ int
 appnd_start(off_t skcnt)
 {
 	int res;
+	int len;
 	off_t cnt;
 
 	if (exit_val != 0) {
@@ -247,6 +367,15 @@ appnd_start(off_t skcnt)
 	skcnt += bufend - bufpt;
 	if ((cnt = (skcnt / blksz) * blksz) < skcnt)
 		cnt += blksz;
+
+	/*
+	 * A volume shorter than a record (e.g. a compressed archive, which
+	 * has no record structure to find its size from) can only be moved
+	 * back to its start, and the record there is short.
+	 */
+	if ((cnt > rdcnt) && ar_isstream())
+		cnt = rdcnt;
+	len = MINIMUM(cnt, blksz);
 	if (ar_rev(cnt) < 0)
 		goto out;
 
@@ -263,7 +392,7 @@ appnd_start(off_t skcnt)
 		 * determination of the physical block size, we will fail.
 		 */
 		bufpt = buf;
-		bufend = buf + blksz;
+		bufend = buf + len;
 		while (bufpt < bufend) {
 			if ((res = ar_read(bufpt, rdblksz)) <= 0)
 				goto out;
@@ -317,6 +446,9 @@ rd_sync(void)
 	int errcnt = 0;
 	int res;
 
+	rd_fin();
+	idx_drop();
+
 	/*
 	 * if the user says bail out on first fault, we are out of here...
 	 */
@@ -385,6 +517,12 @@ void
 pback(char *pt, int cnt)
 {
 	bufpt -= cnt;
+
+	/*
+	 * the mapped window has these very bytes in front of bufpt already
+	 */
+	if (rdmap)
+		return;
 	memcpy(bufpt, pt, cnt);
 }
 
@@ -402,6 +540,7 @@ rd_skip(off_t skcnt)
 	off_t res;
 	off_t cnt;
 	off_t skipped = 0;
+	int resume = 0;
 
 	/*
 	 * consume what data we have in the buffer. If we have to move forward
@@ -415,6 +554,15 @@ rd_skip(off_t skcnt)
 	bufpt += res;
 	skcnt -= res;
 
+	/*
+	 * then what was read ahead. If that is not enough the reader is
+	 * stopped and we start it again once we have moved
+	 */
+	if ((skcnt > 0) && (nrdq > 0)) {
+		skcnt = rdq_skip(skcnt);
+		resume = (nrdq == 0) && !rdqeof;
+	}
+
 	/*
 	 * if skcnt is now 0, then no additional i/o is needed
 	 */
@@ -436,6 +584,8 @@ rd_skip(off_t skcnt)
 		return (-1);
 	res += cnt - skipped;
 	rdcnt += skipped;
+	if (resume)
+		rdq_start();
 
 	/*
 	 * what is left we have to read (which may be the whole thing if
@@ -457,21 +607,88 @@ rd_skip(off_t skcnt)
 	return (0);
 }
 
+/*
+ * rd_offset()
+ *	where in the archive volume the next byte handed to the format read
+ *	routines comes from.
+ * Return:
+ *	offset of the read position
+ */
+
+off_t
+rd_offset(void)
+{
+	return (rdcnt - (bufend - bufpt));
+}
+
+/*
+ * rd_fin()
+ *	stop reading ahead on the archive. Whatever is left in the current
+ *	buffer stays available, anything read beyond it is dropped. Must be
+ *	called before the archive is positioned, drained or closed.
+ */
+
+void
+rd_fin(void)
+{
+	int cnt;
+	int res;
+
+	/*
+	 * keep what fits in the buffer of a mapped window, the rest is read
+	 * again from the archive
+	 */
+	if (rdmap) {
+		cnt = bufend - bufpt;
+		res = MINIMUM(cnt, blksz);
+		memcpy(bufmem + BLKMULT, bufpt, res);
+		ar_munmap(cnt - res);
+		rdcnt -= cnt - res;
+		buf = bufmem + BLKMULT;
+		bufpt = buf;
+		bufend = buf + res;
+		rdmap = 0;
+		return;
+	}
+	if (nrdq == 0)
+		return;
+	rdq_stop();
+	cnt = bufend - bufpt;
+	if (cnt > 0)
+		memmove(bufmem + BLKMULT, bufpt, cnt);
+	buf = bufmem + BLKMULT;
+	bufpt = buf;
+	bufend = buf + cnt;
+	nrdq = 0;
+}
+
 /*
  * wr_fin()
  *	flush out any data (and pad if required) the last block. We always pad
  *	with zero (even though we do not have to). Padding with 0 makes it a
  *	lot easier to recover if the archive is damaged. zero padding SHOULD
  *	BE a requirement....
+ *	When the i/o size is a multiple of the record size (files and pipes)
+ *	we only pad out to the end of the current record, so the archive is
+ *	the same no matter how large the buffer was.
  */
 
 void
 wr_fin(void)
 {
+	int cnt;
+
+	/*
+	 * let the writer thread finish, the last record is written here
+	 */
+	if (nwrq > 0)
+		(void)wrq_stop();
 	if (bufpt > buf) {
-		memset(bufpt, 0, bufend - bufpt);
-		bufpt = bufend;
-		(void)buf_flush(blksz);
+		cnt = (rdblksz - ((bufpt - buf) % rdblksz)) % rdblksz;
+		memset(bufpt, 0, cnt);
+		bufpt += cnt;
+		while ((bufpt > buf) && (buf_flush(bufpt - buf) >= 0))
+			continue;
 	}
 }
 
@@ -590,6 +807,257 @@ wr_skip(off_t skcnt)
 	return (0);
 }
 
+/*
+ * wr_mark()
+ *	remember the archive position of the next byte written, so the
+ *	format can patch what it writes there with wr_patch().
+ * Return:
+ *	position in the archive volume
+ */
+
+off_t
+wr_mark(void)
+{
+	markvol = wrvol;
+	return (wrcnt + (bufpt - buf));
+}
+
+/*
+ * wr_patch()
+ *	overwrite cnt bytes written at archive position pos (from wr_mark())
+ *	with data. What is still in the buffer is changed there, the rest is
+ *	rewritten on the archive, which has to allow this (see ar_patchok()).
+ * Return:
+ *	0 if ok, -1 if the data cannot be changed any more
+ */
+
+int
+wr_patch(off_t pos, char *data, int cnt)
+{
+	off_t inbuf;
+
+	if (markvol != wrvol)
+		return (-1);
+
+	/*
+	 * wait for the writer thread, so all that was flushed is on the
+	 * archive (or back in the buffer, after a short write)
+	 */
+	if ((pos < wrcnt) && (nwrq > 0) && (wrq_sync() < 0))
+		return (-1);
+	if (markvol != wrvol)
+		return (-1);
+
+	if ((inbuf = pos + cnt - wrcnt) > 0) {
+		inbuf = MINIMUM(inbuf, cnt);
+		memcpy(buf + (pos + cnt - inbuf - wrcnt),
+		    data + (cnt - inbuf), inbuf);
+		cnt -= inbuf;
+	}
+	if (cnt == 0)
+		return (0);
+	return (ar_patch(wrcnt - pos, data, cnt));
+}
+
+/*
+ * wr_spool()
+ *	get room to read the file of a member into, which wr_rdfile() then
+ *	stores instead of reading the file again, for that member only.
+ *	wr_spooled() tells how much was read, -1 drops the spool.
+ * Return:
+ *	pointer to the spool, NULL if the file is too large for it
+ */
+
+char *
+wr_spool(ARCHD *arcn)
+{
+	off_t size = arcn->sb.st_size;
+	char *pt;
+
+	spoolcnt = -1;
+	spooldev = arcn->sb.st_dev;
+	spoolino = arcn->sb.st_ino;
+	if (size > SPOOLMAX)
+		return (NULL);
+	if ((size_t)size > spoolsz) {
+		if ((pt = realloc(spool, (size_t)size)) == NULL)
+			return (NULL);
+		spool = pt;
+		spoolsz = size;
+	}
+	return (spool);
+}
+
+void
+wr_spooled(off_t cnt)
+{
+	spoolcnt = cnt;
+}
+
+/*
+ * crc_sum()
+ *	add the bytes of a buffer to the sum used as crc by the sv4crc format.
+ *	The bytes are added eight at a time, in 16 bit lanes of a 64 bit
+ *	word, which are folded into the sum before they can overflow.
+ * Return:
+ *	the new sum
+ */
+
+u_int32_t
+crc_sum(u_int32_t crc, const char *pt, int cnt)
+{
+	const unsigned char *bp = (const unsigned char *)pt;
+	const u_int64_t mask = 0x00ff00ff00ff00ffULL;
+	u_int64_t acc, w;
+	int i, n;
+
+	while (cnt >= 8) {
+		/*
+		 * a lane gets at most 2 * 255 per word, 128 words fit
+		 */
+		n = MINIMUM(cnt / 8, 128);
+		acc = 0;
+		for (i = 0; i < n; i++, bp += 8) {
+			memcpy(&w, bp, sizeof(w));
+			acc += (w & mask) + ((w >> 8) & mask);
+		}
+		acc = (acc & 0x0000ffff0000ffffULL) +
+		    ((acc >> 16) & 0x0000ffff0000ffffULL);
+		crc += (u_int32_t)(acc + (acc >> 32));
+		cnt -= n * 8;
+	}
+	while (--cnt >= 0)
+		crc += *bp++;
+	return (crc);
+}
+
+/*
+ * sp_alloc()
+ *	get room for cnt extents of a sparse file. The room is shared by all
+ *	sparse files, so it is only valid until the next call.
+ * Return:
+ *	pointer to the extent list, NULL if out of memory
+ */
+
+SPARSE *
+sp_alloc(int cnt)
+{
+	SPARSE *pt;
+	int max;
+
+	if (cnt <= spmax)
+		return (spbuf);
+	max = MAXIMUM(cnt, 2 * spmax);
+	if ((pt = reallocarray(spbuf, max, sizeof(SPARSE))) == NULL) {
+		paxwarn(1, "Unable to allocate memory for sparse file map");
+		return (NULL);
+	}
+	spbuf = pt;
+	spmax = max;
+	return (spbuf);
+}
+
+/*
+ * sp_free()
+ *	release the room of the extent lists, for one that turned out to be
+ *	of no use (the room asked for may be large)
+ */
+
+void
+sp_free(void)
+{
+	free(spbuf);
+	spbuf = NULL;
+	spmax = 0;
+}
+
+/*
+ * sp_map()
+ *	find the data extents of a file with holes. When the file system can
+ *	tell us where the data is (SEEK_DATA/SEEK_HOLE), arcn->sp is set to
+ *	the list of extents, so only those have to be stored. A hole at the
+ *	end of the file is marked with an empty extent at the file size.
+ *	Without such help, or when the file has no holes, arcn->spcnt is 0
+ *	and the file is stored whole.
+ */
+
+void
+sp_map(ARCHD *arcn, int fd)
+{
+#ifdef SEEK_DATA
+	off_t size = arcn->sb.st_size;
+	off_t data, hole;
+	off_t off = 0;
+	SPARSE *sp;
+	int cnt = 0;
+	int ok = 1;
+#endif
+
+	arcn->sp = NULL;
+	arcn->spcnt = 0;
+#ifdef SEEK_DATA
+	/*
+	 * a file which uses as many blocks as its size has no holes
+	 */
+	if (((off_t)(arcn->sb.st_blocks * BLKMULT)) >= size)
+		return;
+
+	while (off < size) {
+		if ((data = lseek(fd, off, SEEK_DATA)) < 0) {
+			/*
+			 * ENXIO: no data after off, the rest is a hole
+			 */
+			if (errno != ENXIO)
+				ok = 0;
+			break;
+		}
+		if (data >= size)
+			break;
+		if (((hole = lseek(fd, data, SEEK_HOLE)) < 0) ||
+		    ((sp = sp_alloc(cnt + 2)) == NULL)) {
+			ok = 0;
+			break;
+		}
+		sp[cnt].off = data;
+		sp[cnt++].len = MINIMUM(hole, size) - data;
+		off = hole;
+	}
+
+	/*
+	 * if we could not find the holes or there are none after all (the
+	 * file system may just store it compressed), read the file as usual
+	 */
+	if ((lseek(fd, 0, SEEK_SET) < 0) || !ok)
+		return;
+	if ((cnt == 1) && (spbuf[0].len == size))
+		return;
+	if ((cnt == 0) || (spbuf[cnt - 1].off + spbuf[cnt - 1].len < size)) {
+		if ((sp = sp_alloc(cnt + 1)) == NULL)
+			return;
+		sp[cnt].off = size;
+		sp[cnt++].len = 0;
+	}
+	arcn->sp = spbuf;
+	arcn->spcnt = cnt;
+#endif
+}
+
+/*
+ * sp_size()
+ *	number of data bytes in the extents of a sparse file
+ */
+
+off_t
+sp_size(ARCHD *arcn)
+{
+	off_t size = 0;
+	int i;
+
+	for (i = 0; i < arcn->spcnt; i++)
+		size += arcn->sp[i].len;
+	return (size);
+}
+
 /*
  * wr_rdfile()
  *	fill write buffer with the contents of a file. We are passed an	open
@@ -614,24 +1082,76 @@ wr_rdfile(ARCHD *arcn, int ifd, off_t *left)
 	int cnt;
 	int res = 0;
 	off_t size = arcn->sb.st_size;
+	off_t ext;
+	int i = 0;
+	u_int32_t crc = 0;
 	struct stat sb;
 
+	/*
+	 * set_crc() may have read the file into the spool already. It is
+	 * only of use for the member it was read for.
+	 */
+	if ((spoolcnt >= 0) && (arcn->spcnt == 0) && (spoolcnt == size) &&
+	    (spooldev == arcn->sb.st_dev) && (spoolino == arcn->sb.st_ino)) {
+		spoolcnt = -1;
+		if (wr_rdbuf(spool, (int)size) < 0) {
+			*left = size;
+			return (-1);
+		}
+		*left = 0;
+		return (0);
+	}
+	spoolcnt = -1;
+
+	/*
+	 * of a sparse file only the data extents are stored, ext is what
+	 * is left of the current one
+	 */
+	if (arcn->spcnt > 0)
+		size = sp_size(arcn);
+	ext = (arcn->spcnt > 0) ? 0 : size;
+	if (dodgst)
+		dgst_start();
+
 	/*
 	 * while there are more bytes to write
 	 */
 	while (size > 0) {
+		if (ext == 0) {
+			while (arcn->sp[i].len == 0)
+				++i;
+			if (lseek(ifd, arcn->sp[i].off, SEEK_SET) < 0) {
+				res = -1;
+				break;
+			}
+			ext = arcn->sp[i++].len;
+		}
 		cnt = bufend - bufpt;
 		if ((cnt <= 0) && ((cnt = buf_flush(blksz)) < 0)) {
 			*left = size;
 			return (-1);
 		}
-		cnt = MINIMUM(cnt, size);
+		cnt = MINIMUM(cnt, ext);
 		if ((res = read(ifd, bufpt, cnt)) <= 0)
 			break;
+		if (docrc)
+			crc = crc_sum(crc, bufpt, res);
+		if (dodgst)
+			dgst_add(bufpt, res);
 		size -= res;
+		ext -= res;
 		bufpt += res;
 	}
 
+	/*
+	 * the crc and digest of what was stored, the format may still put
+	 * them in the header (see wr_patch())
+	 */
+	if (docrc)
+		arcn->crc = crc;
+	if (dodgst)
+		dgst_end(arcn->dgst);
+
 	/*
 	 * better check the file did not change during this operation
 	 * or the file read failed.
@@ -662,8 +1182,8 @@ wr_rdfile(ARCHD *arcn, int ifd, off_t *left)
  *	We call a special function to write the file. This function attempts to
  *	restore file holes (blocks of zeros) into the file. When files are
  *	sparse this saves space, and is a LOT faster. For non sparse files
- *	the performance hit is small. As of this writing, no archive supports
- *	information on where the file holes are.
+ *	the performance hit is small. Only the pax format records where the
+ *	holes are (arcn->sp), for the others they have to be found this way.
  * Return:
  *	0 ok, -1 if archive read failure. if we cannot write the entire file,
  *	we return a 0 but "left" is set to be the amount unwritten
@@ -679,6 +1199,8 @@ rd_wrfile(ARCHD *arcn, int ofd, off_t *left)
 	int isem = 1;
 	int rem;
 	int sz = MINFBSZ;
+	off_t ext;
+	int i = 0;
 	struct stat sb;
 	u_int32_t crc = 0;
 	int need_swap = swapbytes || swaphalf;
@@ -698,12 +1220,31 @@ rd_wrfile(ARCHD *arcn, int ofd, off_t *left)
 	rem = sz;
 	*left = 0;
 
+	/*
+	 * the archive may hold only the data extents of a sparse file, these
+	 * are written where they belong and the rest is left a hole
+	 */
+	if (arcn->spcnt > 0)
+		size = sp_size(arcn);
+	ext = (arcn->spcnt > 0) ? 0 : size;
+
 	/*
 	 * Copy the archive to the file the number of bytes specified. We have
-	 * to assume that we want to recover file holes as none of the archive
-	 * formats can record the location of file holes.
+	 * to assume that we want to recover file holes as most of the archive
+	 * formats cannot record the location of file holes.
 	 */
 	while (size > 0) {
+		if (ext == 0) {
+			while (arcn->sp[i].len == 0)
+				++i;
+			if (lseek(ofd, arcn->sp[i].off, SEEK_SET) < 0) {
+				syswarn(1, errno, "Unable to seek in %s", fnm);
+				*left = size;
+				break;
+			}
+			ext = arcn->sp[i++].len;
+			rem = sz;
+		}
 		cnt = bufend - bufpt;
 		/*
 		 * if we get a read error, we do not want to skip, as we may
@@ -712,7 +1253,7 @@ rd_wrfile(ARCHD *arcn, int ofd, off_t *left)
 		 */
 		if ((cnt <= 0) && ((cnt = buf_fill()) <= 0))
 			break;
-		cnt = MINIMUM(cnt, size);
+		cnt = MINIMUM(cnt, ext);
 		if (need_swap)
 			/* convert archive data into requested byte order */
 			apply_swaps(bufpt, cnt, 0);
@@ -727,23 +1268,24 @@ rd_wrfile(ARCHD *arcn, int ofd, off_t *left)
 			/* restore buffer so CRC logic sees original stream */
 			apply_swaps(bufpt, cnt, 1);
 
-		if (docrc) {
-			int i = res;
-			unsigned char *bp = (unsigned char *)bufpt;
-			while (--i >= 0)
-				crc += *bp++;
-		}
+		if (docrc)
+			crc = crc_sum(crc, bufpt, res);
 		bufpt += res;
 		size -= res;
+		ext -= res;
 	}
 
 	/*
 	 * if the last block has a file hole (all zero), we must make sure this
 	 * gets updated in the file. We force the last block of zeros to be
 	 * written. just closing with the file offset moved forward may not put
-	 * a hole at the end of the file.
+	 * a hole at the end of the file. A sparse file is simply cut to its
+	 * size, which also makes any hole at its end.
 	 */
-	if (isem && (arcn->sb.st_size > 0))
+	if (arcn->spcnt > 0) {
+		if ((*left == 0) && (ftruncate(ofd, arcn->sb.st_size) < 0))
+			syswarn(1, errno, "Unable to set size of %s", fnm);
+	} else if (isem && (arcn->sb.st_size > 0))
 		file_flush(ofd, fnm, isem);
 
 	/*
@@ -845,18 +1387,25 @@ cp_file(ARCHD *arcn, int fd1, int fd2)
 	rem = sz;
 
 	/*
-	 * read the source file and copy to destination file until EOF
+	 * let the kernel copy what it can. Otherwise, or for the rest, read
+	 * the source file and copy to destination file until EOF
 	 */
-	for (;;) {
-		if ((cnt = read(fd1, buf, blksz)) <= 0)
-			break;
-		if (no_hole)
-			res = write(fd2, buf, cnt);
-		else
-			res = file_write(fd2, buf, cnt, &rem, &isem, sz, fnm);
-		if (res != cnt)
-			break;
-		cpcnt += cnt;
+	if ((res = cp_kern(fd1, fd2, no_hole, &cpcnt)) == 0)
+		isem = 0;
+	else if (res > 0) {
+		res = 0;
+		for (;;) {
+			if ((cnt = read(fd1, buf, blksz)) <= 0)
+				break;
+			if (no_hole)
+				res = write(fd2, buf, cnt);
+			else
+				res = file_write(
+				    fd2, buf, cnt, &rem, &isem, sz, fnm);
+			if (res != cnt)
+				break;
+			cpcnt += cnt;
+		}
 	}
 
 	/*
@@ -884,6 +1433,79 @@ cp_file(ARCHD *arcn, int fd1, int fd2)
 		file_flush(fd2, fnm, isem);
 }
 
+/*
+ * cp_kern()
+ *	copy file data within the kernel, without passing it through our
+ *	buffer. A clone (reflink) of the source shares its blocks, holes and
+ *	all. Failing that, a file without holes is copied with
+ *	copy_file_range(2); files with holes are left to file_write() so the
+ *	holes are kept. Only where the system has these (Linux).
+ * Return:
+ *	0 if all data was copied, 1 if the caller must copy the data from the
+ *	current file offsets on, -1 on a write error (errno is set)
+ */
+
+static int
+cp_kern(int fd1, int fd2, int no_hole, off_t *cpcnt)
+{
+#ifdef __linux__
+	struct stat sb;
+	ssize_t res;
+
+	if (ioctl(fd2, FICLONE, fd1) == 0) {
+		if ((fstat(fd2, &sb) == -1) ||
+		    (lseek(fd1, sb.st_size, SEEK_SET) < 0) ||
+		    (lseek(fd2, sb.st_size, SEEK_SET) < 0))
+			return (-1);
+		*cpcnt = sb.st_size;
+		return (0);
+	}
+	if (!no_hole)
+		return (1);
+
+	while ((res = copy_file_range(fd1, NULL, fd2, NULL, SSIZE_MAX, 0)) > 0)
+		*cpcnt += res;
+	if ((res == 0) && (*cpcnt > 0))
+		return (0);
+
+	/*
+	 * not supported between these files, or nothing copied at all (some
+	 * file systems claim end of file): do it the old way. Any other error
+	 * is a real one.
+	 */
+	if ((res == 0) || (errno == ENOSYS) || (errno == EXDEV) ||
+	    (errno == EINVAL) || (errno == EOPNOTSUPP) || (errno == ENOTSUP))
+		return (1);
+	return (-1);
+#else
+	return (1);
+#endif
+}
+
+/*
+ * buf_alloc()
+ *	allocate the i/o buffer (and the pushback space in front of it) the
+ *	first time the buffering system is started.
+ * Return:
+ *	0 if ok, -1 otherwise
+ */
+
+static int
+buf_alloc(void)
+{
+	size_t sz;
+
+	if (bufmem != NULL)
+		return (0);
+	sz = MAXIMUM(iosz, MAXBLK);
+	if ((bufmem = malloc(sz + BLKMULT)) == NULL) {
+		paxwarn(1, "Unable to allocate %zu byte archive buffer", sz);
+		return (-1);
+	}
+	buf = bufmem + BLKMULT;
+	return (0);
+}
+
 /*
  * buf_fill()
  *	fill the read buffer with the next record (or what we can get) from
@@ -902,6 +1524,31 @@ buf_fill(void)
 	if (fini)
 		return (0);
 
+	/*
+	 * take the next buffer read ahead. If the reader stopped, the read
+	 * it stopped on is redone below
+	 */
+	if (nrdq > 0) {
+		if ((cnt = rdq_take(1)) > 0)
+			return (cnt);
+		rd_fin();
+	}
+
+	/*
+	 * map the next window of an archive file. At end of file (or if it
+	 * cannot be mapped) we go back to reading, which also deals with
+	 * the end of the volume
+	 */
+	if (rdmap) {
+		if ((cnt = ar_mread(&buf)) > 0) {
+			bufpt = buf;
+			bufend = buf + cnt;
+			rdcnt += cnt;
+			return (cnt);
+		}
+		rd_fin();
+	}
+
 	for (;;) {
 		/*
 		 * try to fill the buffer. on error the next archive volume is
@@ -936,7 +1583,8 @@ buf_fill(void)
  * buf_flush()
  *	force the write buffer to the archive. We are passed the number of
  *	bytes in the buffer at the point of the flush. When we change archives
- *	the record size might change. (either larger or smaller).
+ *	the record size might change. (either larger or smaller). A count
+ *	smaller than blksz (only from wr_fin()) is written as is.
  * Return:
  *	0 if all is ok, -1 when a write error occurs.
  */
@@ -945,9 +1593,13 @@ static int
 buf_flush(int bufcnt)
 {
 	int cnt;
+	int wrsz;
 	int push = 0;
 	int totcnt = 0;
 
+	if (nwrq > 0)
+		return (wrq_put());
+
 	/*
 	 * if we have reached the user specified byte count for each archive
 	 * volume, question for the next volume. (The non-standard -R flag).
@@ -956,6 +1608,7 @@ buf_flush(int bufcnt)
 	 */
 	if ((wrlimit > 0) && (wrcnt > wrlimit)) {
 		paxwarn(0, "User specified archive volume byte limit reached.");
+		++wrvol;
 		if (ar_next() < 0) {
 			wrcnt = 0;
 			exit_val = 1;
@@ -986,8 +1639,9 @@ buf_flush(int bufcnt)
 		/*
 		 * write a block and check if it all went out ok
 		 */
-		cnt = ar_write(buf, blksz);
-		if (cnt == blksz) {
+		wrsz = MINIMUM(bufcnt, blksz);
+		cnt = ar_write(buf, wrsz);
+		if (cnt == wrsz) {
 			/*
 			 * the write went ok
 			 */
@@ -1029,6 +1683,7 @@ buf_flush(int bufcnt)
 		 * All done, go to next archive
 		 */
 		wrcnt = 0;
+		++wrvol;
 		if (ar_next() < 0)
 			break;
 
@@ -1050,3 +1705,367 @@ buf_flush(int bufcnt)
 	exit_val = 1;
 	return (-1);
 }
+
+/*
+ * wrq_start()
+ *	start the archive writer thread. If we cannot, writes just stay
+ *	synchronous.
+ */
+
+static void
+wrq_start(void)
+{
+	sigset_t all, omask;
+	int i;
+
+	if ((wrq = calloc(iobufs, sizeof(*wrq))) == NULL)
+		return;
+	for (i = 0; i < iobufs; i++)
+		if ((wrq[i].mem = malloc(blksz)) == NULL)
+			goto bad;
+
+	nwrq = iobufs;
+	wrqhead = wrqlen = wrqfail = wrqend = 0;
+
+	/*
+	 * signals are handled by the main thread only
+	 */
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &omask);
+	i = pthread_create(&wrqthr, NULL, wrq_thread, NULL);
+	pthread_sigmask(SIG_SETMASK, &omask, NULL);
+	if (i != 0) {
+		nwrq = 0;
+		goto bad;
+	}
+	buf = wrq[0].mem;
+	bufpt = buf;
+	bufend = buf + blksz;
+	return;
+
+bad:
+	for (i = 0; i < iobufs; i++)
+		free(wrq[i].mem);
+	free(wrq);
+	wrq = NULL;
+}
+
+/*
+ * wrq_put()
+ *	queue the (full) buffer for the writer thread and switch to the next
+ *	free one. If the writer thread stopped on a short write, we go back
+ *	to synchronous writes.
+ * Return:
+ *	number of bytes queued, 0 if the caller must check for room in the
+ *	buffer again, -1 on a write failure
+ */
+
+static int
+wrq_put(void)
+{
+	int cur;
+
+	pthread_mutex_lock(&wrqmtx);
+	while ((wrqlen == nwrq - 1) && !wrqfail)
+		pthread_cond_wait(&wrqdone, &wrqmtx);
+	if (wrqfail) {
+		pthread_mutex_unlock(&wrqmtx);
+		return (wrq_stop() < 0 ? -1 : 0);
+	}
+	cur = (wrqhead + wrqlen) % nwrq;
+	wrq[cur].cnt = blksz;
+	++wrqlen;
+	pthread_cond_signal(&wrqwork);
+	pthread_mutex_unlock(&wrqmtx);
+
+	wrcnt += blksz;
+	buf = wrq[(cur + 1) % nwrq].mem;
+	bufpt = buf;
+	bufend = buf + blksz;
+	return (blksz);
+}
+
+/*
+ * wrq_stop()
+ *	wait for the writer thread to write what is queued and stop it. We
+ *	then continue with synchronous writes. The data the thread did not
+ *	write (after a short write) and the contents of the current buffer
+ *	are copied into the i/o buffer in archive order, flushing as it fills
+ *	(which moves on to the next volume when needed).
+ * Return:
+ *	0 if ok, -1 on a write failure
+ */
+
+static int
+wrq_stop(void)
+{
+	struct wrqbuf *wb;
+	char *cur = buf;
+	int curcnt = bufpt - buf;
+	int n = nwrq;
+	int i, off;
+	int ret = 0;
+
+	pthread_mutex_lock(&wrqmtx);
+	wrqend = 1;
+	pthread_cond_signal(&wrqwork);
+	pthread_mutex_unlock(&wrqmtx);
+	pthread_join(wrqthr, NULL);
+
+	nwrq = 0;
+	buf = bufmem + BLKMULT;
+	bufpt = buf;
+	bufend = buf + blksz;
+
+	for (i = 0; i < wrqlen; i++) {
+		wb = &wrq[(wrqhead + i) % n];
+		off = 0;
+		if (i == 0 && wb->res > 0) {
+			/*
+			 * part of the buffer went out. As in buf_flush(), the
+			 * rest must keep the format alignment
+			 */
+			off = wb->res;
+			if (frmt->blkalgn &&
+			    ((wb->cnt - off) % frmt->blkalgn)) {
+				exit_val = 1;
+				ret = -1;
+				break;
+			}
+		}
+		wrcnt -= wb->cnt - off;
+		if (wr_rdbuf(wb->mem + off, wb->cnt - off) < 0) {
+			ret = -1;
+			break;
+		}
+	}
+	if ((ret == 0) && (curcnt > 0) && (wr_rdbuf(cur, curcnt) < 0))
+		ret = -1;
+
+	for (i = 0; i < n; i++)
+		free(wrq[i].mem);
+	free(wrq);
+	wrq = NULL;
+	return (ret);
+}
+
+/*
+ * wrq_sync()
+ *	wait until the writer thread has written all that is queued. After a
+ *	short write the thread is stopped, which puts the data not written
+ *	back into the buffer.
+ * Return:
+ *	0 if ok, -1 on a write failure
+ */
+
+static int
+wrq_sync(void)
+{
+	pthread_mutex_lock(&wrqmtx);
+	while ((wrqlen > 0) && !wrqfail)
+		pthread_cond_wait(&wrqdone, &wrqmtx);
+	pthread_mutex_unlock(&wrqmtx);
+	if (wrqfail)
+		return (wrq_stop());
+	return (0);
+}
+
+/*
+ * wrq_thread()
+ *	archive writer thread. Writes the queued buffers in order until told
+ *	to stop or a write does not complete.
+ */
+
+static void *
+wrq_thread(void *arg)
+{
+	struct wrqbuf *wb;
+
+	pthread_mutex_lock(&wrqmtx);
+	for (;;) {
+		while ((wrqlen == 0) && !wrqend)
+			pthread_cond_wait(&wrqwork, &wrqmtx);
+		if (wrqlen == 0)
+			break;
+		wb = &wrq[wrqhead];
+		pthread_mutex_unlock(&wrqmtx);
+		wb->res = ar_write(wb->mem, wb->cnt);
+		pthread_mutex_lock(&wrqmtx);
+		if (wb->res != wb->cnt) {
+			wrqfail = 1;
+			pthread_cond_signal(&wrqdone);
+			break;
+		}
+		wrqhead = (wrqhead + 1) % nwrq;
+		--wrqlen;
+		pthread_cond_signal(&wrqdone);
+	}
+	pthread_mutex_unlock(&wrqmtx);
+	return (NULL);
+}
+
+/*
+ * rdq_start()
+ *	start (or restart after a skip) the archive read-ahead thread. If we
+ *	cannot, reads just stay synchronous.
+ */
+
+static void
+rdq_start(void)
+{
+	sigset_t all, omask;
+	size_t sz;
+	int i;
+
+	if (rdq == NULL) {
+		if ((rdq = calloc(iobufs, sizeof(*rdq))) == NULL)
+			return;
+		sz = MAXIMUM(iosz, MAXBLK) + BLKMULT;
+		for (i = 0; i < iobufs; i++) {
+			if ((rdq[i].mem = malloc(sz)) == NULL) {
+				while (--i >= 0)
+					free(rdq[i].mem);
+				free(rdq);
+				rdq = NULL;
+				return;
+			}
+		}
+	}
+	nrdq = iobufs;
+	rdqhead = rdqlen = rdqend = rdqdone = rdqeof = 0;
+
+	/*
+	 * signals are handled by the main thread only
+	 */
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &omask);
+	if (pthread_create(&rdqthr, NULL, rdq_thread, NULL) == 0)
+		rdqrun = 1;
+	else
+		nrdq = 0;
+	pthread_sigmask(SIG_SETMASK, &omask, NULL);
+}
+
+/*
+ * rdq_take()
+ *	make the oldest buffer read ahead the current buffer, optionally
+ *	waiting for the reader.
+ * Return:
+ *	number of bytes in the buffer, 0 if there is none ready or the
+ *	reader stopped there
+ */
+
+static int
+rdq_take(int wait)
+{
+	struct rdqbuf *rb;
+	int cnt;
+
+	pthread_mutex_lock(&rdqmtx);
+	while (wait && (rdqlen == 0) && !rdqdone)
+		pthread_cond_wait(&rdqready, &rdqmtx);
+	if ((rdqlen == 0) || ((cnt = rdq[rdqhead].res) <= 0)) {
+		pthread_mutex_unlock(&rdqmtx);
+		return (0);
+	}
+	rb = &rdq[rdqhead];
+	rdqhead = (rdqhead + 1) % nrdq;
+	--rdqlen;
+	pthread_cond_signal(&rdqfree);
+	pthread_mutex_unlock(&rdqmtx);
+
+	buf = rb->mem + BLKMULT;
+	bufpt = buf;
+	bufend = buf + cnt;
+	rdcnt += cnt;
+	return (cnt);
+}
+
+/*
+ * rdq_skip()
+ *	skip over data read ahead. When we run out of it, the reader is
+ *	stopped (finishing the read it is in) and what it has read is used as
+ *	well. If the skip still is not done, the caller positions the archive
+ *	and starts the reader again.
+ * Return:
+ *	number of bytes still to skip
+ */
+
+static off_t
+rdq_skip(off_t skcnt)
+{
+	int stopped = 0;
+	int cnt;
+
+	for (;;) {
+		while ((skcnt > 0) && ((cnt = rdq_take(0)) > 0)) {
+			cnt = MINIMUM(cnt, skcnt);
+			bufpt += cnt;
+			skcnt -= cnt;
+		}
+		if ((skcnt == 0) || stopped)
+			break;
+		rdq_stop();
+		stopped = 1;
+	}
+	if (stopped) {
+		rd_fin();
+		if ((skcnt == 0) && !rdqeof)
+			rdq_start();
+	}
+	return (skcnt);
+}
+
+/*
+ * rdq_stop()
+ *	stop the read-ahead thread. The buffers it filled can still be taken.
+ */
+
+static void
+rdq_stop(void)
+{
+	if (!rdqrun)
+		return;
+	pthread_mutex_lock(&rdqmtx);
+	rdqend = 1;
+	pthread_cond_signal(&rdqfree);
+	pthread_mutex_unlock(&rdqmtx);
+	pthread_join(rdqthr, NULL);
+	rdqrun = 0;
+}
+
+/*
+ * rdq_thread()
+ *	archive read-ahead thread. Fills the free buffers in order until
+ *	told to stop or a read does not return data.
+ */
+
+static void *
+rdq_thread(void *arg)
+{
+	struct rdqbuf *rb;
+	int res;
+
+	pthread_mutex_lock(&rdqmtx);
+	for (;;) {
+		while ((rdqlen == nrdq - 1) && !rdqend)
+			pthread_cond_wait(&rdqfree, &rdqmtx);
+		if (rdqend)
+			break;
+		rb = &rdq[(rdqhead + rdqlen) % nrdq];
+		pthread_mutex_unlock(&rdqmtx);
+		res = ar_rdahead(rb->mem + BLKMULT, blksz);
+		pthread_mutex_lock(&rdqmtx);
+		rb->res = res;
+		++rdqlen;
+		pthread_cond_signal(&rdqready);
+		if (res <= 0) {
+			rdqeof = 1;
+			break;
+		}
+	}
+	rdqdone = 1;
+	pthread_cond_signal(&rdqready);
+	pthread_mutex_unlock(&rdqmtx);
+	return (NULL);
+}
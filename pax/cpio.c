@@ -57,6 +57,8 @@ static int com_rd(ARCHD *);
  */
 
 static int swp_head; /* binary cpio header byte swap */
+static off_t crcpos = -1; /* archive position of the sv4crc header crc */
+static u_int32_t crchd;   /* crc written in that header */
 
 /*
  * Routines common to all versions of cpio
@@ -156,16 +158,22 @@ int
 cpio_endwr(void)
 {
 	ARCHD last;
+	int ret;
 
 	/*
 	 * create a trailer request and call the proper format write function
 	 */
 	memset(&last, 0, sizeof(last));
-	last.nlen = sizeof(TRAILER) - 1;
+	if ((arcn_set(&last, 0, TRAILER, sizeof(TRAILER) - 1) < 0) ||
+	    (arcn_set(&last, 1, "", 0) < 0)) {
+		arcn_free(&last);
+		return (-1);
+	}
 	last.type = PAX_REG;
 	last.sb.st_nlink = 1;
-	(void)strlcpy(last.name, TRAILER, sizeof(last.name));
-	return ((*frmt->wr)(&last));
+	ret = (*frmt->wr)(&last);
+	arcn_free(&last);
+	return (ret);
 }
 
 /*
@@ -181,10 +189,12 @@ rd_nm(ARCHD *arcn, int nsz)
 	/*
 	 * do not even try bogus values
 	 */
-	if ((nsz == 0) || ((size_t)nsz > sizeof(arcn->name))) {
+	if ((nsz == 0) || ((size_t)nsz > PAXNAMEMAX)) {
 		paxwarn(1, "Cpio file name length %d is out of range", nsz);
 		return (-1);
 	}
+	if (arcn_room(arcn, 0, nsz) < 0)
+		return (-1);
 
 	/*
 	 * read the name and make sure it is not empty and is \0 terminated
@@ -212,11 +222,13 @@ rd_ln_nm(ARCHD *arcn)
 	 * check the length specified for bogus values
 	 */
 	if ((arcn->sb.st_size <= 0) ||
-	    (arcn->sb.st_size >= (off_t)sizeof(arcn->ln_name))) {
+	    (arcn->sb.st_size > PAXNAMEMAX)) {
 		paxwarn(1, "Cpio link name length is invalid: %lld",
 		    arcn->sb.st_size);
 		return (-1);
 	}
+	if (arcn_room(arcn, 1, arcn->sb.st_size) < 0)
+		return (-1);
 
 	/*
 	 * read in the link name and \0 terminate it
@@ -321,8 +333,8 @@ cpio_rd(ARCHD *arcn, char *buf)
 		/*
 		 * no link name to read for this file
 		 */
-		arcn->ln_nlen = 0;
-		arcn->ln_name[0] = '\0';
+		if (arcn_set(arcn, 1, "", 0) < 0)
+			return (-1);
 		return (com_rd(arcn));
 	}
 
@@ -612,8 +624,8 @@ vcpio_rd(ARCHD *arcn, char *buf)
 		/*
 		 * we have a valid header (not a link)
 		 */
-		arcn->ln_nlen = 0;
-		arcn->ln_name[0] = '\0';
+		if (arcn_set(arcn, 1, "", 0) < 0)
+			return (-1);
 		arcn->pad = VCPIO_PAD(arcn->sb.st_size);
 		return (com_rd(arcn));
 	}
@@ -658,6 +670,27 @@ crc_stwr(void)
 	return (dev_start());
 }
 
+/*
+ * crc_patch()
+ *	after the file data is stored, put the crc summed from it into the
+ *	sv4crc header, unless it is there already (set_crc() read the file
+ *	before the header was written).
+ */
+
+void
+crc_patch(ARCHD *arcn)
+{
+	HD_VCPIO hd;
+	off_t pos = crcpos;
+
+	crcpos = -1;
+	if ((pos < 0) || (arcn->crc == crchd))
+		return;
+	if (ul_asc(arcn->crc, hd.c_chksum, sizeof(hd.c_chksum), HEX) ||
+	    (wr_patch(pos, hd.c_chksum, sizeof(hd.c_chksum)) < 0))
+		paxwarn(1, "Unable to store the crc of %s", arcn->org_name);
+}
+
 /*
  * vcpio_wr()
  *	copy the data in the ARCHD to buffer in system VR4 cpio
@@ -754,6 +787,15 @@ vcpio_wr(ARCHD *arcn)
 	    ul_asc(nsz, hd->c_namesize, sizeof(hd->c_namesize), HEX))
 		goto out;
 
+	/*
+	 * the crc may have to be put in the header after the file data
+	 */
+	crcpos = -1;
+	if (docrc && (PAX_IS_REG(arcn->type) || (arcn->type == PAX_HRG))) {
+		crcpos = wr_mark() + (hd->c_chksum - hdblk);
+		crchd = arcn->crc;
+	}
+
 	/*
 	 * write the header, the file name and padding as required.
 	 */
@@ -913,8 +955,8 @@ bcpio_rd(ARCHD *arcn, char *buf)
 		/*
 		 * we have a valid header (not a link)
 		 */
-		arcn->ln_nlen = 0;
-		arcn->ln_name[0] = '\0';
+		if (arcn_set(arcn, 1, "", 0) < 0)
+			return (-1);
 		arcn->pad = BCPIO_PAD(arcn->sb.st_size);
 		return (com_rd(arcn));
 	}
@@ -46,12 +46,22 @@
 extern const char *arcname;
 extern const char *gzip_program;
 extern int force_one_volume;
+extern int gzip_builtin;
+extern int gzthreads;
 int ar_open(const char *);
 void ar_close(int _in_sig);
 void ar_drain(void);
 int ar_set_wr(void);
 int ar_app_ok(void);
+int ar_isstream(void);
+int ar_zlib(void);
 int ar_read(char *, int);
+int ar_rdahead(char *, int);
+int ar_mapok(void);
+int ar_patchok(void);
+int ar_patch(off_t, char *, int);
+int ar_mread(char **);
+void ar_munmap(int);
 int ar_write(char *, int);
 int ar_rdsync(void);
 int ar_fow(off_t, off_t *);
@@ -62,6 +72,10 @@ int ar_next(void);
  * ar_subs.c
  */
 extern u_long flcnt;
+extern int hashthreads;
+extern int xthreads;
+extern int rdthreads;
+extern size_t prefetch;
 void list(void);
 void extract(void);
 void append(void);
@@ -72,23 +86,36 @@ void copy(void);
  * buf_subs.c
  */
 extern int blksz;
+extern int iosz;
 extern int wrblksz;
 extern int maxflt;
 extern int rdblksz;
 extern off_t wrlimit;
 extern off_t rdcnt;
 extern off_t wrcnt;
+extern int iobufs;
 int wr_start(void);
 int rd_start(void);
-void cp_start(void);
+int cp_start(void);
 int appnd_start(off_t);
 int rd_sync(void);
 void pback(char *, int);
 int rd_skip(off_t);
+off_t rd_offset(void);
+void rd_fin(void);
 void wr_fin(void);
 int wr_rdbuf(char *, int);
 int rd_wrbuf(char *, int);
 int wr_skip(off_t);
+off_t wr_mark(void);
+int wr_patch(off_t, char *, int);
+char *wr_spool(ARCHD *);
+void wr_spooled(off_t);
+u_int32_t crc_sum(u_int32_t, const char *, int);
+SPARSE *sp_alloc(int);
+void sp_free(void);
+void sp_map(ARCHD *, int);
+off_t sp_size(ARCHD *);
 int wr_rdfile(ARCHD *, int, off_t *);
 int rd_wrfile(ARCHD *, int, off_t *);
 void cp_file(ARCHD *, int, int);
@@ -110,6 +137,7 @@ int crc_strd(void);
 int vcpio_rd(ARCHD *, char *);
 off_t vcpio_endrd(void);
 int crc_stwr(void);
+void crc_patch(ARCHD *);
 int vcpio_wr(ARCHD *);
 int bcpio_id(char *, int);
 int bcpio_rd(ARCHD *, char *);
@@ -135,10 +163,12 @@ int file_write(int, char *, int, int *, int *, int, char *);
 void file_flush(int, char *, int);
 void rdfile_close(ARCHD *, int *);
 int set_crc(ARCHD *, int);
+void pdir_flush(void);
 
 /*
  * ftree.c
  */
+extern int walkthreads;
 int ftree_start(void);
 int ftree_add(char *, int);
 void ftree_sel(ARCHD *);
@@ -149,6 +179,11 @@ int next_file(ARCHD *);
 /*
  * gen_subs.c
  */
+void dgst_start(void);
+void dgst_add(const char *, int);
+void dgst_end(u_char *);
+void dgst_hex(const u_char *, char *);
+int dgst_unhex(const char *, u_char *);
 void ls_list(ARCHD *, time_t, FILE *);
 void ls_tty(ARCHD *);
 void safe_print(const char *, FILE *);
@@ -180,6 +215,11 @@ int ull_asc(unsigned long long, char *, int, int);
 size_t fieldcpy(char *, size_t, const char *, size_t);
 void pax_kv_free(PAXKEY **);
 const char *pax_kv_lookup(const ARCHD *, const char *);
+int arcn_room(ARCHD *, int, size_t);
+int arcn_set(ARCHD *, int, const char *, size_t);
+int arcn_clear(ARCHD *);
+int arcn_dup(ARCHD *, const ARCHD *);
+void arcn_free(ARCHD *);
 
 /*
  * getoldopt.c
@@ -203,6 +243,8 @@ int pat_add(char *, char *);
 void pat_chk(void);
 int pat_sel(ARCHD *);
 int pat_match(ARCHD *);
+PATTERN *pat_next(PATTERN *);
+int pat_test(PATTERN *, char *);
 int mod_name(ARCHD *);
 int set_dest(ARCHD *, char *, int);
 int has_dotdot(const char *);
@@ -239,6 +281,8 @@ extern int pids;
 extern int rmleadslash;
 extern int exit_val;
 extern int docrc;
+extern int dodgst;
+extern int verify;
 extern int swapbytes;
 extern int swaphalf;
 extern char *dirptr;
@@ -261,6 +305,8 @@ int trng_add(char *);
 /*
  * tables.c
  */
+extern char *idxfile;
+extern size_t ftmem;
 int lnk_start(void);
 int chk_lnk(ARCHD *);
 void purg_lnk(ARCHD *);
@@ -273,7 +319,7 @@ int sltab_add_link(const char *, const struct stat *);
 void sltab_process(int _in_sig);
 int name_start(void);
 int add_name(char *, int, char *);
-void sub_name(char *, int *, int);
+void sub_name(ARCHD *);
 #ifndef NOCPIO
 int dev_start(void);
 int add_dev(ARCHD *);
@@ -288,10 +334,29 @@ void atdir_end(void);
 void add_atdir(
     char *, dev_t, ino_t, const struct timespec *, const struct timespec *);
 int do_atdir(const char *, dev_t, ino_t);
+int exdir_chk(const char *);
+void exdir_add(const char *);
+void exdir_clr(void);
+int pidx_add(PATTERN *);
+void pidx_del(PATTERN *);
+PATTERN *pidx_get(const char *, int, int);
+const char *uid_name(uid_t, int);
+const char *gid_name(gid_t, int);
+int name_uid(const char *, uid_t *);
+int name_gid(const char *, gid_t *);
+int idn_load(const char *, int);
 int dir_start(void);
 void add_dir(char *, struct stat *, int);
 void delete_dir(dev_t, ino_t);
 void proc_dir(int _in_sig);
+int idx_start(void);
+void idx_mark(void);
+void idx_add(ARCHD *);
+void idx_done(void);
+void idx_drop(void);
+int idx_seek(void);
+int idx_next(ARCHD *);
+void idx_end(void);
 
 /*
  * tar.c
@@ -311,6 +376,7 @@ int ustar_wr(ARCHD *);
 int pax_id(char *, int);
 int pax_opt(void);
 int pax_wr(ARCHD *);
+void dgst_patch(ARCHD *);
 
 /*
  * tty_subs.c
@@ -55,12 +55,126 @@ static int mk_link(char *, struct stat *, char *, int);
 static void fset_ftime(
     const char *, int, const struct timespec *, const struct timespec *, int);
 static void fset_pmode(char *, int, mode_t);
+static int zero_chk(const char *, int);
+static int pdir_fd(const char *, const char **);
+
+/*
+ * Small LRU cache of descriptors for the parent directories of the nodes
+ * we create. Extraction tends to create many nodes in the same directory,
+ * so resolving the parent once and working relative to it with the *at()
+ * calls saves the kernel a full path walk for every operation.
+ */
+#define PDIRFDS		16
+
+static struct pdir {
+	char	*path;		/* parent path, including trailing slash */
+	size_t	len;		/* length of path */
+	int	fd;		/* open descriptor for the directory */
+	u_long	used;		/* LRU stamp */
+} pdirs[PDIRFDS];
+static u_long pdtick;
+
+static mode_t cmask;		/* umask, the mode bits new files lack */
+static int cmaskset;
 
 /*
  * routines that deal with file operations such as: creating, removing;
  * and setting access modes, uid/gid and times of files
  */
 
+/*
+ * pdir_fd()
+ *	Look up (or open and cache) a descriptor for the directory containing
+ *	name. *base is set to the part of name to use relative to it. When
+ *	name has no parent or the parent cannot be opened, AT_FDCWD and the
+ *	whole name are handed back so the caller sees the usual errors.
+ * Return:
+ *	directory descriptor or AT_FDCWD
+ */
+
+static int
+pdir_fd(const char *name, const char **base)
+{
+	struct pdir *pd, *lru;
+	const char *pt;
+	size_t len;
+	char *path;
+	int fd;
+
+	*base = name;
+
+	/*
+	 * find the last component, ignoring any trailing slashes
+	 */
+	len = strlen(name);
+	while (len > 1 && name[len - 1] == '/')
+		--len;
+	while (len > 0 && name[len - 1] != '/')
+		--len;
+	if (len == 0)
+		return (AT_FDCWD);
+	pt = name + len;
+	if (*pt == '\0' || *pt == '/')
+		return (AT_FDCWD);
+
+	lru = &pdirs[0];
+	for (pd = pdirs; pd < pdirs + PDIRFDS; ++pd) {
+		if (pd->path == NULL) {
+			if (lru->path != NULL)
+				lru = pd;
+			continue;
+		}
+		if (pd->len == len && memcmp(pd->path, name, len) == 0) {
+			pd->used = ++pdtick;
+			*base = pt;
+			return (pd->fd);
+		}
+		if (lru->path != NULL && pd->used < lru->used)
+			lru = pd;
+	}
+
+	if ((path = malloc(len + 1)) == NULL)
+		return (AT_FDCWD);
+	memcpy(path, name, len);
+	path[len] = '\0';
+	if ((fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) == -1) {
+		free(path);
+		return (AT_FDCWD);
+	}
+	if (lru->path != NULL) {
+		(void)close(lru->fd);
+		free(lru->path);
+	}
+	lru->path = path;
+	lru->len = len;
+	lru->fd = fd;
+	lru->used = ++pdtick;
+	*base = pt;
+	return (fd);
+}
+
+/*
+ * pdir_flush()
+ *	Forget every cached parent directory (and every directory known to
+ *	exist). Called whenever a directory or symlink that may be a path
+ *	component is removed, and when the working directory changes.
+ */
+
+void
+pdir_flush(void)
+{
+	struct pdir *pd;
+
+	for (pd = pdirs; pd < pdirs + PDIRFDS; ++pd) {
+		if (pd->path == NULL)
+			continue;
+		(void)close(pd->fd);
+		free(pd->path);
+		pd->path = NULL;
+	}
+	exdir_clr();
+}
+
 /*
  * file_creat()
  *	Create and open a file.
@@ -73,7 +187,8 @@ file_creat(ARCHD *arcn)
 {
 	int fd = -1;
 	mode_t file_mode;
-	int oerrno;
+	int oerrno, dfd;
+	const char *base;
 
 	/*
 	 * Assume file doesn't exist, so just try to create it, most times this
@@ -87,9 +202,22 @@ file_creat(ARCHD *arcn)
 	 * first with lstat.
 	 */
 	file_mode = arcn->sb.st_mode & FILEBITS;
-	if ((fd = open(arcn->name, O_WRONLY | O_CREAT | O_EXCL, file_mode)) >=
-	    0)
+	dfd = pdir_fd(arcn->name, &base);
+	if ((fd = openat(dfd, base, O_WRONLY | O_CREAT | O_EXCL, file_mode)) >=
+	    0) {
+		/*
+		 * a new file, remember the mode it got so file_close() need
+		 * not set it again
+		 */
+		if (!cmaskset) {
+			cmask = umask(0);
+			(void)umask(cmask);
+			cmaskset = 1;
+		}
+		arcn->cmode = file_mode & ~cmask;
 		return (fd);
+	}
+	arcn->cmode = -1;
 
 	/*
 	 * the file seems to exist. First we try to get rid of it (found to be
@@ -105,7 +233,8 @@ file_creat(ARCHD *arcn)
 		 * the path and give it a final try. if chk_path() finds that
 		 * it cannot fix anything, we will skip the last attempt
 		 */
-		if ((fd = open(arcn->name, O_WRONLY | O_CREAT | O_TRUNC,
+		dfd = pdir_fd(arcn->name, &base);
+		if ((fd = openat(dfd, base, O_WRONLY | O_CREAT | O_TRUNC,
 		    file_mode)) >= 0)
 			break;
 		oerrno = errno;
@@ -150,7 +279,7 @@ file_close(ARCHD *arcn, int fd)
 	 */
 	if (!pmode || res)
 		arcn->sb.st_mode &= ~(SETBITS);
-	if (pmode)
+	if (pmode && ((arcn->sb.st_mode & ABITS) != (mode_t)arcn->cmode))
 		fset_pmode(arcn->name, fd, arcn->sb.st_mode);
 	if (patime || pmtime)
 		fset_ftime(
@@ -242,12 +371,15 @@ int
 chk_same(ARCHD *arcn)
 {
 	struct stat sb;
+	const char *base;
+	int dfd;
 
 	/*
 	 * if file does not exist, return. if file exists and -k, skip it
 	 * quietly
 	 */
-	if (lstat(arcn->name, &sb) == -1)
+	dfd = pdir_fd(arcn->name, &base);
+	if (fstatat(dfd, base, &sb, AT_SYMLINK_NOFOLLOW) == -1)
 		return (1);
 	if (kflag)
 		return (0);
@@ -279,13 +411,15 @@ static int
 mk_link(char *to, struct stat *to_sb, char *from, int ign)
 {
 	struct stat sb;
-	int oerrno;
+	const char *base;
+	int oerrno, dfd;
 
 	/*
 	 * if from file exists, it has to be unlinked to make the link. If the
 	 * file exists and -k is set, skip it quietly
 	 */
-	if (lstat(from, &sb) == 0) {
+	dfd = pdir_fd(from, &base);
+	if (fstatat(dfd, base, &sb, AT_SYMLINK_NOFOLLOW) == 0) {
 		if (kflag)
 			return (0);
 
@@ -302,18 +436,20 @@ mk_link(char *to, struct stat *to_sb, char *from, int ign)
 		 * try to get rid of the file, based on the type
 		 */
 		if (S_ISDIR(sb.st_mode)) {
-			if (rmdir(from) == -1) {
+			if (unlinkat(dfd, base, AT_REMOVEDIR) == -1) {
 				syswarn(1, errno, "Unable to remove %s", from);
 				return (-1);
 			}
 			delete_dir(sb.st_dev, sb.st_ino);
-		} else if (unlink(from) == -1) {
+			pdir_flush();
+		} else if (unlinkat(dfd, base, 0) == -1) {
 			if (!ign) {
 				syswarn(1, errno, "Unable to remove %s", from);
 				return (-1);
 			}
 			return (1);
-		}
+		} else if (S_ISLNK(sb.st_mode))
+			pdir_flush();
 	}
 
 	/*
@@ -322,7 +458,8 @@ mk_link(char *to, struct stat *to_sb, char *from, int ign)
 	 * try again)
 	 */
 	for (;;) {
-		if (linkat(AT_FDCWD, to, AT_FDCWD, from, 0) == 0)
+		dfd = pdir_fd(from, &base);
+		if (linkat(AT_FDCWD, to, dfd, base, 0) == 0)
 			break;
 		oerrno = errno;
 		if (!nodirs &&
@@ -361,7 +498,8 @@ node_creat(ARCHD *arcn)
 	struct stat sb;
 	char target[PATH_MAX];
 	char *nm = arcn->name;
-	int len, defer_pmode = 0;
+	const char *base;
+	int len, dfd, defer_pmode = 0;
 
 	/*
 	 * create node based on type, if that fails try to unlink the node and
@@ -396,7 +534,8 @@ node_creat(ARCHD *arcn)
 					nm = target;
 				}
 			}
-			res = mkdir(nm, file_mode);
+			dfd = pdir_fd(nm, &base);
+			res = mkdirat(dfd, base, file_mode);
 
  badlink:
 			if (ign)
@@ -404,14 +543,17 @@ node_creat(ARCHD *arcn)
 			break;
 		case PAX_CHR:
 			file_mode |= S_IFCHR;
-			res = mknod(nm, file_mode, arcn->sb.st_rdev);
+			dfd = pdir_fd(nm, &base);
+			res = mknodat(dfd, base, file_mode, arcn->sb.st_rdev);
 			break;
 		case PAX_BLK:
 			file_mode |= S_IFBLK;
-			res = mknod(nm, file_mode, arcn->sb.st_rdev);
+			dfd = pdir_fd(nm, &base);
+			res = mknodat(dfd, base, file_mode, arcn->sb.st_rdev);
 			break;
 		case PAX_FIF:
-			res = mkfifo(nm, file_mode);
+			dfd = pdir_fd(nm, &base);
+			res = mkfifoat(dfd, base, file_mode);
 			break;
 		case PAX_SCK:
 			/*
@@ -423,9 +565,10 @@ node_creat(ARCHD *arcn)
 			return (-1);
 		case PAX_SLK:
 			if (arcn->ln_name[0] != '/' &&
-			    !has_dotdot(arcn->ln_name))
-				res = symlink(arcn->ln_name, nm);
-			else {
+			    !has_dotdot(arcn->ln_name)) {
+				dfd = pdir_fd(nm, &base);
+				res = symlinkat(arcn->ln_name, dfd, base);
+			} else {
 				/*
 				 * absolute symlinks and symlinks with ".."
 				 * have to be deferred to prevent the archive
@@ -478,6 +621,8 @@ node_creat(ARCHD *arcn)
 	/*
 	 * we were able to create the node. set uid/gid, modes and times
 	 */
+	if (arcn->type == PAX_DIR)
+		exdir_add(nm);
 	if (pids)
 		res = set_ids(nm, arcn->sb.st_uid, arcn->sb.st_gid);
 	else
@@ -504,9 +649,10 @@ node_creat(ARCHD *arcn)
 		 * before pax exits.  To do that safely, we want the dev+ino
 		 * of the directory we created.
 		 */
-		if (lstat(nm, &sb) == -1) {
+		dfd = pdir_fd(nm, &base);
+		if (fstatat(dfd, base, &sb, AT_SYMLINK_NOFOLLOW) == -1) {
 			syswarn(0, errno, "Could not access %s (stat)", nm);
-		} else if (access(nm, R_OK | W_OK | X_OK) == -1) {
+		} else if (faccessat(dfd, base, R_OK | W_OK | X_OK, 0) == -1) {
 			/*
 			 * We have to add rights to the dir, so we make
 			 * sure to restore the mode. The mode must be
@@ -551,11 +697,14 @@ static int
 unlnk_exist(char *name, int type)
 {
 	struct stat sb;
+	const char *base;
+	int dfd;
 
 	/*
 	 * the file does not exist, or -k we are done
 	 */
-	if (lstat(name, &sb) == -1)
+	dfd = pdir_fd(name, &base);
+	if (fstatat(dfd, base, &sb, AT_SYMLINK_NOFOLLOW) == -1)
 		return (0);
 	if (kflag)
 		return (-1);
@@ -565,7 +714,7 @@ unlnk_exist(char *name, int type)
 		 * try to remove a directory, if it fails and we were going to
 		 * create a directory anyway, tell the caller (return a 1)
 		 */
-		if (rmdir(name) == -1) {
+		if (unlinkat(dfd, base, AT_REMOVEDIR) == -1) {
 			if (type == PAX_DIR)
 				return (1);
 			syswarn(
@@ -573,16 +722,20 @@ unlnk_exist(char *name, int type)
 			return (-1);
 		}
 		delete_dir(sb.st_dev, sb.st_ino);
+		pdir_flush();
 		return (0);
 	}
 
 	/*
-	 * try to get rid of all non-directory type nodes
+	 * try to get rid of all non-directory type nodes. a symlink may
+	 * have been a component of a cached parent directory, so drop those
 	 */
-	if (unlink(name) == -1) {
+	if (unlinkat(dfd, base, 0) == -1) {
 		syswarn(1, errno, "Could not unlink %s", name);
 		return (-1);
 	}
+	if (S_ISLNK(sb.st_mode))
+		pdir_flush();
 	return (0);
 }
 
@@ -643,7 +796,14 @@ chk_path(char *name, uid_t st_uid, gid_t st_gid, int ign)
 		 * recursive unlink()) or fix up the directory permissions if
 		 * required (do an access()).
 		 */
+		if (exdir_chk(name)) {
+			*spt = '/';
+			spt = next;
+			continue;
+		}
 		if (lstat(name, &sb) == 0) {
+			if (S_ISDIR(sb.st_mode))
+				exdir_add(name);
 			*spt = '/';
 			spt = next;
 			continue;
@@ -667,6 +827,7 @@ chk_path(char *name, uid_t st_uid, gid_t st_gid, int ign)
 		 * and create the node again.
 		 */
 		retval = 0;
+		exdir_add(name);
 		if (pids)
 			(void)set_ids(name, st_uid, st_gid);
 
@@ -703,6 +864,8 @@ set_ftime(const char *fnm, const struct timespec *mtimp,
     const struct timespec *atimp, int frc)
 {
 	struct timespec tv[2];
+	const char *base;
+	int dfd;
 
 	tv[0] = *atimp;
 	tv[1] = *mtimp;
@@ -721,7 +884,8 @@ set_ftime(const char *fnm, const struct timespec *mtimp,
 	/*
 	 * set the times
 	 */
-	if (utimensat(AT_FDCWD, fnm, tv, AT_SYMLINK_NOFOLLOW) < 0)
+	dfd = pdir_fd(fnm, &base);
+	if (utimensat(dfd, base, tv, AT_SYMLINK_NOFOLLOW) < 0)
 		syswarn(1, errno, "Access/modification time set failed on: %s",
 		    fnm);
 }
@@ -763,7 +927,11 @@ fset_ftime(const char *fnm, int fd, const struct timespec *mtimp,
 int
 set_ids(char *fnm, uid_t uid, gid_t gid)
 {
-	if (fchownat(AT_FDCWD, fnm, uid, gid, AT_SYMLINK_NOFOLLOW) == -1) {
+	const char *base;
+	int dfd;
+
+	dfd = pdir_fd(fnm, &base);
+	if (fchownat(dfd, base, uid, gid, AT_SYMLINK_NOFOLLOW) == -1) {
 		/*
 		 * ignore EPERM unless in verbose mode or being run by root.
 		 * if running as pax, POSIX requires a warning.
@@ -802,8 +970,12 @@ fset_ids(char *fnm, int fd, uid_t uid, gid_t gid)
 void
 set_pmode(char *fnm, mode_t mode)
 {
+	const char *base;
+	int dfd;
+
 	mode &= ABITS;
-	if (fchmodat(AT_FDCWD, fnm, mode, AT_SYMLINK_NOFOLLOW) == -1)
+	dfd = pdir_fd(fnm, &base);
+	if (fchmodat(dfd, base, mode, AT_SYMLINK_NOFOLLOW) == -1)
 		syswarn(1, errno, "Could not set permissions on %s", fnm);
 }
 
@@ -825,7 +997,8 @@ set_attr(const struct file_times *ft, int force_times, mode_t mode, int do_mode,
     int in_sig)
 {
 	struct stat sb;
-	int fd, r;
+	const char *base;
+	int dfd, fd, r;
 
 	if (!do_mode && !force_times && !patime && !pmtime)
 		return (0);
@@ -833,9 +1006,15 @@ set_attr(const struct file_times *ft, int force_times, mode_t mode, int do_mode,
 	/*
 	 * We could legitimately go through a symlink here,
 	 * so do *not* use O_NOFOLLOW.  The dev+ino check will
-	 * protect us from evil.
+	 * protect us from evil. The parent directory cache is not
+	 * touched from a signal handler.
 	 */
-	fd = open(ft->ft_name, O_RDONLY | O_DIRECTORY);
+	if (in_sig)
+		fd = open(ft->ft_name, O_RDONLY | O_DIRECTORY);
+	else {
+		dfd = pdir_fd(ft->ft_name, &base);
+		fd = openat(dfd, base, O_RDONLY | O_DIRECTORY);
+	}
 	if (fd == -1) {
 		if (!in_sig)
 			syswarn(1, errno,
@@ -909,9 +1088,8 @@ set_attr(const struct file_times *ft, int force_times, mode_t mode, int do_mode,
  *	are not desired, just do a conditional test in those routines that
  *	call file_write() and have it call write() instead. BEFORE CLOSING THE
  *	FILE, make sure to call file_flush() when the last write finishes with
- *	an empty block. A lot of file systems will not create an lseek hole at
- *	the end. In this case we drop a single 0 at the end to force the
- *	trailing 0's in the file.
+ *	an empty block. Seeking past the end does not make the file any
+ *	longer, file_flush() sets the size so the trailing 0's are a hole.
  *	---Parameters---
  *	rem: how many bytes left in this file system block
  *	isempt: have we written to the file block yet (is it empty)
@@ -926,8 +1104,6 @@ int
 file_write(
     int fd, char *str, int cnt, int *rem, int *isempt, int sz, char *name)
 {
-	char *pt;
-	char *end;
 	int wcnt;
 	char *st = str;
 	char **strp;
@@ -958,16 +1134,7 @@ file_write(
 			 * have not written to this block yet, so we keep
 			 * looking for zero's
 			 */
-			pt = st;
-			end = st + wcnt;
-
-			/*
-			 * look for a zero filled buffer
-			 */
-			while ((pt < end) && (*pt == '\0'))
-				++pt;
-
-			if (pt == end) {
+			if (zero_chk(st, wcnt)) {
 				/*
 				 * skip, buf is empty so far
 				 */
@@ -976,7 +1143,7 @@ file_write(
 					    1, errno, "File seek on %s", name);
 					return (-1);
 				}
-				st = pt;
+				st += wcnt;
 				continue;
 			}
 			/*
@@ -1022,8 +1189,9 @@ file_write(
 
 /*
  * file_flush()
- *	when the last file block in a file is zero, many file systems will not
- *	let us create a hole at the end. To get the last block with zeros, we
+ *	when the last file block in a file is zero, we only moved the file
+ *	offset past it and the file is not yet that long. Extend the file to
+ *	the offset, which makes the end a hole. Where that is not possible,
  *	write the last BYTE with a zero (back up one byte and write a zero).
  */
 
@@ -1031,6 +1199,7 @@ void
 file_flush(int fd, char *fname, int isempt)
 {
 	static char blnk[] = "\0";
+	off_t off;
 
 	/*
 	 * silly test, but make sure we are only called when the last block is
@@ -1039,6 +1208,13 @@ file_flush(int fd, char *fname, int isempt)
 	if (!isempt)
 		return;
 
+	if ((off = lseek(fd, 0, SEEK_CUR)) < 0) {
+		syswarn(1, errno, "Failed seek on file %s", fname);
+		return;
+	}
+	if (ftruncate(fd, off) == 0)
+		return;
+
 	/*
 	 * move back one byte and write a zero
 	 */
@@ -1051,6 +1227,40 @@ file_flush(int fd, char *fname, int isempt)
 		syswarn(1, errno, "Failed write to file %s", fname);
 }
 
+/*
+ * zero_chk()
+ *	see if a buffer holds nothing but zeros. This is done for each file
+ *	block extracted, so it has to be cheap: the buffer is looked at a word
+ *	at a time, eight words per pass, and the first word is tested on its
+ *	own as it settles the question for most blocks with data.
+ * Return:
+ *	1 if the buffer is all zeros, 0 otherwise
+ */
+
+static int
+zero_chk(const char *pt, int cnt)
+{
+	const char *end = pt + cnt;
+	u_long w[8];
+
+	if (cnt >= (int)sizeof(w[0])) {
+		memcpy(w, pt, sizeof(w[0]));
+		if (w[0] != 0)
+			return (0);
+	}
+	for (; (size_t)(end - pt) >= sizeof(w); pt += sizeof(w)) {
+		memcpy(w, pt, sizeof(w));
+		if ((w[0] | w[1] | w[2] | w[3] | w[4] | w[5] | w[6] | w[7]) !=
+		    0)
+			return (0);
+	}
+	for (; pt < end; ++pt) {
+		if (*pt != '\0')
+			return (0);
+	}
+	return (1);
+}
+
 /*
  * rdfile_close()
  *	close a file we have been reading (to copy or archive). If we have to
@@ -1079,9 +1289,11 @@ rdfile_close(ARCHD *arcn, int *fd)
 
 /*
  * set_crc()
- *	read a file to calculate its crc. This is a real drag. Archive formats
- *	that have this, end up reading the file twice (we have to write the
- *	header WITH the crc before writing the file contents. Oh well...
+ *	get the crc (or the digest) of a file for formats which store it in
+ *	the header. Where the header can be patched afterwards, it is computed
+ *	while the file data is stored (see wr_patch()). Otherwise we have to
+ *	read the file now, into the spool if it fits, so it is only read
+ *	once. Larger files end up being read twice. Oh well...
  * Return:
  *	0 if was able to calculate the crc, -1 otherwise
  */
@@ -1089,14 +1301,15 @@ rdfile_close(ARCHD *arcn, int *fd)
 int
 set_crc(ARCHD *arcn, int fd)
 {
-	int i;
 	int res;
 	off_t cpcnt = 0;
-	size_t size;
+	size_t size, n;
 	u_int32_t crc = 0;
 	char tbuf[FILEBLK];
+	char *spool, *pt;
 	struct stat sb;
 
+	wr_spooled(-1);
 	if (fd < 0) {
 		/*
 		 * hmm, no fd, should never happen. well no crc then.
@@ -1104,20 +1317,37 @@ set_crc(ARCHD *arcn, int fd)
 		arcn->crc = 0;
 		return (0);
 	}
+	if (ar_patchok()) {
+		arcn->crc = 0;
+		memset(arcn->dgst, 0, sizeof(arcn->dgst));
+		return (0);
+	}
 
 	if ((size = arcn->sb.st_blksize) > sizeof(tbuf))
 		size = sizeof(tbuf);
+	spool = wr_spool(arcn);
+	if (dodgst)
+		dgst_start();
 
 	/*
 	 * read all the bytes we think that there are in the file. If the user
 	 * is trying to archive an active file, forget this file.
 	 */
 	for (;;) {
-		if ((res = read(fd, tbuf, size)) <= 0)
+		if ((spool != NULL) && (cpcnt < arcn->sb.st_size)) {
+			pt = spool + cpcnt;
+			n = arcn->sb.st_size - cpcnt;
+		} else {
+			pt = tbuf;
+			n = size;
+		}
+		if ((res = read(fd, pt, n)) <= 0)
 			break;
 		cpcnt += res;
-		for (i = 0; i < res; ++i)
-			crc += (tbuf[i] & 0xff);
+		if (docrc)
+			crc = crc_sum(crc, pt, res);
+		if (dodgst)
+			dgst_add(pt, res);
 	}
 
 	/*
@@ -1130,10 +1360,18 @@ set_crc(ARCHD *arcn, int fd)
 		syswarn(1, errno, "Failed stat on %s", arcn->org_name);
 	else if (timespeccmp(&arcn->sb.st_mtim, &sb.st_mtim, !=))
 		paxwarn(1, "File %s was modified during read", arcn->org_name);
-	else if (lseek(fd, 0, SEEK_SET) < 0)
+	else if (spool != NULL) {
+		arcn->crc = crc;
+		if (dodgst)
+			dgst_end(arcn->dgst);
+		wr_spooled(cpcnt);
+		return (0);
+	} else if (lseek(fd, 0, SEEK_SET) < 0)
 		syswarn(1, errno, "File rewind failed on: %s", arcn->org_name);
 	else {
 		arcn->crc = crc;
+		if (dodgst)
+			dgst_end(arcn->dgst);
 		return (0);
 	}
 	return (-1);
@@ -37,8 +37,13 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 
+#include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <fts.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -81,8 +86,80 @@ static FTREE *ftcur = NULL;  /* current file arg being processed */
 static FTSENT *ftent = NULL; /* current file tree entry */
 static int ftree_skip;       /* when set skip to next file arg */
 
+/*
+ * With -o walkthreads the file trees are walked without fts. The directories
+ * are read by a pool of threads ahead of next_file(), which hands out their
+ * entries in the order fts does: a directory, then its entries in the order
+ * they were read (descending into the subdirectories), then the directory
+ * again in postorder. A thread reads a whole directory, stat'ing each entry
+ * relative to the open directory, and queues its subdirectories in front
+ * of the directories queued before, so the walk ahead goes depth first like
+ * next_file(). Whether a directory is descended into (-d, -X, cycles) is
+ * still up to next_file(); directories read ahead in vain are dropped.
+ */
+
+#define WK_QUEUED 0		/* to be read */
+#define WK_BUSY 1		/* being read */
+#define WK_DONE 2		/* read */
+
+struct wdir;
+
+struct went {				/* an entry of a directory */
+	size_t name;			/* offset of the name in names */
+	int info;			/* FTS_D, FTS_F, ... like fts */
+	int err;			/* errno if it could not be stat'ed */
+	struct stat sb;
+	struct wdir *sub;		/* the directory, if read ahead */
+};
+
+struct wdir {				/* a directory to read */
+	struct wdir *next;		/* next one to read */
+	char *path;
+	int state;			/* WK_* */
+	int dead;			/* no longer wanted, free when read */
+	int err;			/* errno if it could not be read */
+	struct went *ent;		/* its entries */
+	size_t nent;
+	char *names;			/* the names of the entries */
+	size_t nlen;
+};
+
+struct wlev {				/* a directory being walked */
+	struct wdir *wd;
+	size_t cur;			/* next entry to hand out */
+	size_t plen;			/* length of its path */
+	struct stat *sbp;		/* its stat */
+};
+
+int walkthreads;			/* # of walk threads, 0 to use fts */
+static pthread_mutex_t wkmtx = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wkwork = PTHREAD_COND_INITIALIZER;	/* dir queued */
+static pthread_cond_t wkdone = PTHREAD_COND_INITIALIZER;	/* dir read */
+static struct wdir *wkhead;		/* directories to read */
+static int nwdir;			/* directories read ahead */
+static int maxwdir;			/* most directories read ahead */
+static int nwkbusy;			/* directories being read by threads */
+static pthread_t *wkthr;
+static int nwkthr;
+static int wkend;
+static struct wlev *wklev;		/* directories being walked */
+static int nwklev;
+static int maxwklev;
+static struct went wkroot;		/* the file arg */
+static int wkfirst;			/* file arg not handed out yet */
+static struct went *wkdesc;		/* directory to descend into next */
+static int wkskip;			/* do not descend into it */
+static char wkpath[PATH_MAX];		/* path of the entry handed out */
+static size_t wkplen;
+static FTSENT wkent;			/* the entry handed out */
+
 static int ftree_arg(void);
 static char *getpathname(char *, int);
+static int wk_start(void);
+static int wk_open(const char *);
+static void wk_close(void);
+static void wk_end(void);
+static FTSENT *wk_read(void);
 
 /*
  * ftree_start()
@@ -130,6 +207,9 @@ ftree_start(void)
 		return (-1);
 	}
 
+	if (wk_start() < 0)
+		return (-1);
+
 	if (ftree_arg() < 0)
 		return (-1);
 	if (tflag && (atdir_start() < 0))
@@ -213,7 +293,9 @@ ftree_sel(ARCHD *arcn)
 	if (!dflag || (arcn->type != PAX_DIR))
 		return;
 
-	if (ftent != NULL)
+	if (nwkthr > 0)
+		wkskip = 1;
+	else if (ftent != NULL)
 		(void)fts_set(ftsp, ftent, FTS_SKIP);
 }
 
@@ -248,6 +330,11 @@ ftree_chk(void)
 	if (tflag)
 		atdir_end();
 
+	/*
+	 * and that the walk threads are done
+	 */
+	wk_end();
+
 	/*
 	 * walk down list and check reference count. Print out those members
 	 * that never had a match
@@ -285,6 +372,8 @@ ftree_arg(void)
 		(void)fts_close(ftsp);
 		ftsp = NULL;
 	}
+	if (nwkthr > 0)
+		wk_close();
 
 	/*
 	 * keep looping until we get a valid file tree to process. Stop when we
@@ -314,6 +403,7 @@ ftree_arg(void)
 					    "directory");
 					return (-1);
 				}
+				pdir_flush();
 				if (chdir(ftcur->fname) == -1) {
 					syswarn(1, errno, "Can't chdir to %s",
 					    ftcur->fname);
@@ -333,7 +423,10 @@ ftree_arg(void)
 		 * files (the -n and -d flags need this). If the open is
 		 * successful, return a 0.
 		 */
-		if ((ftsp = fts_open(farray, ftsopts, NULL)) != NULL)
+		if (nwkthr > 0) {
+			if (wk_open(farray[0]) == 0)
+				break;
+		} else if ((ftsp = fts_open(farray, ftsopts, NULL)) != NULL)
 			break;
 	}
 	return (0);
@@ -370,7 +463,11 @@ next_file(ARCHD *arcn)
 	 * loop until we get a valid file to process
 	 */
 	for (;;) {
-		if ((ftent = fts_read(ftsp)) == NULL) {
+		if (nwkthr > 0)
+			ftent = wk_read();
+		else
+			ftent = fts_read(ftsp);
+		if (ftent == NULL) {
 			if (errno)
 				syswarn(1, errno, "next_file");
 			/*
@@ -437,8 +534,8 @@ next_file(ARCHD *arcn)
 		 */
 		arcn->skip = 0;
 		arcn->pad = 0;
-		arcn->ln_nlen = 0;
-		arcn->ln_name[0] = '\0';
+		if (arcn_set(arcn, 1, "", 0) < 0)
+			return (-1);
 		memcpy(&arcn->sb, ftent->fts_statp, sizeof(arcn->sb));
 
 		/*
@@ -481,8 +578,10 @@ next_file(ARCHD *arcn)
 			/*
 			 * have to read the symlink path from the file
 			 */
+			if (arcn_room(arcn, 1, PATH_MAX) < 0)
+				return (-1);
 			if ((cnt = readlink(ftent->fts_path, arcn->ln_name,
-			    PAXPATHLEN)) == -1) {
+			    arcn->lnsize - 1)) == -1) {
 				syswarn(1, errno, "Unable to read symlink %s",
 				    ftent->fts_path);
 				continue;
@@ -512,13 +611,531 @@ next_file(ARCHD *arcn)
 	/*
 	 * copy file name, set file name length
 	 */
-	arcn->nlen = strlcpy(arcn->name, ftent->fts_path, sizeof(arcn->name));
-	if ((size_t)arcn->nlen >= sizeof(arcn->name))
-		arcn->nlen = sizeof(arcn->name) - 1; /* XXX truncate? */
+	if (arcn_set(arcn, 0, ftent->fts_path, strlen(ftent->fts_path)) < 0)
+		return (-1);
 	arcn->org_name = ftent->fts_path;
 	return (0);
 }
 
+/*
+ * wk_stat()
+ *	stat an entry of an open directory, following symlinks when fts would
+ */
+
+static void
+wk_stat(int dfd, const char *name, struct went *we, int follow)
+{
+	int err;
+
+	if (fstatat(dfd, name, &we->sb, follow ? 0 : AT_SYMLINK_NOFOLLOW) < 0) {
+		err = errno;
+		if (follow &&
+		    (fstatat(dfd, name, &we->sb, AT_SYMLINK_NOFOLLOW) == 0)) {
+			we->info = FTS_SLNONE;
+			return;
+		}
+		memset(&we->sb, 0, sizeof(we->sb));
+		we->err = err;
+		we->info = FTS_NS;
+		return;
+	}
+	if (S_ISDIR(we->sb.st_mode))
+		we->info = FTS_D;
+	else if (S_ISLNK(we->sb.st_mode))
+		we->info = FTS_SL;
+	else if (S_ISREG(we->sb.st_mode))
+		we->info = FTS_F;
+	else
+		we->info = FTS_DEFAULT;
+}
+
+/*
+ * wk_readdir()
+ *	read a directory and stat all of its entries
+ */
+
+static void
+wk_readdir(struct wdir *wd)
+{
+	struct dirent *dp;
+	struct went *we;
+	DIR *dirp;
+	size_t len, maxent = 0, maxnames = 0;
+	void *p;
+	int dfd;
+
+	if ((dfd = open(wd->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) {
+		wd->err = errno;
+		return;
+	}
+	if ((dirp = fdopendir(dfd)) == NULL) {
+		wd->err = errno;
+		(void)close(dfd);
+		return;
+	}
+	while ((dp = readdir(dirp)) != NULL) {
+		if ((dp->d_name[0] == '.') && ((dp->d_name[1] == '\0') ||
+		    ((dp->d_name[1] == '.') && (dp->d_name[2] == '\0'))))
+			continue;
+		len = strlen(dp->d_name) + 1;
+		if (wd->nent == maxent) {
+			maxent = (maxent == 0) ? 64 : 2 * maxent;
+			if ((p = reallocarray(wd->ent, maxent,
+			    sizeof(*wd->ent))) == NULL)
+				break;
+			wd->ent = p;
+		}
+		if (wd->nlen + len > maxnames) {
+			maxnames = MAXIMUM(2 * maxnames, wd->nlen + len + 1024);
+			if ((p = realloc(wd->names, maxnames)) == NULL)
+				break;
+			wd->names = p;
+		}
+		we = &wd->ent[wd->nent++];
+		memset(we, 0, sizeof(*we));
+		we->name = wd->nlen;
+		memcpy(wd->names + wd->nlen, dp->d_name, len);
+		wd->nlen += len;
+		wk_stat(dfd, dp->d_name, we, Lflag);
+	}
+	if (dp != NULL) {
+		wd->err = errno;
+		wd->nent = 0;
+	}
+	(void)closedir(dirp);
+}
+
+/*
+ * wk_new()
+ *	allocate a directory to read, dir (of length dlen) with name appended
+ *	unless it is NULL
+ * Return:
+ *	the directory, NULL if out of memory
+ */
+
+static struct wdir *
+wk_new(const char *dir, size_t dlen, const char *name)
+{
+	struct wdir *wd;
+	int res;
+
+	if ((wd = calloc(1, sizeof(*wd))) == NULL)
+		return (NULL);
+	if (name == NULL)
+		res = ((wd->path = strndup(dir, dlen)) == NULL) ? -1 : 0;
+	else if ((dlen > 0) && (dir[dlen - 1] == '/'))
+		res = asprintf(&wd->path, "%.*s%s", (int)dlen, dir, name);
+	else
+		res = asprintf(&wd->path, "%.*s/%s", (int)dlen, dir, name);
+	if (res < 0) {
+		free(wd);
+		return (NULL);
+	}
+	return (wd);
+}
+
+/*
+ * wk_free()
+ *	free a directory
+ */
+
+static void
+wk_free(struct wdir *wd)
+{
+	free(wd->path);
+	free(wd->ent);
+	free(wd->names);
+	free(wd);
+}
+
+/*
+ * wk_ahead()
+ *	queue the subdirectories of a directory just read to be read ahead,
+ *	as far as the budget goes. Called with wkmtx held.
+ */
+
+static void
+wk_ahead(struct wdir *wd)
+{
+	struct wdir *first = NULL, **last = &first, *sd;
+	struct went *we;
+	size_t i;
+
+	for (i = 0; (i < wd->nent) && (nwdir < maxwdir); i++) {
+		we = &wd->ent[i];
+		if ((we->info != FTS_D) || (we->sub != NULL) ||
+		    (Xflag && (we->sb.st_dev != wkroot.sb.st_dev)))
+			continue;
+		if ((sd = wk_new(wd->path, strlen(wd->path),
+		    wd->names + we->name)) == NULL)
+			break;
+		we->sub = sd;
+		*last = sd;
+		last = &sd->next;
+		++nwdir;
+	}
+	if (first == NULL)
+		return;
+	*last = wkhead;
+	wkhead = first;
+	pthread_cond_broadcast(&wkwork);
+}
+
+/*
+ * wk_drop()
+ *	drop a directory read ahead that is not wanted, with the ones read
+ *	ahead below it. One that is not read yet is freed by the thread that
+ *	gets to it. Called with wkmtx held.
+ */
+
+static void
+wk_drop(struct wdir *wd)
+{
+	size_t i;
+
+	if (wd->state != WK_DONE) {
+		wd->dead = 1;
+		return;
+	}
+	for (i = 0; i < wd->nent; i++)
+		if (wd->ent[i].sub != NULL)
+			wk_drop(wd->ent[i].sub);
+	--nwdir;
+	wk_free(wd);
+}
+
+/*
+ * wk_pthread()
+ *	a walk thread, reads the queued directories
+ */
+
+static void *
+wk_pthread(void *arg)
+{
+	struct wdir *wd;
+
+	pthread_mutex_lock(&wkmtx);
+	while (!wkend) {
+		if ((wd = wkhead) == NULL) {
+			pthread_cond_wait(&wkwork, &wkmtx);
+			continue;
+		}
+		wkhead = wd->next;
+		if (!wd->dead) {
+			wd->state = WK_BUSY;
+			++nwkbusy;
+			pthread_mutex_unlock(&wkmtx);
+			wk_readdir(wd);
+			pthread_mutex_lock(&wkmtx);
+			--nwkbusy;
+		}
+		if (wd->dead) {
+			--nwdir;
+			wk_free(wd);
+		} else {
+			wd->state = WK_DONE;
+			wk_ahead(wd);
+		}
+		pthread_cond_broadcast(&wkdone);
+	}
+	pthread_mutex_unlock(&wkmtx);
+	return (NULL);
+}
+
+/*
+ * wk_start()
+ *	start the walk threads for -o walkthreads. If none can be started the
+ *	file trees are walked with fts as usual.
+ * Return:
+ *	0 if ok, -1 otherwise
+ */
+
+static int
+wk_start(void)
+{
+	sigset_t all, omask;
+
+	if (walkthreads == 0)
+		return (0);
+	if ((wkthr = calloc(walkthreads, sizeof(*wkthr))) == NULL) {
+		paxwarn(1, "Unable to allocate memory for walk threads");
+		return (-1);
+	}
+	maxwdir = 16 * walkthreads;
+
+	/*
+	 * signals are handled by the main thread only
+	 */
+	sigfillset(&all);
+	pthread_sigmask(SIG_BLOCK, &all, &omask);
+	for (nwkthr = 0; nwkthr < walkthreads; nwkthr++)
+		if (pthread_create(&wkthr[nwkthr], NULL, wk_pthread, NULL) != 0)
+			break;
+	pthread_sigmask(SIG_SETMASK, &omask, NULL);
+	return (0);
+}
+
+/*
+ * wk_open()
+ *	start walking a file arg, stat'ing it as fts_open() does
+ * Return:
+ *	0 if ok, -1 for an empty name
+ */
+
+static int
+wk_open(const char *name)
+{
+	struct went *we = &wkroot;
+	size_t len;
+
+	if ((len = strlen(name)) == 0)
+		return (-1);
+	memset(we, 0, sizeof(*we));
+	wkplen = strlcpy(wkpath, name, sizeof(wkpath));
+	if (len >= sizeof(wkpath)) {
+		wkplen = sizeof(wkpath) - 1;
+		we->err = ENAMETOOLONG;
+		we->info = FTS_NS;
+	} else
+		wk_stat(AT_FDCWD, wkpath, we, Lflag || Hflag);
+	wkfirst = 1;
+	return (0);
+}
+
+/*
+ * wk_close()
+ *	stop walking the current file arg. When done no thread is reading a
+ *	directory, so the current directory may change.
+ */
+
+static void
+wk_close(void)
+{
+	struct wdir *wd;
+	size_t i;
+
+	pthread_mutex_lock(&wkmtx);
+	while (nwklev > 0) {
+		wd = wklev[--nwklev].wd;
+		for (i = 0; i < wd->nent; i++)
+			if (wd->ent[i].sub != NULL)
+				wk_drop(wd->ent[i].sub);
+		wk_free(wd);
+	}
+	wkdesc = NULL;
+	wkfirst = 0;
+	while (nwkbusy > 0)
+		pthread_cond_wait(&wkdone, &wkmtx);
+	pthread_mutex_unlock(&wkmtx);
+}
+
+/*
+ * wk_end()
+ *	stop the walk threads
+ */
+
+static void
+wk_end(void)
+{
+	struct wdir *wd;
+	int i;
+
+	if (nwkthr == 0)
+		return;
+	wk_close();
+	pthread_mutex_lock(&wkmtx);
+	wkend = 1;
+	pthread_cond_broadcast(&wkwork);
+	pthread_mutex_unlock(&wkmtx);
+	for (i = 0; i < nwkthr; i++)
+		pthread_join(wkthr[i], NULL);
+	while ((wd = wkhead) != NULL) {
+		wkhead = wd->next;
+		wk_free(wd);
+	}
+	free(wkthr);
+	wkthr = NULL;
+	nwkthr = 0;
+	free(wklev);
+	wklev = NULL;
+	maxwklev = 0;
+}
+
+/*
+ * wk_take()
+ *	get the directory handed out last to descend into it: the one read
+ *	ahead, or read it now if no thread got to it yet
+ * Return:
+ *	the directory (see its err), NULL if out of memory
+ */
+
+static struct wdir *
+wk_take(struct went *we)
+{
+	struct wdir *wd, **wp;
+
+	pthread_mutex_lock(&wkmtx);
+	if ((wd = we->sub) != NULL) {
+		we->sub = NULL;
+		--nwdir;
+		while (wd->state == WK_BUSY)
+			pthread_cond_wait(&wkdone, &wkmtx);
+		if (wd->state == WK_QUEUED) {
+			for (wp = &wkhead; *wp != wd; wp = &(*wp)->next)
+				;
+			*wp = wd->next;
+		}
+	}
+	pthread_mutex_unlock(&wkmtx);
+
+	if ((wd == NULL) && ((wd = wk_new(wkpath, wkplen, NULL)) == NULL))
+		return (NULL);
+	if (wd->state != WK_DONE) {
+		wk_readdir(wd);
+		wd->state = WK_DONE;
+	}
+	pthread_mutex_lock(&wkmtx);
+	if (wd->err == 0)
+		wk_ahead(wd);
+	pthread_mutex_unlock(&wkmtx);
+	return (wd);
+}
+
+/*
+ * wk_ent()
+ *	fill in the entry handed out
+ */
+
+static FTSENT *
+wk_ent(int info, int err, struct stat *sbp)
+{
+	wkent.fts_info = info;
+	wkent.fts_errno = err;
+	wkent.fts_path = wkpath;
+	wkent.fts_statp = sbp;
+	return (&wkent);
+}
+
+/*
+ * wk_read()
+ *	the fts_read() of the walk threads
+ * Return:
+ *	the next entry, NULL (with errno 0) when done with the file arg
+ */
+
+static FTSENT *
+wk_read(void)
+{
+	struct wlev *lv;
+	struct went *we;
+	struct wdir *wd;
+	const char *name;
+	size_t len, n;
+	void *p;
+	int i, info, err;
+
+	errno = 0;
+	if (wkfirst) {
+		wkfirst = 0;
+		if (wkroot.info == FTS_D)
+			wkdesc = &wkroot;
+		wkskip = 0;
+		return (wk_ent(wkroot.info, wkroot.err, &wkroot.sb));
+	}
+
+	/*
+	 * descend into the directory handed out last, unless it was skipped
+	 * or is on another file system. Then it is done with right away.
+	 */
+	if ((we = wkdesc) != NULL) {
+		wkdesc = NULL;
+		if (wkskip || (Xflag && (we->sb.st_dev != wkroot.sb.st_dev))) {
+			if (we->sub != NULL) {
+				pthread_mutex_lock(&wkmtx);
+				wk_drop(we->sub);
+				we->sub = NULL;
+				pthread_mutex_unlock(&wkmtx);
+			}
+			return (wk_ent(FTS_DP, 0, &we->sb));
+		}
+		if ((wd = wk_take(we)) == NULL)
+			return (wk_ent(FTS_DNR, ENOMEM, &we->sb));
+		if ((wd->err == 0) && (nwklev == maxwklev)) {
+			if ((p = reallocarray(wklev, maxwklev + 16,
+			    sizeof(*wklev))) == NULL)
+				wd->err = ENOMEM;
+			else {
+				wklev = p;
+				maxwklev += 16;
+			}
+		}
+		if ((err = wd->err) != 0) {
+			pthread_mutex_lock(&wkmtx);
+			for (n = 0; n < wd->nent; n++)
+				if (wd->ent[n].sub != NULL)
+					wk_drop(wd->ent[n].sub);
+			pthread_mutex_unlock(&wkmtx);
+			wk_free(wd);
+			return (wk_ent(FTS_DNR, err, &we->sb));
+		}
+		lv = &wklev[nwklev++];
+		lv->wd = wd;
+		lv->cur = 0;
+		lv->plen = wkplen;
+		lv->sbp = &we->sb;
+	}
+
+	if (nwklev == 0)
+		return (NULL);
+
+	/*
+	 * hand out the next entry of the current directory, or the directory
+	 * in postorder when done with it
+	 */
+	lv = &wklev[nwklev - 1];
+	wkplen = lv->plen;
+	wkpath[wkplen] = '\0';
+	if (lv->cur == lv->wd->nent) {
+		wk_free(lv->wd);
+		--nwklev;
+		return (wk_ent(FTS_DP, 0, lv->sbp));
+	}
+	we = &lv->wd->ent[lv->cur++];
+	name = lv->wd->names + we->name;
+	if ((wkplen == 0) || (wkpath[wkplen - 1] != '/'))
+		wkpath[wkplen++] = '/';
+	len = strlcpy(wkpath + wkplen, name, sizeof(wkpath) - wkplen);
+	info = we->info;
+	if (len >= sizeof(wkpath) - wkplen) {
+		wkplen = sizeof(wkpath) - 1;
+		we->err = ENAMETOOLONG;
+		info = FTS_NS;
+	} else
+		wkplen += len;
+
+	/*
+	 * look for a cycle, as fts does, among the directories above
+	 */
+	if (info == FTS_D) {
+		for (i = 0; i < nwklev; i++)
+			if ((wklev[i].sbp->st_dev == we->sb.st_dev) &&
+			    (wklev[i].sbp->st_ino == we->sb.st_ino))
+				break;
+		if (i < nwklev)
+			info = FTS_DC;
+	}
+	if (info == FTS_D) {
+		wkdesc = we;
+		wkskip = 0;
+	} else if (we->sub != NULL) {
+		pthread_mutex_lock(&wkmtx);
+		wk_drop(we->sub);
+		we->sub = NULL;
+		pthread_mutex_unlock(&wkmtx);
+	}
+	return (wk_ent(info, we->err, &we->sb));
+}
+
 /*
  * getpathname()
  *	Reads a pathname from stdin, handling NUL- or newline-termination.
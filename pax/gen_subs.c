@@ -38,10 +38,9 @@
 #include <sys/types.h>
 
 #include <ctype.h>
-#include <grp.h>
 #include <libgen.h>
 #include <limits.h>
-#include <pwd.h>
+#include <sha2.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -260,11 +259,11 @@ listopt_keyword_string(
 	if (strcmp(keyword, "linkpath") == 0)
 		return arcn->ln_name;
 	if (strcmp(keyword, "uname") == 0) {
-		val = user_from_uid(arcn->sb.st_uid, 0);
+		val = uid_name(arcn->sb.st_uid, 0);
 		return val ? val : "";
 	}
 	if (strcmp(keyword, "gname") == 0) {
-		val = group_from_gid(arcn->sb.st_gid, 0);
+		val = gid_name(arcn->sb.st_gid, 0);
 		return val ? val : "";
 	}
 	if (strcmp(keyword, "name") == 0) {
@@ -454,8 +453,8 @@ ls_list(ARCHD *arcn, time_t now, FILE *fp)
 	    tm) == 0)
 		f_date[0] = '\0';
 	(void)fprintf(fp, "%s%2u %-*.*s %-*.*s ", f_mode, sbp->st_nlink,
-	    NAME_WIDTH, UT_NAMESIZE, user_from_uid(sbp->st_uid, 0), NAME_WIDTH,
-	    UT_NAMESIZE, group_from_gid(sbp->st_gid, 0));
+	    NAME_WIDTH, UT_NAMESIZE, uid_name(sbp->st_uid, 0), NAME_WIDTH,
+	    UT_NAMESIZE, gid_name(sbp->st_gid, 0));
 
 	/*
 	 * print device id's for devices, or sizes for other nodes
@@ -989,3 +988,215 @@ fieldcpy(char *buf, size_t bufsz, const char *field, size_t fieldsz)
 		*p = '\0';
 	return (i);
 }
+
+/*
+ * the digest of the file being stored, see dgst_start()
+ */
+static SHA2_CTX dgstctx;
+
+/*
+ * dgst_start(), dgst_add(), dgst_end()
+ *	compute the SHA-256 of the data of the file being stored. Only one
+ *	file is stored at a time, so one context is enough.
+ */
+
+void
+dgst_start(void)
+{
+	SHA256Init(&dgstctx);
+}
+
+void
+dgst_add(const char *pt, int cnt)
+{
+	SHA256Update(&dgstctx, (const u_int8_t *)pt, (size_t)cnt);
+}
+
+void
+dgst_end(u_char *dgst)
+{
+	SHA256Final(dgst, &dgstctx);
+}
+
+/*
+ * dgst_hex()
+ *	convert a digest to the hex string stored in the archive. hex must
+ *	have room for 2 * DGSTLEN + 1 chars.
+ */
+
+void
+dgst_hex(const u_char *dgst, char *hex)
+{
+	static const char hexdig[] = "0123456789abcdef";
+	int i;
+
+	for (i = 0; i < DGSTLEN; i++) {
+		*hex++ = hexdig[dgst[i] >> 4];
+		*hex++ = hexdig[dgst[i] & 0xf];
+	}
+	*hex = '\0';
+}
+
+/*
+ * dgst_unhex()
+ *	convert a digest stored in the archive back to binary
+ * Return:
+ *	0 if ok, -1 if hex is not a digest
+ */
+
+int
+dgst_unhex(const char *hex, u_char *dgst)
+{
+	int i, d, n = 0;
+
+	for (i = 0; i < 2 * DGSTLEN; i++) {
+		if ((hex[i] >= '0') && (hex[i] <= '9'))
+			d = hex[i] - '0';
+		else if ((hex[i] >= 'a') && (hex[i] <= 'f'))
+			d = hex[i] - 'a' + 10;
+		else if ((hex[i] >= 'A') && (hex[i] <= 'F'))
+			d = hex[i] - 'A' + 10;
+		else
+			return (-1);
+		n = (n << 4) | d;
+		if (i & 1) {
+			dgst[i >> 1] = (u_char)n;
+			n = 0;
+		}
+	}
+	return ((hex[i] == '\0') ? 0 : -1);
+}
+
+/*
+ * The names of a member are kept in buffers of its ARCHD. They grow to fit
+ * the longest name seen and are used again for the next member, so only
+ * as much as the names take is touched, and a name is not limited to any
+ * fixed size. A buffer is NULL (with a size of 0) until it is needed.
+ */
+
+/*
+ * arcn_room()
+ *	make room for a name of len characters (and the NUL) in the file name
+ *	buffer of a member, or with ln set in its link name buffer. When the
+ *	buffer moves, org_name follows it if it pointed at it.
+ * Return:
+ *	0 if ok, -1 if the name is too long or out of memory
+ */
+
+int
+arcn_room(ARCHD *arcn, int ln, size_t len)
+{
+	char **bufp = ln ? &arcn->ln_name : &arcn->name;
+	size_t *sizep = ln ? &arcn->lnsize : &arcn->nsize;
+	size_t nsz;
+	char *nbuf;
+	int org;
+
+	if (len < *sizep)
+		return (0);
+	if (len > PAXNAMEMAX) {
+		paxwarn(1, "File name too long, %zu characters", len);
+		return (-1);
+	}
+	for (nsz = MAXIMUM(*sizep, NAMEBUF); nsz <= len; nsz *= 2)
+		;
+	org = (*bufp != NULL) && (arcn->org_name == *bufp);
+	if ((nbuf = realloc(*bufp, nsz)) == NULL) {
+		paxwarn(1, "Unable to allocate memory for file name");
+		return (-1);
+	}
+	if (*sizep == 0)
+		*nbuf = '\0';
+	if (org)
+		arcn->org_name = nbuf;
+	*bufp = nbuf;
+	*sizep = nsz;
+	return (0);
+}
+
+/*
+ * arcn_set()
+ *	store the file name (ln set: the link name) of a member, len
+ *	characters of name (which may be in the buffer itself)
+ * Return:
+ *	0 if ok, -1 if the name is too long or out of memory
+ */
+
+int
+arcn_set(ARCHD *arcn, int ln, const char *name, size_t len)
+{
+	char *buf;
+
+	if (arcn_room(arcn, ln, len) < 0)
+		return (-1);
+	buf = ln ? arcn->ln_name : arcn->name;
+	memmove(buf, name, len);
+	buf[len] = '\0';
+	if (ln)
+		arcn->ln_nlen = (int)len;
+	else
+		arcn->nlen = (int)len;
+	return (0);
+}
+
+/*
+ * arcn_clear()
+ *	clear a member for the next header, keeping its name buffers (which
+ *	are made to exist and hold empty names)
+ * Return:
+ *	0 if ok, -1 if out of memory
+ */
+
+int
+arcn_clear(ARCHD *arcn)
+{
+	char *name = arcn->name;
+	char *ln_name = arcn->ln_name;
+	size_t nsize = arcn->nsize;
+	size_t lnsize = arcn->lnsize;
+
+	memset(arcn, 0, sizeof(*arcn));
+	arcn->name = name;
+	arcn->nsize = nsize;
+	arcn->ln_name = ln_name;
+	arcn->lnsize = lnsize;
+	if ((arcn_set(arcn, 0, "", 0) < 0) || (arcn_set(arcn, 1, "", 0) < 0))
+		return (-1);
+	return (0);
+}
+
+/*
+ * arcn_dup()
+ *	copy the names of a member into the name buffers of another
+ * Return:
+ *	0 if ok, -1 if out of memory
+ */
+
+int
+arcn_dup(ARCHD *dst, const ARCHD *src)
+{
+	if ((arcn_set(dst, 0, (src->name != NULL) ? src->name : "",
+	    src->nlen) < 0) ||
+	    (arcn_set(dst, 1, (src->ln_name != NULL) ? src->ln_name : "",
+	    src->ln_nlen) < 0))
+		return (-1);
+	return (0);
+}
+
+/*
+ * arcn_free()
+ *	release the name buffers of a member
+ */
+
+void
+arcn_free(ARCHD *arcn)
+{
+	if ((arcn->org_name != NULL) && ((arcn->org_name == arcn->name) ||
+	    (arcn->org_name == arcn->ln_name)))
+		arcn->org_name = NULL;
+	free(arcn->name);
+	free(arcn->ln_name);
+	arcn->name = arcn->ln_name = NULL;
+	arcn->nsize = arcn->lnsize = 0;
+	arcn->nlen = arcn->ln_nlen = 0;
+}
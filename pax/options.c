@@ -230,7 +230,7 @@ FSUB fsub[] = {
 	{NULL, 0, 4, 0, 0, 0, 0, gzip_id},
     /* 10: POSIX PAX */
 	{"pax", 5120, BLKMULT, 0, 1, BLKMULT, 0, pax_id, no_op, ustar_rd, tar_endrd,
-	 no_op, pax_wr, tar_endwr, tar_trail, pax_opt},
+	 no_op, pax_wr, tar_endwr, tar_trail, pax_opt, 1},
 #endif
 };
 #define F_OCPIO 0 /* format when called as cpio -6 */
@@ -1691,6 +1691,8 @@ static void
 opt_common(void)
 {
 	OPLIST **prev, *opt, *next;
+	const char *errstr;
+	off_t sz;
 
 	prev = &ophead;
 	while ((opt = *prev) != NULL) {
@@ -1700,13 +1702,121 @@ opt_common(void)
 				paxwarn(1, "Unable to record listopt format");
 				pax_usage();
 			}
-			*prev = next;
-			free(opt->name);
-			free(opt->value);
-			free(opt);
+		} else if (strcmp(opt->name, "bufsize") == 0) {
+			sz = str_offt(opt->value);
+			if ((sz <= 0) || (sz > MAXIOBLK) || (sz % BLKMULT)) {
+				paxwarn(1, "Invalid bufsize %s, must be a %d "
+				    "byte multiple no larger than %d",
+				    opt->value, BLKMULT, MAXIOBLK);
+				pax_usage();
+			}
+			iosz = (int)sz;
+		} else if (strcmp(opt->name, "ftmem") == 0) {
+			if ((sz = str_offt(opt->value)) <= 0) {
+				paxwarn(1, "Invalid ftmem %s", opt->value);
+				pax_usage();
+			}
+			ftmem = (size_t)sz;
+		} else if (strcmp(opt->name, "gzip") == 0) {
+			if (strcmp(opt->value, "builtin") == 0)
+				gzip_builtin = 1;
+			else if (strcmp(opt->value, "external") == 0)
+				gzip_builtin = 0;
+			else {
+				paxwarn(1, "Invalid gzip %s, must be builtin "
+				    "or external", opt->value);
+				pax_usage();
+			}
+		} else if (strcmp(opt->name, "gzthreads") == 0) {
+			gzthreads = strtonum(opt->value, 1, MAXGZTHREADS,
+			    &errstr);
+			if (errstr != NULL) {
+				paxwarn(1, "Invalid gzthreads %s, must be 1 "
+				    "to %d", opt->value, MAXGZTHREADS);
+				pax_usage();
+			}
+		} else if ((strcmp(opt->name, "group") == 0) ||
+		    (strcmp(opt->name, "passwd") == 0)) {
+			if (idn_load(opt->value, *opt->name == 'g') < 0)
+				pax_usage();
+		} else if (strcmp(opt->name, "index") == 0) {
+			if (*opt->value == '\0') {
+				paxwarn(1, "Invalid index, a file name is "
+				    "required");
+				pax_usage();
+			}
+			free(idxfile);
+			idxfile = opt->value;
+			opt->value = NULL;
+		} else if (strcmp(opt->name, "hashthreads") == 0) {
+			hashthreads = strtonum(opt->value, 1, MAXHASHTHREADS,
+			    &errstr);
+			if (errstr != NULL) {
+				paxwarn(1, "Invalid hashthreads %s, must be 1 "
+				    "to %d", opt->value, MAXHASHTHREADS);
+				pax_usage();
+			}
+		} else if (strcmp(opt->name, "iobufs") == 0) {
+			iobufs = strtonum(opt->value, 1, MAXIOBUFS, &errstr);
+			if (errstr != NULL) {
+				paxwarn(1, "Invalid iobufs %s, must be 1 to %d",
+				    opt->value, MAXIOBUFS);
+				pax_usage();
+			}
+		} else if (strcmp(opt->name, "verify") == 0) {
+			if ((*opt->value == '\0') ||
+			    (strcmp(opt->value, "archive") == 0))
+				verify = VFY_ARC;
+			else if (strcmp(opt->value, "fs") == 0)
+				verify = VFY_FS;
+			else {
+				paxwarn(1, "Invalid verify %s, must be archive "
+				    "or fs", opt->value);
+				pax_usage();
+			}
+			if (act != LIST) {
+				paxwarn(1, "verify is only used when listing "
+				    "an archive");
+				pax_usage();
+			}
+		} else if (strcmp(opt->name, "prefetch") == 0) {
+			if ((sz = str_offt(opt->value)) <= 0) {
+				paxwarn(1, "Invalid prefetch %s", opt->value);
+				pax_usage();
+			}
+			prefetch = (size_t)sz;
+		} else if (strcmp(opt->name, "rdthreads") == 0) {
+			rdthreads = strtonum(opt->value, 1, MAXRDTHREADS,
+			    &errstr);
+			if (errstr != NULL) {
+				paxwarn(1, "Invalid rdthreads %s, must be 1 "
+				    "to %d", opt->value, MAXRDTHREADS);
+				pax_usage();
+			}
+		} else if (strcmp(opt->name, "walkthreads") == 0) {
+			walkthreads = strtonum(opt->value, 1, MAXWKTHREADS,
+			    &errstr);
+			if (errstr != NULL) {
+				paxwarn(1, "Invalid walkthreads %s, must be 1 "
+				    "to %d", opt->value, MAXWKTHREADS);
+				pax_usage();
+			}
+		} else if (strcmp(opt->name, "xthreads") == 0) {
+			xthreads = strtonum(opt->value, 1, MAXXTHREADS,
+			    &errstr);
+			if (errstr != NULL) {
+				paxwarn(1, "Invalid xthreads %s, must be 1 "
+				    "to %d", opt->value, MAXXTHREADS);
+				pax_usage();
+			}
+		} else {
+			prev = &opt->fow;
 			continue;
 		}
-		prev = &opt->fow;
+		*prev = next;
+		free(opt->name);
+		free(opt->value);
+		free(opt);
 	}
 
 	optail = ophead;
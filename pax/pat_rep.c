@@ -51,9 +51,13 @@
 typedef struct replace {
 	char *nstr;   /* the new string we will substitute with */
 	regex_t rcmp; /* compiled regular expression used to match */
+	char *lit;    /* literal a match must contain, NULL if none */
+	size_t llen;  /* length of lit */
 	int flgs;     /* print conversions? global in operation?  */
 #define PRNT 0x1
 #define GLOB 0x2
+#define ANCH 0x4  /* a match must start with lit */
+#define LITRE 0x8 /* the expression is just lit */
 	struct replace *fow; /* pointer to next pattern */
 } REPLACE;
 
@@ -67,13 +71,20 @@ typedef struct replace {
 #define MAXSUBEXP 10            /* max subexpressions, DO NOT CHANGE */
 static PATTERN *pathead = NULL; /* file pattern match list head */
 static PATTERN *pattail = NULL; /* file pattern match list tail */
+static PATTERN *wildhead = NULL; /* patterns with wildcards, in order */
+static PATTERN *wildtail = NULL;
+static int patseq;               /* position of the next pattern */
 static REPLACE *rephead = NULL; /* replacement string list head */
 static REPLACE *reptail = NULL; /* replacement string list tail */
 
-static int rep_name(char *, size_t, int *, int);
+static void rep_lit(REPLACE *, const char *);
+static int rep_exec(REPLACE *, char *, regmatch_t *);
+static int rep_name(ARCHD *, int, int);
 static int tty_rename(ARCHD *);
-static int fix_path(char *, int *, char *, int);
+static int fix_path(ARCHD *, int, char *, int);
 static int fn_match(char *, char *, char **);
+static int lit_match(PATTERN *, char *, char **);
+static void pat_unindex(PATTERN *);
 static char *range_match(char *, int);
 static int resub(regex_t *, regmatch_t *, char *, char *, char *, char *);
 
@@ -145,6 +156,13 @@ rep_add(char *str)
 		return (-1);
 	}
 
+	/*
+	 * find the literal a name must contain to match, to check for it
+	 * before running the regular expression
+	 */
+	rep->flgs = 0;
+	rep_lit(rep, str + 1);
+
 	/*
 	 * put the delimiter back in case we need an error message and
 	 * locate the delimiter at the end of the replacement string
@@ -161,6 +179,7 @@ rep_add(char *str)
 	}
 	if (*pt2 == '\0') {
 		regfree(&(rep->rcmp));
+		free(rep->lit);
 		free(rep);
 		paxwarn(1, "Invalid replacement string %s", str);
 		return (-1);
@@ -169,7 +188,6 @@ rep_add(char *str)
 	*pt2 = '\0';
 	rep->nstr = pt1;
 	pt1 = pt2++;
-	rep->flgs = 0;
 
 	/*
 	 * set the options if any
@@ -186,6 +204,7 @@ rep_add(char *str)
 			break;
 		default:
 			regfree(&(rep->rcmp));
+			free(rep->lit);
 			free(rep);
 			*pt1 = *str;
 			paxwarn(1, "Invalid replacement string option %s", str);
@@ -207,6 +226,119 @@ rep_add(char *str)
 	return (0);
 }
 
+/*
+ * rep_lit()
+ *	find a literal that every match of the basic regular expression re
+ *	must contain: the longest run of ordinary characters, outside of
+ *	subexpressions, that no '*' or interval applies to. When re starts
+ *	with '^' and such a run, a match must start with it (ANCH), and when
+ *	re is nothing else but the literal, it is matched without regexec()
+ *	(LITRE). Anything not understood here just ends a run, and without a
+ *	literal every name is handed to regexec().
+ */
+
+static void
+rep_lit(REPLACE *rep, const char *re)
+{
+	const char *p = re;
+	char *run;
+	size_t n = 0;
+	int depth = 0, first = 1, pure = 1, anch = 0;
+	char c, d;
+
+	rep->lit = NULL;
+	rep->llen = 0;
+	if (((run = malloc(strlen(re) + 1)) == NULL) ||
+	    ((rep->lit = malloc(strlen(re) + 1)) == NULL)) {
+		free(run);
+		return;
+	}
+	if (*p == '^') {
+		anch = 1;
+		++p;
+	}
+	for (;;) {
+		c = *p;
+		if ((c == '\\') && (p[1] != '\0') &&
+		    (strchr(".[]*^$\\/", p[1]) != NULL)) {
+			c = p[1];
+			p += 2;
+			if (depth == 0)
+				run[n++] = c;
+			continue;
+		}
+		if ((c != '\0') && (strchr(".[*^$\\", c) == NULL)) {
+			++p;
+			if (depth == 0)
+				run[n++] = c;
+			continue;
+		}
+
+		/*
+		 * the run ends, a '*' or an interval applies to the last
+		 * character of it
+		 */
+		if ((n > 0) &&
+		    ((c == '*') || ((c == '\\') && (p[1] == '{'))))
+			--n;
+		if ((n > 0) && ((first && anch) ||
+		    (!(rep->flgs & ANCH) && (n > rep->llen)))) {
+			memcpy(rep->lit, run, n);
+			rep->llen = n;
+			if (first && anch)
+				rep->flgs |= ANCH;
+		}
+		first = 0;
+		n = 0;
+		if (c == '\0')
+			break;
+		pure = 0;
+
+		/*
+		 * skip over what ended the run
+		 */
+		if (c == '[') {
+			if (*++p == '^')
+				++p;
+			if (*p == ']')
+				++p;
+			while ((*p != '\0') && (*p != ']')) {
+				if ((*p != '[') || ((p[1] != ':') &&
+				    (p[1] != '=') && (p[1] != '.'))) {
+					++p;
+					continue;
+				}
+				for (d = p[1], p += 2; (*p != '\0') &&
+				    ((*p != d) || (p[1] != ']')); ++p)
+					;
+				if (*p != '\0')
+					p += 2;
+			}
+		} else if ((c == '\\') && (p[1] == '{')) {
+			for (p += 2; (*p != '\0') &&
+			    ((*p != '\\') || (p[1] != '}')); ++p)
+				;
+			if (*p != '\0')
+				++p;
+		} else if (c == '\\') {
+			if (p[1] == '(')
+				++depth;
+			else if (p[1] == ')')
+				--depth;
+			if (p[1] != '\0')
+				++p;
+		}
+		if (*p != '\0')
+			++p;
+	}
+	free(run);
+	if (rep->llen == 0) {
+		free(rep->lit);
+		rep->lit = NULL;
+	} else if (pure)
+		rep->flgs |= LITRE;
+}
+
 /*
  * pat_add()
  *	add a pattern match to the pattern match list. Pattern matches are used
@@ -245,8 +377,27 @@ pat_add(char *str, char *chdirname)
 	pt->pend = NULL;
 	pt->plen = strlen(str);
 	pt->fow = NULL;
+	pt->wfow = NULL;
 	pt->flgs = 0;
 	pt->chdname = chdirname;
+	pt->seq = patseq++;
+
+	/*
+	 * patterns without any wildcards are looked up by name, the others
+	 * are kept in a list of their own
+	 */
+	if (strpbrk(str, "*?[\\") == NULL) {
+		pt->flgs |= NO_WILD;
+		if (pidx_add(pt) < 0) {
+			free(pt);
+			return (-1);
+		}
+	} else if (wildhead == NULL)
+		wildtail = wildhead = pt;
+	else {
+		wildtail->wfow = pt;
+		wildtail = pt;
+	}
 
 	if (pathead == NULL) {
 		pattail = pathead = pt;
@@ -305,6 +456,7 @@ pat_sel(ARCHD *arcn)
 {
 	PATTERN *pt;
 	PATTERN **ppt;
+	char *pstr;
 	size_t len;
 
 	/*
@@ -349,13 +501,15 @@ pat_sel(ARCHD *arcn)
 		if (pt->pend != NULL)
 			*pt->pend = '\0';
 
-		if ((pt->pstr = strdup(arcn->name)) == NULL) {
+		if ((pstr = strdup(arcn->name)) == NULL) {
 			paxwarn(1, "Pattern select out of memory");
 			if (pt->pend != NULL)
 				*pt->pend = '/';
 			pt->pend = NULL;
 			return (-1);
 		}
+		pat_unindex(pt);
+		pt->pstr = pstr;
 
 		/*
 		 * put the trailing / back in the source string
@@ -376,7 +530,11 @@ pat_sel(ARCHD *arcn)
 		}
 		pt->flgs = DIR_MTCH | MTCH;
 		arcn->pat = pt;
-		return (0);
+
+		/*
+		 * from now on it is looked up by its new name
+		 */
+		return (pidx_add(pt));
 	}
 
 	/*
@@ -402,6 +560,7 @@ pat_sel(ARCHD *arcn)
 		return (-1);
 	}
 	*ppt = pt->fow;
+	pat_unindex(pt);
 	free(pt);
 	arcn->pat = NULL;
 	return (0);
@@ -422,7 +581,9 @@ pat_sel(ARCHD *arcn)
 int
 pat_match(ARCHD *arcn)
 {
-	PATTERN *pt;
+	PATTERN *pt, *lpt;
+	char *name;
+	int len;
 
 	arcn->pat = NULL;
 
@@ -437,27 +598,29 @@ pat_match(ARCHD *arcn)
 	}
 
 	/*
-	 * have to search down the list one at a time looking for a match.
+	 * the first pattern in the list that matches wins. Look up the name,
+	 * and those of the directories above it, among the patterns without
+	 * wildcards, then try the patterns with wildcards that come before
+	 * the one found.
 	 */
-	pt = pathead;
-	while (pt != NULL) {
-		/*
-		 * check for a file name match unless we have DIR_MTCH set in
-		 * this pattern then we want a prefix match
-		 */
-		if (pt->flgs & DIR_MTCH) {
-			/*
-			 * this pattern was matched before to a directory
-			 * as we must have -n set for this (but not -d). We can
-			 * only match CHILDREN of that directory so we must use
-			 * an exact prefix match (no wildcards).
-			 */
-			if ((arcn->name[pt->plen] == '/') &&
-			    (strncmp(pt->pstr, arcn->name, pt->plen) == 0))
-				break;
-		} else if (fn_match(pt->pstr, arcn->name, &pt->pend) == 0)
+	name = arcn->name;
+	if ((pt = pidx_get(name, strlen(name), 0)) != NULL)
+		pt->pend = NULL;
+	for (len = 0; name[len] != '\0'; len++) {
+		if ((name[len] != '/') ||
+		    ((lpt = pidx_get(name, len, 1)) == NULL) ||
+		    ((pt != NULL) && (pt->seq < lpt->seq)))
+			continue;
+		pt = lpt;
+		pt->pend = name + len;
+	}
+	for (lpt = wildhead; lpt != NULL; lpt = lpt->wfow) {
+		if ((pt != NULL) && (pt->seq < lpt->seq))
 			break;
-		pt = pt->fow;
+		if (fn_match(lpt->pstr, name, &lpt->pend) == 0) {
+			pt = lpt;
+			break;
+		}
 	}
 
 	/*
@@ -482,6 +645,89 @@ pat_match(ARCHD *arcn)
 	return (1);
 }
 
+/*
+ * pat_unindex()
+ *	take a pattern out of the index or the list of patterns with
+ *	wildcards, before it is changed or deleted
+ */
+
+static void
+pat_unindex(PATTERN *pt)
+{
+	PATTERN **ppt, *prev = NULL;
+
+	if (pt->flgs & (NO_WILD | DIR_MTCH)) {
+		pidx_del(pt);
+		return;
+	}
+	for (ppt = &wildhead; *ppt != NULL; ppt = &(*ppt)->wfow) {
+		if (*ppt == pt) {
+			if ((*ppt = pt->wfow) == NULL)
+				wildtail = prev;
+			return;
+		}
+		prev = *ppt;
+	}
+}
+
+/*
+ * pat_next()
+ *	walk the list of user supplied patterns.
+ * Return:
+ *	the pattern after pt (the first one when pt is NULL), NULL at the end
+ */
+
+PATTERN *
+pat_next(PATTERN *pt)
+{
+	return (pt == NULL ? pathead : pt->fow);
+}
+
+/*
+ * pat_test()
+ *	check if a name matches a pattern the way pat_match() would, without
+ *	changing any of the pattern state.
+ * Return:
+ *	0 if the name matches, -1 otherwise
+ */
+
+int
+pat_test(PATTERN *pt, char *name)
+{
+	char *pend;
+
+	if (pt->flgs & DIR_MTCH)
+		return (((name[pt->plen] == '/') &&
+		    (strncmp(pt->pstr, name, pt->plen) == 0)) ? 0 : -1);
+	if (pt->flgs & NO_WILD)
+		return (lit_match(pt, name, &pend));
+	return (fn_match(pt->pstr, name, &pend));
+}
+
+/*
+ * lit_match()
+ *	fn_match() for a pattern without wildcards: the name must be the
+ *	pattern or (without -d) be below it.
+ * Return:
+ *	0 if the name matches, -1 otherwise
+ *	Note: *pend may be changed to show where the prefix ends.
+ */
+
+static int
+lit_match(PATTERN *pt, char *string, char **pend)
+{
+	*pend = NULL;
+	if (strncmp(pt->pstr, string, pt->plen) != 0)
+		return (-1);
+	string += pt->plen;
+	if (*string == '\0')
+		return (0);
+	if ((dflag == 1) || (*string != '/'))
+		return (-1);
+	*pend = string;
+	return (0);
+}
+
 /*
  * fn_match()
  * Return:
@@ -716,14 +962,11 @@ mod_name(ARCHD *arcn)
 		 * we have replacement strings, modify the name and the link
 		 * name if any.
 		 */
-		if ((res = rep_name(arcn->name, sizeof(arcn->name),
-		    &(arcn->nlen), 1)) != 0)
+		if ((res = rep_name(arcn, 0, 1)) != 0)
 			return (res);
 
 		if (PAX_IS_LINK(arcn->type)) {
-			if ((res = rep_name(arcn->ln_name,
-			    sizeof(arcn->ln_name), &(arcn->ln_nlen), 0)) !=
-			    0)
+			if ((res = rep_name(arcn, 1, 0)) != 0)
 				return (res);
 		}
 	}
@@ -739,8 +982,7 @@ mod_name(ARCHD *arcn)
 		if ((res = tty_rename(arcn)) != 0)
 			return (res);
 		if (PAX_IS_LINK(arcn->type))
-			sub_name(arcn->ln_name, &(arcn->ln_nlen),
-			    sizeof(arcn->ln_name));
+			sub_name(arcn);
 		arcn->invalid = PAX_INVALID_NONE;
 	}
 	return (res);
@@ -807,10 +1049,7 @@ tty_rename(ARCHD *arcn)
 	 */
 	tty_prnt("Processing continues, name changed to: %s\n", tmpname);
 	res = add_name(arcn->name, arcn->nlen, tmpname);
-	arcn->nlen = strlcpy(arcn->name, tmpname, sizeof(arcn->name));
-	if ((size_t)arcn->nlen >= sizeof(arcn->name))
-		arcn->nlen = sizeof(arcn->name) - 1; /* XXX truncate? */
-	if (res < 0)
+	if ((arcn_set(arcn, 0, tmpname, strlen(tmpname)) < 0) || (res < 0))
 		return (-1);
 	return (0);
 }
@@ -826,7 +1065,7 @@ tty_rename(ARCHD *arcn)
 int
 set_dest(ARCHD *arcn, char *dest_dir, int dir_len)
 {
-	if (fix_path(arcn->name, &(arcn->nlen), dest_dir, dir_len) < 0)
+	if (fix_path(arcn, 0, dest_dir, dir_len) < 0)
 		return (-1);
 
 	/*
@@ -837,60 +1076,41 @@ set_dest(ARCHD *arcn, char *dest_dir, int dir_len)
 	if (!PAX_IS_HARDLINK(arcn->type))
 		return (0);
 
-	if (fix_path(arcn->ln_name, &(arcn->ln_nlen), dest_dir, dir_len) < 0)
+	if (fix_path(arcn, 1, dest_dir, dir_len) < 0)
 		return (-1);
 	return (0);
 }
 
 /*
  * fix_path
- *	concatenate dir_name and or_name and store the result in or_name (if
- *	it fits). This is one ugly function.
+ *	concatenate dir_name and the file name (ln set: the link name) of a
+ *	member and store the result as that name.
  * Return:
  *	0 if ok, -1 if the final name is too long
  */
 
 static int
-fix_path(char *or_name, int *or_len, char *dir_name, int dir_len)
+fix_path(ARCHD *arcn, int ln, char *dir_name, int dir_len)
 {
-	char *src;
-	char *dest;
-	char *start;
-	int len;
+	char *or_name = ln ? arcn->ln_name : arcn->name;
+	int *or_len = ln ? &arcn->ln_nlen : &arcn->nlen;
+	int skip = (*or_name == '/');
+	size_t len = dir_len + *or_len - skip;
 
 	/*
-	 * we shift the or_name to the right enough to tack in the dir_name
-	 * at the front. We make sure we have enough space for it all before
-	 * we start. since dest always ends in a slash, we skip of or_name
+	 * make room, shift the name to the right to tack in the dir_name at
+	 * the front. since dest always ends in a slash, we skip of the name
 	 * if it also starts with one.
 	 */
-	start = or_name;
-	src = start + *or_len;
-	dest = src + dir_len;
-	if (*start == '/') {
-		++start;
-		--dest;
-	}
-	if ((len = dest - or_name) > PAXPATHLEN) {
-		paxwarn(1, "File name %s/%s, too long", dir_name, start);
+	if (arcn_room(arcn, ln, len) < 0) {
+		paxwarn(1, "File name %s/%s, too long", dir_name,
+		    or_name + skip);
 		return (-1);
 	}
-	*or_len = len;
-
-	/*
-	 * enough space, shift
-	 */
-	while (src >= start)
-		*dest-- = *src--;
-	src = dir_name + dir_len - 1;
-
-	/*
-	 * splice in the destination directory name
-	 */
-	while (src >= dir_name)
-		*dest-- = *src--;
-
-	*(or_name + len) = '\0';
+	or_name = ln ? arcn->ln_name : arcn->name;
+	memmove(or_name + dir_len, or_name + skip, *or_len - skip + 1);
+	memcpy(or_name, dir_name, dir_len);
+	*or_len = (int)len;
 	return (0);
 }
 
@@ -903,11 +1123,8 @@ fix_path(char *or_name, int *or_len, char *dir_name, int dir_len)
  *	routines (regexp() ought to win a prize as having the most cryptic
  *	library function manual page).
  *	--Parameters--
- *	name is the file name we are going to apply the regular expressions to
- *	(and may be modified)
- *	nsize is the size of the name buffer.
- *	nlen is the length of this name (and is modified to hold the length of
- *	the final string).
+ *	arcn is the member whose file name (or with ln set, link name) we are
+ *	going to apply the regular expressions to (and may be modified)
  *	prnt is a flag that says whether to print the final result.
  * Return:
  *	0 if substitution was successful, 1 if we are to skip the file (the name
@@ -915,32 +1132,50 @@ fix_path(char *or_name, int *or_len, char *dir_name, int dir_len)
  */
 
 static int
-rep_name(char *name, size_t nsize, int *nlen, int prnt)
+rep_name(ARCHD *arcn, int ln, int prnt)
 {
+	static char *nname;  /* final result of all replacements */
+	static size_t nnsize; /* size of nname */
 	REPLACE *pt;
+	char *name = ln ? arcn->ln_name : arcn->name;
 	char *inpt;
 	char *outpt;
 	char *endpt;
 	char *rpt;
-	int found = 0;
+	char *nbuf;
+	size_t nsz;
+	int found;
+	int full;
 	int res;
 	regmatch_t pm[MAXSUBEXP];
-	char nname[PAXPATHLEN + 1]; /* final result of all replacements */
-	char buf1[PAXPATHLEN + 1];  /* where we work on the name */
 
 	/*
-	 * copy the name into buf1, where we will work on it. We need to keep
-	 * the orig string around so we can print out the result of the final
+	 * nname grows (and the replacements start over) when the result does
+	 * not fit in it
+	 */
+	if (nnsize == 0) {
+		if ((nname = malloc(NAMEBUF)) == NULL) {
+			paxwarn(1, "Unable to allocate memory for replacement "
+			    "name");
+			return (1);
+		}
+		nnsize = NAMEBUF;
+	}
+
+again:
+	/*
+	 * the name is left alone until the end, we need to keep the orig
+	 * string around so we can print out the result of the final
 	 * replacement. We build up the final result in nname. inpt points at
 	 * the string we apply the regular expression to. prnt is used to
 	 * suppress printing when we handle replacements on the link field
 	 * (the user already saw that substitution go by)
 	 */
 	pt = rephead;
-	(void)strlcpy(buf1, name, sizeof(buf1));
-	inpt = buf1;
+	inpt = name;
 	outpt = nname;
-	endpt = outpt + PAXPATHLEN;
+	endpt = outpt + nnsize - 1;
+	found = full = 0;
 
 	/*
 	 * try each replacement string in order
@@ -952,23 +1187,25 @@ rep_name(char *name, size_t nsize, int *nlen, int prnt)
 			 * check for a successful substitution, if not go to
 			 * the next pattern, or cleanup if we were global
 			 */
-			if (regexec(&(pt->rcmp), inpt, MAXSUBEXP, pm, 0) != 0)
+			if (rep_exec(pt, inpt, pm) != 0)
 				break;
 
 			/*
 			 * ok we found one. We have three parts, the prefix
 			 * which did not match, the section that did and the
 			 * tail (that also did not match). Copy the prefix to
-			 * the final output buffer (watching to make sure we
-			 * do not create a string too long).
+			 * the final output buffer (watching for the end of
+			 * it).
 			 */
 			found = 1;
 			rpt = inpt + pm[0].rm_so;
 
 			while ((inpt < rpt) && (outpt < endpt))
 				*outpt++ = *inpt++;
-			if (outpt == endpt)
+			if (inpt < rpt) {
+				full = 1;
 				break;
+			}
 
 			/*
 			 * for the second part (which matched the regular
@@ -977,7 +1214,11 @@ rep_name(char *name, size_t nsize, int *nlen, int prnt)
 			 * final output. If we have problems, skip it.
 			 */
 			if ((res = resub(&(pt->rcmp), pm, pt->nstr, oinpt,
-			    outpt, endpt)) < 0) {
+			    outpt, endpt)) == -2) {
+				full = 1;
+				break;
+			}
+			if (res < 0) {
 				if (prnt)
 					paxwarn(1, "Replacement name error %s",
 					    name);
@@ -992,14 +1233,25 @@ rep_name(char *name, size_t nsize, int *nlen, int prnt)
 			 * expression (inpt always points at the first char in
 			 * the string to process). If we are not doing a global
 			 * substitution, we will use inpt to copy the tail to
-			 * the final result. Make sure we do not overrun the
-			 * output buffer
+			 * the final result.
 			 */
 			inpt += pm[0].rm_eo - pm[0].rm_so;
 
-			if ((outpt == endpt) || (*inpt == '\0'))
+			if (*inpt == '\0')
 				break;
 
+			/*
+			 * an empty match is found again at the same place,
+			 * without end: the name can never be long enough
+			 */
+			if ((pm[0].rm_so == pm[0].rm_eo) && (pt->flgs & GLOB)) {
+				*outpt = '\0';
+				if (prnt)
+					paxwarn(1, "Replacement name too long "
+					    "%s >> %s", name, nname);
+				return (1);
+			}
+
 			/*
 			 * if the user wants global we keep trying to
 			 * substitute until it fails, then we are done.
@@ -1015,51 +1267,90 @@ rep_name(char *name, size_t nsize, int *nlen, int prnt)
 		pt = pt->fow;
 	}
 
-	if (found) {
-		/*
-		 * we had a substitution, copy the last tail piece (if there is
-		 * room) to the final result
-		 */
-		while ((outpt < endpt) && (*inpt != '\0'))
-			*outpt++ = *inpt++;
+	if (!found)
+		return (0);
 
-		*outpt = '\0';
-		if ((outpt == endpt) && (*inpt != '\0')) {
+	/*
+	 * we had a substitution, copy the last tail piece (if there is room)
+	 * to the final result
+	 */
+	while ((outpt < endpt) && (*inpt != '\0'))
+		*outpt++ = *inpt++;
+	*outpt = '\0';
+	if (full || (*inpt != '\0')) {
+		nsz = 2 * nnsize;
+		if ((nsz - 1 > PAXNAMEMAX) ||
+		    ((nbuf = realloc(nname, nsz)) == NULL)) {
 			if (prnt)
 				paxwarn(1, "Replacement name too long %s >> %s",
 				    name, nname);
 			return (1);
 		}
+		nname = nbuf;
+		nnsize = nsz;
+		goto again;
+	}
 
-		/*
-		 * inform the user of the result if wanted
-		 */
-		if (prnt && (pt->flgs & PRNT)) {
-			if (*nname == '\0')
-				(void)fprintf(
-				    stderr, "%s >> <empty string>\n", name);
-			else
-				(void)fprintf(
-				    stderr, "%s >> %s\n", name, nname);
-		}
-
-		/*
-		 * if empty inform the caller this file is to be skipped
-		 * otherwise copy the new name over the orig name and return
-		 */
+	/*
+	 * inform the user of the result if wanted
+	 */
+	if (prnt && (pt->flgs & PRNT)) {
 		if (*nname == '\0')
-			return (1);
-		*nlen = strlcpy(name, nname, nsize);
+			(void)fprintf(stderr, "%s >> <empty string>\n", name);
+		else
+			(void)fprintf(stderr, "%s >> %s\n", name, nname);
 	}
+
+	/*
+	 * if empty inform the caller this file is to be skipped
+	 * otherwise copy the new name over the orig name and return
+	 */
+	if ((*nname == '\0') || (arcn_set(arcn, ln, nname, outpt - nname) < 0))
+		return (1);
 	return (0);
 }
 
+/*
+ * rep_exec()
+ *	regexec() for a replacement, looking for the literal a match must
+ *	contain first. An expression that is just the literal needs nothing
+ *	else.
+ * Return:
+ *	0 if it matched (with pm set as regexec() does), non-zero otherwise
+ */
+
+static int
+rep_exec(REPLACE *pt, char *inpt, regmatch_t *pm)
+{
+	char *cp;
+	int i;
+
+	if (pt->lit != NULL) {
+		if (pt->flgs & ANCH)
+			cp = (strncmp(inpt, pt->lit, pt->llen) == 0) ? inpt :
+			    NULL;
+		else
+			cp = memmem(inpt, strlen(inpt), pt->lit, pt->llen);
+		if (cp == NULL)
+			return (REG_NOMATCH);
+		if (pt->flgs & LITRE) {
+			pm[0].rm_so = cp - inpt;
+			pm[0].rm_eo = pm[0].rm_so + pt->llen;
+			for (i = 1; i < MAXSUBEXP; i++)
+				pm[i].rm_so = pm[i].rm_eo = -1;
+			return (0);
+		}
+	}
+	return (regexec(&(pt->rcmp), inpt, MAXSUBEXP, pm, 0));
+}
+
 /*
  * resub()
  *	apply the replacement to the matched expression. expand out the old
  *	style ed(1) subexpression expansion.
  * Return:
- *	-1 if error, or the number of characters added to the destination.
+ *	-1 if error, -2 if it does not fit before destend, or the number of
+ *	characters added to the destination.
  */
 
 static int
@@ -1076,7 +1367,7 @@ resub(regex_t *rp, regmatch_t *pm, char *src, char *inpt, char *dest,
 	spt = src;
 	dpt = dest;
 	subexcnt = rp->re_nsub;
-	while ((dpt < destend) && ((c = *spt++) != '\0')) {
+	while ((c = *spt++) != '\0') {
 		/*
 		 * see if we just have an ordinary replacement character
 		 * or we refer to a subexpression.
@@ -1096,6 +1387,8 @@ resub(regex_t *rp, regmatch_t *pm, char *src, char *inpt, char *dest,
 			 */
 			if ((c == '\\') && (*spt != '\0'))
 				c = *spt++;
+			if (dpt == destend)
+				return (-2);
 			*dpt++ = c;
 			continue;
 		}
@@ -1112,7 +1405,7 @@ resub(regex_t *rp, regmatch_t *pm, char *src, char *inpt, char *dest,
 		 * fail if we run out of space or the match string is damaged
 		 */
 		if (len > (destend - dpt))
-			return (-1);
+			return (-2);
 		strncpy(dpt, inpt + pmpt->rm_so, len);
 		dpt += len;
 	}
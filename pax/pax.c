@@ -92,6 +92,8 @@ int pids;                   /* preserve file uid/gid */
 int rmleadslash = 0;        /* remove leading '/' from pathnames */
 int exit_val;               /* exit value */
 int docrc;                  /* check/create file crc */
+int dodgst;                 /* store file digests */
+int verify;                 /* verify file digests (VFY_*) */
 int swapbytes;              /* swap bytes when extracting */
 int swaphalf;               /* swap halfwords when extracting */
 char *dirptr;               /* destination dir in a copy */
@@ -276,18 +278,27 @@ main(int argc, char **argv)
 	 * so can't pledge at all then.
 	 */
 	if (pmode == 0 || (act != EXTRACT && act != COPY)) {
-		/* Copy mode, or no gzip -- don't need to fork/exec. */
-		if (gzip_program == NULL || act == COPY) {
+		/* Copy mode, no gzip or gzip in process -- don't need to
+		 * fork/exec. A read archive may still turn out to need
+		 * gzip_program (compress(1) data). */
+		if (gzip_program == NULL || act == COPY || (ar_zlib() &&
+		    act != LIST && act != EXTRACT)) {
 			/* List mode -- don't need to write/create/modify files.
 			 */
 			if (act == LIST) {
-				if (pledge("stdio rpath getpw tape", NULL) ==
-				    -1)
+				/* A member index may have to be written. */
+				if (pledge(idxfile == NULL ?
+				    "stdio rpath getpw tape" :
+				    "stdio rpath wpath cpath getpw tape",
+				    NULL) == -1)
 					err(1, "pledge");
 				/* Append mode -- don't need to create/modify
 				 * files. */
 			} else if (act == APPND) {
-				if (pledge("stdio rpath wpath getpw tape",
+				/* A compressed archive needs a temp file. */
+				if (pledge(gzip_program == NULL ?
+				    "stdio rpath wpath getpw tape" :
+				    "stdio rpath wpath cpath getpw tape",
 				    NULL) == -1)
 					err(1, "pledge");
 			} else {
@@ -298,8 +309,10 @@ main(int argc, char **argv)
 			}
 		} else {
 			if (act == LIST) {
-				if (pledge("stdio rpath getpw proc exec tape",
-				    NULL) == -1)
+				if (pledge(idxfile == NULL ?
+				    "stdio rpath getpw proc exec tape" :
+				    "stdio rpath wpath cpath getpw proc exec "
+				    "tape", NULL) == -1)
 					err(1, "pledge");
 				/* can not gzip while appending */
 			} else {
@@ -323,7 +336,7 @@ main(int argc, char **argv)
 		archive();
 		break;
 	case APPND:
-		if (gzip_program != NULL)
+		if (gzip_program != NULL && !ar_zlib())
 			errx(1, "can not gzip while appending");
 		append();
 		break;
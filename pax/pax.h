@@ -48,8 +48,23 @@
 			   /* Don't even think of changing this */
 #define DEVBLK 8192        /* default read blksize for devices */
 #define FILEBLK 10240      /* default read blksize for files */
+#define MINFBSZ 512        /* default block size for hole detect */
 #define PAXPATHLEN 3072    /* maximum path length for pax. MUST be */
 			   /* longer than the system PATH_MAX */
+#define PAXNAMEMAX (1024 * 1024) /* longest member name, a sanity bound */
+#define NAMEBUF 256        /* initial size of a member name buffer */
+#define IOBLK (1024 * 1024)     /* default i/o size for files and pipes */
+#define MAXIOBLK (8 * 1024 * 1024) /* largest i/o size (-o bufsize) */
+#define MAPBLK (8 * 1024 * 1024) /* window mapped on archive files */
+#define IOBUFS 2           /* archive buffers in flight (-o iobufs) */
+#define MAXIOBUFS 64       /* largest -o iobufs */
+#define MAXGZTHREADS 64    /* largest -o gzthreads */
+#define MAXHASHTHREADS 64  /* largest -o hashthreads */
+#define MAXXTHREADS 64     /* largest -o xthreads */
+#define MAXRDTHREADS 64    /* largest -o rdthreads */
+#define MAXWKTHREADS 64    /* largest -o walkthreads */
+#define PREFETCH (32 * 1024 * 1024) /* file data read ahead (-o prefetch) */
+#define FTMEM (64 * 1024 * 1024) /* -u names kept in memory (-o ftmem) */
 
 /*
  * Pax modes of operation
@@ -83,7 +98,10 @@ typedef struct pattern {
 	int flgs;            /* processing/state flags */
 #define MTCH 0x1             /* pattern has been matched */
 #define DIR_MTCH 0x2         /* pattern matched a directory */
+#define NO_WILD 0x4          /* pattern has no wildcards */
+	int seq;             /* position in the pattern list */
 	struct pattern *fow; /* next pattern */
+	struct pattern *wfow; /* next pattern with wildcards */
 } PATTERN;
 
 /*
@@ -133,11 +151,32 @@ enum pax_invalid_action {
 #define PAX_INVALID_SKIP 1
 #define PAX_INVALID_RENAME 2
 
+/*
+ * File digests are stored in the pax format under the keyword DGSTKEY, as
+ * the SHA-256 of the file data written in hex. The verify modes check them
+ * against the archive data (VFY_ARC) or the file system (VFY_FS).
+ */
+#define DGSTLEN 32                /* length of a SHA-256 digest */
+#define DGSTKEY "OpenBSD.sha256"  /* pax keyword holding the digest */
+#define VFY_ARC 1                 /* verify against the archive data */
+#define VFY_FS 2                  /* verify against the file system */
+
+/*
+ * Data extent of a sparse file. Only the extents are stored in the archive,
+ * the rest of the file is a hole.
+ */
+typedef struct {
+	off_t off; /* offset of the data in the file */
+	off_t len; /* length of the data */
+} SPARSE;
+
 typedef struct {
 	int nlen;                     /* file name length */
-	char name[PAXPATHLEN + 1];    /* file name */
+	char *name;                   /* file name */
+	size_t nsize;                 /* size of the name buffer */
 	int ln_nlen;                  /* link name length */
-	char ln_name[PAXPATHLEN + 1]; /* name to link to (if any) */
+	char *ln_name;                /* name to link to (if any) */
+	size_t lnsize;                /* size of the ln_name buffer */
 	char *org_name;               /* orig name in file system */
 	PATTERN *pat;                 /* ptr to pattern match (if any) */
 	struct stat sb;               /* stat buffer see stat(2) */
@@ -147,6 +186,7 @@ typedef struct {
 				      /* not always indicate the amount of */
 				      /* data following the header. */
 	u_int32_t crc;                /* file crc */
+	u_char dgst[DGSTLEN];         /* SHA-256 of the file data */
 	int type;                     /* type of file node */
 #define PAX_DIR 1                     /* directory */
 #define PAX_CHR 2                     /* character device */
@@ -163,6 +203,9 @@ typedef struct {
 	PAXKEY *xattr;                /* file specific pax keywords */
 	const PAXKEY *gattr;          /* global pax keywords in effect */
 	int invalid;                  /* invalid handling state */
+	SPARSE *sp;                   /* data extents of a sparse file */
+	int spcnt;                    /* number of extents, 0 if not sparse */
+	int cmode;                    /* mode file_creat() made, -1 unknown */
 } ARCHD;
 
 #define PAX_IS_REG(type) ((type) == PAX_REG || (type) == PAX_CTG)
@@ -250,6 +293,9 @@ typedef struct {
 			       /* different for trailers inside or outside */
 			       /* of headers. See get_head() for details */
 	int (*options)(void);  /* process format specific options (-o) */
+	int sparse;            /* can the format store only the data extents */
+			       /* of sparse files? if not, we do not bother */
+			       /* to look for holes during archive writes */
 } FSUB;
 
 /*
@@ -287,6 +333,7 @@ typedef struct oplist {
  * General Macros
  */
 #define MINIMUM(a, b) (((a) < (b)) ? (a) : (b))
+#define MAXIMUM(a, b) (((a) > (b)) ? (a) : (b))
 #define MAJOR(x) major(x)
 #define MINOR(x) minor(x)
 #define TODEV(x, y) makedev((x), (y))
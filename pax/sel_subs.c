@@ -159,7 +159,7 @@ usr_add(char *str)
 		 */
 		if ((str[0] == '\\') && (str[1] == '#'))
 			++str;
-		if (uid_from_user(str, &uid) == -1) {
+		if (name_uid(str, &uid) == -1) {
 			paxwarn(1, "Unable to find uid for user: %s", str);
 			return (-1);
 		}
@@ -255,7 +255,7 @@ grp_add(char *str)
 		 */
 		if ((str[0] == '\\') && (str[1] == '#'))
 			++str;
-		if (gid_from_group(str, &gid) == -1) {
+		if (name_gid(str, &gid) == -1) {
 			paxwarn(
 			    1, "Cannot determine gid for group name: %s", str);
 			return (-1);
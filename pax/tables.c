@@ -34,13 +34,17 @@
  * SUCH DAMAGE.
  */
 
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
 
 #include <errno.h>
 #include <fcntl.h>
+#include <grp.h>
 #include <limits.h>
+#include <pwd.h>
 #include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -48,7 +52,6 @@
 
 #include "extern.h"
 #include "pax.h"
-static u_int st_hash(const char *, int, int);
 
 /*
  * Routines for controlling the contents of all the different databases pax
@@ -70,60 +73,80 @@ static u_int st_hash(const char *, int, int);
  */
 
 /*
- * Hash Table Sizes MUST BE PRIME, if set too small performance suffers.
- * Probably safe to expect 500000 inodes per tape. Assuming good key
- * distribution (inodes) chains of under 50 long (worst case) is ok.
+ * Initial hash table sizes, MUST BE a power of 2. The tables double in size
+ * as they fill up, so these only need to be right for small runs.
  */
-#define L_TAB_SZ 2503  /* hard link hash table size */
-#define F_TAB_SZ 50503 /* file time hash table size */
-#define N_TAB_SZ 541   /* interactive rename hash table */
-#define D_TAB_SZ 317   /* unique device mapping table */
-#define A_TAB_SZ 317   /* ftree dir access time reset table */
-#define SL_TAB_SZ 317  /* escape symlink tables */
-#define MAXKEYLEN 64   /* max number of chars for hash */
+#define L_TAB_SZ 1024  /* hard link hash table size */
+#define F_TAB_SZ 16384 /* file time hash table size */
+#define N_TAB_SZ 512   /* interactive rename hash table */
+#define D_TAB_SZ 256   /* unique device mapping table */
+#define A_TAB_SZ 256   /* ftree dir access time reset table */
+#define E_TAB_SZ 256   /* existing directory table */
+#define P_TAB_SZ 256   /* pattern index */
+#define I_TAB_SZ 64    /* user and group name caches */
+#define SL_TAB_SZ 317  /* escape symlink tables (chained, prime) */
 #define DIRP_SIZE 64   /* initial size of created dir table */
+#define IDX_SIZE 256   /* initial size of archive member index */
 
 /*
- * file hard link structure (hashed by dev/ino and chained) used to find the
- * hard links in a file system or with some archive formats (cpio)
+ * Common hash table used by the databases below. Open addressing with
+ * linear probing in a power of 2 sized array of slots, which is doubled
+ * when 3/4 full, so a lookup stays O(1) however many entries there are.
+ * A slot keeps the hash of its entry: only entries with the same hash are
+ * compared, and growing the table does not need to hash them again. The
+ * users walk the probe sequence themselves (HT_SLOT() and HT_NEXT()) and
+ * end up at the slot of the entry, or at the free slot to add it in.
+ */
+typedef struct hslot {
+	void *ent; /* entry, NULL if the slot is free */
+	u_int hv;  /* hash value of the entry */
+} HSLOT;
+
+typedef struct htab {
+	HSLOT *slot; /* the slots, NULL until the table is started */
+	size_t mask; /* number of slots - 1 */
+	size_t cnt;  /* number of entries */
+} HTAB;
+
+#define HT_SLOT(t, h) ((size_t)(h) & (t)->mask) /* first slot to probe */
+#define HT_NEXT(t, i) (((i) + 1) & (t)->mask)   /* next slot to probe */
+
+/*
+ * file hard link structure (hashed by dev/ino) used to find the hard links
+ * in a file system or with some archive formats (cpio)
  */
 typedef struct hrdlnk {
 	ino_t ino;    /* files inode number */
 	char *name;   /* name of first file seen with this ino/dev */
 	dev_t dev;    /* files device number */
 	u_long nlink; /* expected link count */
-	struct hrdlnk *fow;
 } HRDLNK;
 
 /*
  * Archive write update file time table (the -u, -C flag), hashed by filename.
- * Filenames are stored in a scratch file at seek offset into the file. The
- * file time (mod time) and the file name length (for a quick check) are
- * stored in a hash table node. We were forced to use a scratch file because
- * with -u, the mtime for every node in the archive must always be available
- * to compare against (and this data can get REALLY large with big archives).
- * By being careful to read only when we have a good chance of a match, the
- * performance loss is not measurable (and the size of the archive we can
- * handle is greatly increased).
+ * Filenames are stored back to back in a name arena, at seek offset into it.
+ * The file time (mod time) and the file name length (for a quick check) are
+ * stored in a hash table node. With -u, the mtime for every node in the
+ * archive must always be available to compare against (and this data can
+ * get REALLY large with big archives), so past -o ftmem bytes the arena is
+ * moved to a scratch file that is mapped into memory.
  */
 typedef struct ftm {
-	off_t seek;           /* location in scratch file */
+	off_t seek;           /* location in the name arena */
 	struct timespec mtim; /* files last modification time */
-	struct ftm *fow;
-	int namelen; /* file name length */
+	int namelen;          /* file name length */
 } FTM;
 
 /*
  * Interactive rename table (-i flag), hashed by orig filename.
  * We assume this will not be a large table as this mapping data can only be
  * obtained through interactive input by the user. Nobody is going to type in
- * changes for 500000 files? We use chaining to resolve collisions.
+ * changes for 500000 files?
  */
 
 typedef struct namt {
 	char *oname; /* old name */
 	char *nname; /* new name typed in by the user */
-	struct namt *fow;
 } NAMT;
 
 /*
@@ -135,7 +158,7 @@ typedef struct namt {
  * this table. (When the inode field in the archive header are too small, we
  * remap the dev on writes to remove accidental collisions).
  *
- * The list is hashed by device number using chain collision resolution. Off of
+ * The table is hashed by device number. Off of
  * each DEVT are linked the various remaps for this device based on those bits
  * in the inode which were truncated. For example if we are just remapping to
  * avoid a device number during an update append, off the DEVT we would have
@@ -154,7 +177,6 @@ typedef struct namt {
 
 typedef struct devt {
 	dev_t dev;          /* the orig device number we now have to map */
-	struct devt *fow;   /* new device map list */
 	struct dlist *list; /* map list based on inode truncation bits */
 } DEVT;
 
@@ -169,12 +191,11 @@ typedef struct dlist {
  * subtree we reset the access and mod time of the directory when the tflag is
  * set. Not really explicitly specified in the pax spec, but easy and fast to
  * do (and this may have even been intended in the spec, it is not clear).
- * table is hashed by inode with chaining.
+ * table is hashed by inode and device.
  */
 
 typedef struct atdir {
 	struct file_times ft;
-	struct atdir *fow;
 } ATDIR;
 
 /*
@@ -193,17 +214,119 @@ typedef struct dirdata {
 	u_int16_t frc_mode; /* do we force mode settings? */
 } DIRDATA;
 
-static HRDLNK **ltab = NULL; /* hard link table for detecting hard links */
-static FTM **ftab = NULL;    /* file time table for updating arch */
-static NAMT **ntab = NULL;   /* interactive rename storage table */
+/*
+ * archive member index (-o index=). A sidecar file recording where the
+ * headers of each member of an archive file start, together with what is
+ * needed to list the member. It is built when an archive is read from start
+ * to trailer, and trusted only while the archive keeps the size, mtime and
+ * inode recorded in its header. Offsets are into the (uncompressed) archive
+ * data stream, so rd_skip() moves between members. The group of headers of a
+ * member (GNU long names, pax extended headers) starts at its offset.
+ */
+
+#define IDX_MAGIC "PAXIDX1"
+
+typedef struct idxhdr {
+	char magic[8];   /* IDX_MAGIC */
+	char fmt[16];    /* name of the archive format */
+	u_int32_t recsz; /* sizeof(IDXREC), rejects foreign indexes */
+	u_int32_t flags;
+#define IDX_SEQ 0x1      /* members depend on the headers before them */
+	int64_t size;    /* archive size */
+	int64_t mtime;   /* archive modification time */
+	int64_t mnsec;
+	int64_t ino;     /* archive inode */
+	int64_t end;     /* offset of the archive trailer */
+	u_int64_t cnt;   /* number of IDXREC that follow */
+} IDXHDR;
+
+typedef struct idxrec {
+	int64_t off;     /* offset of the first header of the member */
+	int64_t size;
+	int64_t mtime;
+	int64_t mnsec;
+	int64_t ctime;
+	int64_t cnsec;
+	int64_t rdev;
+	u_int32_t mode;
+	u_int32_t uid;
+	u_int32_t gid;
+	u_int32_t nlink;
+	int32_t type;
+	u_int32_t nlen;  /* name length, the name follows the record */
+	u_int32_t lnlen; /* link name length, follows the name */
+} IDXREC;
+
+typedef struct idxent {
+	IDXREC rec;
+	char *name;
+	char *ln_name;
+	int want; /* member may match a pattern */
+} IDXENT;
+
+/*
+ * user or group name cache entry. A lookup that failed is kept as well: by
+ * id with the number as the name, by name without an id.
+ */
+typedef struct idname {
+	u_int id;    /* uid or gid */
+	int known;   /* the id and name belong together */
+	char name[]; /* user or group name */
+} IDNAME;
+
+#define IDX_OFF 0   /* no index */
+#define IDX_BUILD 1 /* building the index while reading */
+#define IDX_DONE 2  /* index built, written when done reading */
+#define IDX_USE 3   /* valid index loaded */
+
+static HTAB ltab;            /* hard link table for detecting hard links */
+static HTAB ftab;            /* file time table for updating arch */
+static HTAB ntab;            /* interactive rename storage table */
 #ifndef NOCPIO
-static DEVT **dtab = NULL; /* device/inode mapping tables */
+static HTAB dtab;            /* device/inode mapping tables */
 #endif
-static ATDIR **atab = NULL;  /* file tree directory time reset table */
+static HTAB atab;            /* file tree directory time reset table */
+static HTAB etab;            /* directories known to exist on extract */
+static HTAB ptab;            /* patterns without wildcards by name */
+static HTAB uitab;           /* user names by uid */
+static HTAB untab;           /* uids by user name */
+static HTAB gitab;           /* group names by gid */
+static HTAB gntab;           /* gids by group name */
 static DIRDATA *dirp = NULL; /* storage for setting created dir time/mode */
 static size_t dirsize;       /* size of dirp table */
 static size_t dircnt = 0;    /* entries in dir time/mode storage */
 static int ffd = -1;         /* tmp file for file time table name storage */
+static char *fnames = NULL;  /* file time table name arena */
+static size_t fnsize;        /* size of the arena */
+static size_t fnlen;         /* bytes used in the arena */
+static int fnmap;            /* the arena is mapped from ffd */
+size_t ftmem = FTMEM;        /* arena kept in memory (-o ftmem=) */
+static IDXENT *itab = NULL;  /* archive member index */
+static size_t isize;         /* size of itab */
+static size_t icnt = 0;      /* entries in the member index */
+static size_t inext;         /* next entry to list or seek to */
+static IDXHDR ihdr;          /* header of the member index */
+static int istate = IDX_OFF; /* state of the member index */
+static int ipend;            /* inside a group of GNU long name headers */
+static int iseek;            /* seek past members no pattern matches */
+static off_t igrp;           /* offset of the current header group */
+char *idxfile = NULL;        /* member index file (-o index=) */
+
+static int idx_load(FILE *);
+static void idx_want(void);
+static int idx_cmp(const void *, const void *);
+static void idx_write(void);
+static void idx_free(void);
+static IDNAME *idn_find(HTAB *, const char *, u_int, u_int, size_t *);
+static IDNAME *idn_add(HTAB *, size_t, u_int, u_int, int, const char *);
+static const char *idn_name(HTAB *, u_int, int, int);
+static int idn_id(HTAB *, const char *, u_int *, int);
+static int ht_start(HTAB *, size_t);
+static int ht_add(HTAB *, size_t, u_int, void *);
+static void ht_del(HTAB *, size_t);
+static u_int st_hash(const char *, int);
+static off_t fn_add(const char *, int);
+static u_int id_hash(dev_t, ino_t);
 
 /*
  * hard link table routines
@@ -231,9 +354,9 @@ static int ffd = -1;         /* tmp file for file time table name storage */
 int
 lnk_start(void)
 {
-	if (ltab != NULL)
+	if (ltab.slot != NULL)
 		return (0);
-	if ((ltab = calloc(L_TAB_SZ, sizeof(HRDLNK *))) == NULL) {
+	if (ht_start(&ltab, L_TAB_SZ) < 0) {
 		paxwarn(1, "Cannot allocate memory for hard link table");
 		return (-1);
 	}
@@ -256,10 +379,10 @@ int
 chk_lnk(ARCHD *arcn)
 {
 	HRDLNK *pt;
-	HRDLNK **ppt;
-	u_int indx;
+	u_int hv;
+	size_t i;
 
-	if (ltab == NULL)
+	if (ltab.slot == NULL)
 		return (-1);
 	/*
 	 * ignore those nodes that cannot have hard links
@@ -268,64 +391,53 @@ chk_lnk(ARCHD *arcn)
 		return (0);
 
 	/*
-	 * hash inode number and look for this file
+	 * hash dev/inode and look for this file
 	 */
-	indx = ((unsigned)arcn->sb.st_ino) % L_TAB_SZ;
-	if ((pt = ltab[indx]) != NULL) {
+	hv = id_hash(arcn->sb.st_dev, arcn->sb.st_ino);
+	for (i = HT_SLOT(&ltab, hv); (pt = ltab.slot[i].ent) != NULL;
+	    i = HT_NEXT(&ltab, i)) {
+		if ((ltab.slot[i].hv == hv) && (pt->ino == arcn->sb.st_ino) &&
+		    (pt->dev == arcn->sb.st_dev))
+			break;
+	}
+
+	if (pt != NULL) {
 		/*
-		 * its hash chain in not empty, walk down looking for it
+		 * found a link. set the node type and copy in the name of
+		 * the file it is to link to. we need to handle hardlinks to
+		 * regular files differently than other links.
 		 */
-		ppt = &(ltab[indx]);
-		while (pt != NULL) {
-			if ((pt->ino == arcn->sb.st_ino) &&
-			    (pt->dev == arcn->sb.st_dev))
-				break;
-			ppt = &(pt->fow);
-			pt = pt->fow;
-		}
-
-		if (pt != NULL) {
-			/*
-			 * found a link. set the node type and copy in the
-			 * name of the file it is to link to. we need to
-			 * handle hardlinks to regular files differently than
-			 * other links.
-			 */
-			arcn->ln_nlen = strlcpy(
-			    arcn->ln_name, pt->name, sizeof(arcn->ln_name));
-			/* XXX truncate? */
-			if ((size_t)arcn->nlen >= sizeof(arcn->name))
-				arcn->nlen = sizeof(arcn->name) - 1;
-			if (arcn->type == PAX_REG)
-				arcn->type = PAX_HRG;
-			else
-				arcn->type = PAX_HLK;
+		if (arcn_set(arcn, 1, pt->name, strlen(pt->name)) < 0)
+			return (-1);
+		if (arcn->type == PAX_REG)
+			arcn->type = PAX_HRG;
+		else
+			arcn->type = PAX_HLK;
 
-			/*
-			 * if we have found all the links to this file, remove
-			 * it from the database
-			 */
-			if (--pt->nlink <= 1) {
-				*ppt = pt->fow;
-				free(pt->name);
-				free(pt);
-			}
-			return (1);
+		/*
+		 * if we have found all the links to this file, remove it
+		 * from the database
+		 */
+		if (--pt->nlink <= 1) {
+			ht_del(&ltab, i);
+			free(pt->name);
+			free(pt);
 		}
+		return (1);
 	}
 
 	/*
 	 * we never saw this file before. It has links so we add it to the
-	 * front of this hash chain
+	 * free slot the search ended at
 	 */
 	if ((pt = malloc(sizeof(HRDLNK))) != NULL) {
 		if ((pt->name = strdup(arcn->name)) != NULL) {
 			pt->dev = arcn->sb.st_dev;
 			pt->ino = arcn->sb.st_ino;
 			pt->nlink = arcn->sb.st_nlink;
-			pt->fow = ltab[indx];
-			ltab[indx] = pt;
-			return (0);
+			if (ht_add(&ltab, i, hv, pt) == 0)
+				return (0);
+			free(pt->name);
 		}
 		free(pt);
 	}
@@ -345,10 +457,10 @@ void
 purg_lnk(ARCHD *arcn)
 {
 	HRDLNK *pt;
-	HRDLNK **ppt;
-	u_int indx;
+	u_int hv;
+	size_t i;
 
-	if (ltab == NULL)
+	if (ltab.slot == NULL)
 		return;
 	/*
 	 * do not bother to look if it could not be in the database
@@ -358,33 +470,19 @@ purg_lnk(ARCHD *arcn)
 		return;
 
 	/*
-	 * find the hash chain for this inode value, if empty return
-	 */
-	indx = ((unsigned)arcn->sb.st_ino) % L_TAB_SZ;
-	if ((pt = ltab[indx]) == NULL)
-		return;
-
-	/*
-	 * walk down the list looking for the inode/dev pair, unlink and
-	 * free if found
+	 * look for the inode/dev pair, remove and free if found
 	 */
-	ppt = &(ltab[indx]);
-	while (pt != NULL) {
-		if ((pt->ino == arcn->sb.st_ino) &&
-		    (pt->dev == arcn->sb.st_dev))
-			break;
-		ppt = &(pt->fow);
-		pt = pt->fow;
+	hv = id_hash(arcn->sb.st_dev, arcn->sb.st_ino);
+	for (i = HT_SLOT(&ltab, hv); (pt = ltab.slot[i].ent) != NULL;
+	    i = HT_NEXT(&ltab, i)) {
+		if ((ltab.slot[i].hv == hv) && (pt->ino == arcn->sb.st_ino) &&
+		    (pt->dev == arcn->sb.st_dev)) {
+			ht_del(&ltab, i);
+			free(pt->name);
+			free(pt);
+			return;
+		}
 	}
-	if (pt == NULL)
-		return;
-
-	/*
-	 * remove and free it
-	 */
-	*ppt = pt->fow;
-	free(pt->name);
-	free(pt);
 }
 
 /*
@@ -398,29 +496,20 @@ purg_lnk(ARCHD *arcn)
 void
 lnk_end(void)
 {
-	int i;
 	HRDLNK *pt;
-	HRDLNK *ppt;
+	size_t i;
 
-	if (ltab == NULL)
+	if (ltab.slot == NULL)
 		return;
 
-	for (i = 0; i < L_TAB_SZ; ++i) {
-		if (ltab[i] == NULL)
+	for (i = 0; i <= ltab.mask; ++i) {
+		if ((pt = ltab.slot[i].ent) == NULL)
 			continue;
-		pt = ltab[i];
-		ltab[i] = NULL;
-
-		/*
-		 * free up each entry on this chain
-		 */
-		while (pt != NULL) {
-			ppt = pt;
-			pt = ppt->fow;
-			free(ppt->name);
-			free(ppt);
-		}
+		ltab.slot[i].ent = NULL;
+		free(pt->name);
+		free(pt);
 	}
+	ltab.cnt = 0;
 }
 
 /*
@@ -434,22 +523,22 @@ lnk_end(void)
  * An append with an -u must read the archive and store the modification time
  * for every file on that archive before starting the write phase. It is clear
  * that this is one HUGE database. To save memory space, the actual file names
- * are stored in a scratch file and indexed by an in-memory hash table. The
- * hash table is indexed by hashing the file path. The nodes in the table store
- * the length of the filename and the lseek offset within the scratch file
+ * are stored back to back in an append only arena and indexed by a hash
+ * table. The hash table is indexed by hashing the file path. The nodes in the
+ * table store the length of the filename and the offset within the arena
  * where the actual name is stored. Since there are never any deletions from
- * this table, fragmentation of the scratch file is never a issue. Lookups
- * seem to not exhibit any locality at all (files in the database are rarely
- * looked up more than once...), so caching is just a waste of memory. The
- * only limitation is the amount of scratch file space available to store the
- * path names.
+ * this table, fragmentation of the arena is never a issue. The arena is kept
+ * in memory up to -o ftmem bytes. Past that it moves to a scratch file which
+ * is mapped, so the kernel pages the names in and out and a lookup still
+ * only compares memory. The only limitation is the amount of scratch file
+ * space available to store the path names.
  */
 
 /*
  * ftime_start()
  *	create the file time hash table and open for read/write the scratch
- *	file. (after created it is unlinked, so when we exit we leave
- *	no witnesses).
+ *	file the name arena may move to. (after created it is unlinked, so
+ *	when we exit we leave no witnesses).
  * Return:
  *	0 if the table and file was created ok, -1 otherwise
  */
@@ -458,9 +547,9 @@ int
 ftime_start(void)
 {
 
-	if (ftab != NULL)
+	if (ftab.slot != NULL)
 		return (0);
-	if ((ftab = calloc(F_TAB_SZ, sizeof(FTM *))) == NULL) {
+	if (ht_start(&ftab, F_TAB_SZ) < 0) {
 		paxwarn(1, "Cannot allocate memory for file time table");
 		return (-1);
 	}
@@ -497,102 +586,127 @@ chk_ftime(ARCHD *arcn)
 {
 	FTM *pt;
 	int namelen;
-	u_int indx;
-	char ckname[PAXPATHLEN + 1];
+	u_int hv;
+	size_t i;
 
 	/*
 	 * no info, go ahead and add to archive
 	 */
-	if (ftab == NULL)
+	if (ftab.slot == NULL)
 		return (0);
 
 	/*
-	 * hash the pathname and look up in table
+	 * hash the pathname and look up in table. only compare the path
+	 * names if the hash and the lengths match
 	 */
 	namelen = arcn->nlen;
-	indx = st_hash(arcn->name, namelen, F_TAB_SZ);
-	if ((pt = ftab[indx]) != NULL) {
+	hv = st_hash(arcn->name, namelen);
+	for (i = HT_SLOT(&ftab, hv); (pt = ftab.slot[i].ent) != NULL;
+	    i = HT_NEXT(&ftab, i)) {
+		if ((ftab.slot[i].hv == hv) && (pt->namelen == namelen) &&
+		    (memcmp(fnames + pt->seek, arcn->name, namelen) == 0))
+			break;
+	}
+
+	if (pt != NULL) {
 		/*
-		 * the hash chain is not empty, walk down looking for match
-		 * only read up the path names if the lengths match, speeds
-		 * up the search a lot
+		 * found the file, compare the times, save the newer
 		 */
-		while (pt != NULL) {
-			if (pt->namelen == namelen) {
-				/*
-				 * potential match, have to read the name
-				 * from the scratch file.
-				 */
-				if (lseek(ffd, pt->seek, SEEK_SET) !=
-				    pt->seek) {
-					syswarn(1, errno,
-					    "Failed ftime table seek");
-					return (-1);
-				}
-				if (read(ffd, ckname, namelen) != namelen) {
-					syswarn(1, errno,
-					    "Failed ftime table read");
-					return (-1);
-				}
-
-				/*
-				 * if the names match, we are done
-				 */
-				if (!strncmp(ckname, arcn->name, namelen))
-					break;
-			}
-
-			/*
-			 * try the next entry on the chain
-			 */
-			pt = pt->fow;
-		}
-
-		if (pt != NULL) {
-			/*
-			 * found the file, compare the times, save the newer
-			 */
-			if (timespeccmp(&arcn->sb.st_mtim, &pt->mtim, >)) {
-				/*
-				 * file is newer
-				 */
-				pt->mtim = arcn->sb.st_mtim;
-				return (0);
-			}
+		if (timespeccmp(&arcn->sb.st_mtim, &pt->mtim, >)) {
 			/*
-			 * file is older
+			 * file is newer
 			 */
-			return (1);
+			pt->mtim = arcn->sb.st_mtim;
+			return (0);
 		}
+		/*
+		 * file is older
+		 */
+		return (1);
 	}
 
 	/*
-	 * not in table, add it
+	 * not in table, add the name at the end of the arena, saving the
+	 * offset. add the file to the free slot the search ended at
 	 */
-	if ((pt = malloc(sizeof(FTM))) != NULL) {
-		/*
-		 * add the name at the end of the scratch file, saving the
-		 * offset. add the file to the head of the hash chain
-		 */
-		if ((pt->seek = lseek(ffd, 0, SEEK_END)) >= 0) {
-			if (write(ffd, arcn->name, namelen) == namelen) {
-				pt->mtim = arcn->sb.st_mtim;
-				pt->namelen = namelen;
-				pt->fow = ftab[indx];
-				ftab[indx] = pt;
-				return (0);
-			}
-			syswarn(1, errno, "Failed write to file time table");
-		} else
-			syswarn(1, errno, "Failed seek on file time table");
-	} else
+	if ((pt = malloc(sizeof(FTM))) == NULL) {
 		paxwarn(1, "File time table ran out of memory");
-
-	if (pt != NULL)
-		free(pt);
+		return (-1);
+	}
+	if ((pt->seek = fn_add(arcn->name, namelen)) >= 0) {
+		pt->mtim = arcn->sb.st_mtim;
+		pt->namelen = namelen;
+		if (ht_add(&ftab, i, hv, pt) == 0)
+			return (0);
+		paxwarn(1, "File time table ran out of memory");
+	}
+	free(pt);
 	return (-1);
 }
 
+/*
+ * fn_add()
+ *	add a name to the file time table name arena. The arena grows in
+ *	memory up to ftmem bytes, then it is moved to the scratch file, which
+ *	is grown and mapped again as needed.
+ * Return:
+ *	offset of the name in the arena, -1 on error
+ */
+
+static off_t
+fn_add(const char *name, int len)
+{
+	size_t nsize;
+	char *pt;
+
+	if (fnsize - fnlen < (size_t)len) {
+		nsize = (fnsize == 0) ? 64 * 1024 : fnsize;
+		while (nsize - fnlen < (size_t)len) {
+			if (nsize > SIZE_MAX / 2) {
+				paxwarn(1, "File time table ran out of memory");
+				return (-1);
+			}
+			nsize *= 2;
+		}
+		if (!fnmap && (nsize <= ftmem)) {
+			if ((pt = realloc(fnames, nsize)) == NULL) {
+				paxwarn(1, "File time table ran out of memory");
+				return (-1);
+			}
+		} else {
+			/*
+			 * (re)map the scratch file at the new size. Both
+			 * mappings share the pages of the file, the old one
+			 * is only dropped once the new one is in place.
+			 */
+			if (ftruncate(ffd, (off_t)nsize) == -1) {
+				syswarn(1, errno,
+				    "Failed to grow file time table");
+				return (-1);
+			}
+			pt = mmap(NULL, nsize, PROT_READ | PROT_WRITE,
+			    MAP_SHARED, ffd, 0);
+			if (pt == MAP_FAILED) {
+				syswarn(1, errno,
+				    "Failed to map file time table");
+				return (-1);
+			}
+			if (fnmap)
+				(void)munmap(fnames, fnsize);
+			else {
+				memcpy(pt, fnames, fnlen);
+				free(fnames);
+				fnmap = 1;
+			}
+		}
+		fnames = pt;
+		fnsize = nsize;
+	}
+	memcpy(fnames + fnlen, name, len);
+	fnlen += len;
+	return ((off_t)(fnlen - len));
+}
+
 /*
  * escaping (absolute or w/"..") symlink table routines
  *
@@ -950,9 +1064,9 @@ sltab_process(int in_sig)
 int
 name_start(void)
 {
-	if (ntab != NULL)
+	if (ntab.slot != NULL)
 		return (0);
-	if ((ntab = calloc(N_TAB_SZ, sizeof(NAMT *))) == NULL) {
+	if (ht_start(&ntab, N_TAB_SZ) < 0) {
 		paxwarn(
 		    1, "Cannot allocate memory for interactive rename table");
 		return (-1);
@@ -973,9 +1087,10 @@ int
 add_name(char *oname, int onamelen, char *nname)
 {
 	NAMT *pt;
-	u_int indx;
+	u_int hv;
+	size_t i;
 
-	if (ntab == NULL) {
+	if (ntab.slot == NULL) {
 		/*
 		 * should never happen
 		 */
@@ -987,29 +1102,27 @@ add_name(char *oname, int onamelen, char *nname)
 	 * look to see if we have already mapped this file, if so we
 	 * will update it
 	 */
-	indx = st_hash(oname, onamelen, N_TAB_SZ);
-	if ((pt = ntab[indx]) != NULL) {
+	hv = st_hash(oname, onamelen);
+	for (i = HT_SLOT(&ntab, hv); (pt = ntab.slot[i].ent) != NULL;
+	    i = HT_NEXT(&ntab, i)) {
+		if ((ntab.slot[i].hv == hv) && (strcmp(oname, pt->oname) == 0))
+			break;
+	}
+
+	if (pt != NULL) {
 		/*
-		 * look down the has chain for the file
+		 * found an old mapping, replace it with the new one
+		 * the user just input (if it is different)
 		 */
-		while ((pt != NULL) && (strcmp(oname, pt->oname) != 0))
-			pt = pt->fow;
-
-		if (pt != NULL) {
-			/*
-			 * found an old mapping, replace it with the new one
-			 * the user just input (if it is different)
-			 */
-			if (strcmp(nname, pt->nname) == 0)
-				return (0);
-
-			free(pt->nname);
-			if ((pt->nname = strdup(nname)) == NULL) {
-				paxwarn(1, "Cannot update rename table");
-				return (-1);
-			}
+		if (strcmp(nname, pt->nname) == 0)
 			return (0);
+
+		free(pt->nname);
+		if ((pt->nname = strdup(nname)) == NULL) {
+			paxwarn(1, "Cannot update rename table");
+			return (-1);
 		}
+		return (0);
 	}
 
 	/*
@@ -1018,9 +1131,9 @@ add_name(char *oname, int onamelen, char *nname)
 	if ((pt = malloc(sizeof(NAMT))) != NULL) {
 		if ((pt->oname = strdup(oname)) != NULL) {
 			if ((pt->nname = strdup(nname)) != NULL) {
-				pt->fow = ntab[indx];
-				ntab[indx] = pt;
-				return (0);
+				if (ht_add(&ntab, i, hv, pt) == 0)
+					return (0);
+				free(pt->nname);
 			}
 			free(pt->oname);
 		}
@@ -1032,41 +1145,35 @@ add_name(char *oname, int onamelen, char *nname)
 
 /*
  * sub_name()
- *	look up a link name to see if it points at a file that has been
- *	remapped by the user. If found, the link is adjusted to contain the
- *	new name (oname is the link to name)
+ *	look up the link name of a member to see if it points at a file that
+ *	has been remapped by the user. If found, the link is adjusted to
+ *	contain the new name
  */
 
 void
-sub_name(char *oname, int *onamelen, int onamesize)
+sub_name(ARCHD *arcn)
 {
+	char *oname = arcn->ln_name;
 	NAMT *pt;
-	u_int indx;
+	u_int hv;
+	size_t i;
 
-	if (ntab == NULL)
+	if (ntab.slot == NULL)
 		return;
 	/*
 	 * look the name up in the hash table
 	 */
-	indx = st_hash(oname, *onamelen, N_TAB_SZ);
-	if ((pt = ntab[indx]) == NULL)
-		return;
-
-	while (pt != NULL) {
-		/*
-		 * walk down the hash chain looking for a match
-		 */
-		if (strcmp(oname, pt->oname) == 0) {
+	hv = st_hash(oname, arcn->ln_nlen);
+	for (i = HT_SLOT(&ntab, hv); (pt = ntab.slot[i].ent) != NULL;
+	    i = HT_NEXT(&ntab, i)) {
+		if ((ntab.slot[i].hv == hv) &&
+		    (strcmp(oname, pt->oname) == 0)) {
 			/*
 			 * found it, replace it with the new name
-			 * and return (we know that oname has enough space)
 			 */
-			*onamelen = strlcpy(oname, pt->nname, onamesize);
-			if (*onamelen >= onamesize)
-				*onamelen = onamesize - 1; /* XXX truncate? */
+			(void)arcn_set(arcn, 1, pt->nname, strlen(pt->nname));
 			return;
 		}
-		pt = pt->fow;
 	}
 
 	/*
@@ -1127,9 +1234,9 @@ static DEVT *chk_dev(dev_t, int);
 int
 dev_start(void)
 {
-	if (dtab != NULL)
+	if (dtab.slot != NULL)
 		return (0);
-	if ((dtab = calloc(D_TAB_SZ, sizeof(DEVT *))) == NULL) {
+	if (ht_start(&dtab, D_TAB_SZ) < 0) {
 		paxwarn(1, "Cannot allocate memory for device mapping table");
 		return (-1);
 	}
@@ -1171,22 +1278,19 @@ static DEVT *
 chk_dev(dev_t dev, int add)
 {
 	DEVT *pt;
-	u_int indx;
+	u_int hv;
+	size_t i;
 
-	if (dtab == NULL)
+	if (dtab.slot == NULL)
 		return (NULL);
 	/*
-	 * look to see if this device is already in the table
+	 * look to see if this device is already in the table, if so return
+	 * a pointer to it
 	 */
-	indx = ((unsigned)dev) % D_TAB_SZ;
-	if ((pt = dtab[indx]) != NULL) {
-		while ((pt != NULL) && (pt->dev != dev))
-			pt = pt->fow;
-
-		/*
-		 * found it, return a pointer to it
-		 */
-		if (pt != NULL)
+	hv = id_hash(dev, 0);
+	for (i = HT_SLOT(&dtab, hv); (pt = dtab.slot[i].ent) != NULL;
+	    i = HT_NEXT(&dtab, i)) {
+		if ((dtab.slot[i].hv == hv) && (pt->dev == dev))
 			return (pt);
 	}
 
@@ -1198,9 +1302,9 @@ chk_dev(dev_t dev, int add)
 		return (NULL);
 
 	/*
-	 * allocate a node for this device and add it to the front of the hash
-	 * chain. Note we do not assign remaps values here, so the pt->list
-	 * list must be NULL.
+	 * allocate a node for this device and add it in the free slot the
+	 * search ended at. Note we do not assign remaps values here, so the
+	 * pt->list list must be NULL.
 	 */
 	if ((pt = malloc(sizeof(DEVT))) == NULL) {
 		paxwarn(1, "Device map table out of memory");
@@ -1208,8 +1312,11 @@ chk_dev(dev_t dev, int add)
 	}
 	pt->dev = dev;
 	pt->list = NULL;
-	pt->fow = dtab[indx];
-	dtab[indx] = pt;
+	if (ht_add(&dtab, i, hv, pt) < 0) {
+		free(pt);
+		paxwarn(1, "Device map table out of memory");
+		return (NULL);
+	}
 	return (pt);
 }
 
@@ -1237,7 +1344,7 @@ map_dev(ARCHD *arcn, u_long dev_mask, u_long ino_mask)
 	ino_t trunc_bits = 0;
 	ino_t nino;
 
-	if (dtab == NULL)
+	if (dtab.slot == NULL)
 		return (0);
 	/*
 	 * check for device and inode truncation, and extract the truncated
@@ -1372,9 +1479,9 @@ bad:
 int
 atdir_start(void)
 {
-	if (atab != NULL)
+	if (atab.slot != NULL)
 		return (0);
-	if ((atab = calloc(A_TAB_SZ, sizeof(ATDIR *))) == NULL) {
+	if (ht_start(&atab, A_TAB_SZ) < 0) {
 		paxwarn(
 		    1, "Cannot allocate space for directory access time table");
 		return (-1);
@@ -1393,23 +1500,18 @@ void
 atdir_end(void)
 {
 	ATDIR *pt;
-	int i;
+	size_t i;
 
-	if (atab == NULL)
+	if (atab.slot == NULL)
 		return;
 	/*
-	 * for each non-empty hash table entry reset all the directories
-	 * chained there.
+	 * reset all the directories in the table.
+	 * remember to force the times, set_ftime() looks at pmtime and
+	 * patime, which only applies to things CREATED by pax, not read by
+	 * pax. Read time reset is controlled by -t.
 	 */
-	for (i = 0; i < A_TAB_SZ; ++i) {
-		if ((pt = atab[i]) == NULL)
-			continue;
-		/*
-		 * remember to force the times, set_ftime() looks at pmtime
-		 * and patime, which only applies to things CREATED by pax,
-		 * not read by pax. Read time reset is controlled by -t.
-		 */
-		for (; pt != NULL; pt = pt->fow)
+	for (i = 0; i <= atab.mask; ++i) {
+		if ((pt = atab.slot[i].ent) != NULL)
 			set_attr(&pt->ft, 1, 0, 0, 0);
 	}
 }
@@ -1417,7 +1519,7 @@ atdir_end(void)
 /*
  * add_atdir()
  *	add a directory to the directory access time table. Table is hashed
- *	and chained by inode number. This is for directories READ by pax
+ *	by inode and device number. This is for directories READ by pax
  */
 
 void
@@ -1426,9 +1528,10 @@ add_atdir(char *fname, dev_t dev, ino_t ino, const struct timespec *mtimp,
 {
 	ATDIR *pt;
 	sigset_t allsigs, savedsigs;
-	u_int indx;
+	u_int hv;
+	size_t i;
 
-	if (atab == NULL)
+	if (atab.slot == NULL)
 		return;
 
 	/*
@@ -1438,23 +1541,20 @@ add_atdir(char *fname, dev_t dev, ino_t ino, const struct timespec *mtimp,
 	 * different args to pax and the -n option is aborting fts out of a
 	 * subtree before all the post-order visits have been made.
 	 */
-	indx = ((unsigned)ino) % A_TAB_SZ;
-	if ((pt = atab[indx]) != NULL) {
-		while (pt != NULL) {
-			if ((pt->ft.ft_ino == ino) && (pt->ft.ft_dev == dev))
-				break;
-			pt = pt->fow;
-		}
-
+	hv = id_hash(dev, ino);
+	for (i = HT_SLOT(&atab, hv); (pt = atab.slot[i].ent) != NULL;
+	    i = HT_NEXT(&atab, i)) {
 		/*
 		 * oops, already there. Leave it alone.
 		 */
-		if (pt != NULL)
+		if ((atab.slot[i].hv == hv) && (pt->ft.ft_ino == ino) &&
+		    (pt->ft.ft_dev == dev))
 			return;
 	}
 
 	/*
-	 * add it to the front of the hash chain
+	 * add it in the free slot the search ended at. atdir_end() may walk
+	 * the table from a signal handler, so block them while it changes.
 	 */
 	sigfillset(&allsigs);
 	sigprocmask(SIG_BLOCK, &allsigs, &savedsigs);
@@ -1464,10 +1564,11 @@ add_atdir(char *fname, dev_t dev, ino_t ino, const struct timespec *mtimp,
 			pt->ft.ft_ino = ino;
 			pt->ft.ft_mtim = *mtimp;
 			pt->ft.ft_atim = *atimp;
-			pt->fow = atab[indx];
-			atab[indx] = pt;
-			sigprocmask(SIG_SETMASK, &savedsigs, NULL);
-			return;
+			if (ht_add(&atab, i, hv, pt) == 0) {
+				sigprocmask(SIG_SETMASK, &savedsigs, NULL);
+				return;
+			}
+			free(pt->ft.ft_name);
 		}
 		free(pt);
 	}
@@ -1491,28 +1592,21 @@ int
 do_atdir(const char *name, dev_t dev, ino_t ino)
 {
 	ATDIR *pt;
-	ATDIR **ppt;
 	sigset_t allsigs, savedsigs;
-	u_int indx;
+	u_int hv;
+	size_t i;
 
-	if (atab == NULL)
+	if (atab.slot == NULL)
 		return (-1);
 	/*
-	 * hash by inode and search the chain for an inode and device match
+	 * hash by inode and device and search for a match
 	 */
-	indx = ((unsigned)ino) % A_TAB_SZ;
-	if ((pt = atab[indx]) == NULL)
-		return (-1);
-
-	ppt = &(atab[indx]);
-	while (pt != NULL) {
-		if ((pt->ft.ft_ino == ino) && (pt->ft.ft_dev == dev))
+	hv = id_hash(dev, ino);
+	for (i = HT_SLOT(&atab, hv); (pt = atab.slot[i].ent) != NULL;
+	    i = HT_NEXT(&atab, i)) {
+		if ((atab.slot[i].hv == hv) && (pt->ft.ft_ino == ino) &&
+		    (pt->ft.ft_dev == dev))
 			break;
-		/*
-		 * no match, go to next one
-		 */
-		ppt = &(pt->fow);
-		pt = pt->fow;
 	}
 
 	/*
@@ -1528,7 +1622,7 @@ do_atdir(const char *name, dev_t dev, ino_t ino)
 	set_attr(&pt->ft, 1, 0, 0, 0);
 	sigfillset(&allsigs);
 	sigprocmask(SIG_BLOCK, &allsigs, &savedsigs);
-	*ppt = pt->fow;
+	ht_del(&atab, i);
 	sigprocmask(SIG_SETMASK, &savedsigs, NULL);
 	free(pt->ft.ft_name);
 	free(pt);
@@ -1536,126 +1630,579 @@ do_atdir(const char *name, dev_t dev, ino_t ino)
 }
 
 /*
- * directory access mode and time storage routines (for directories CREATED
- * by pax).
+ * existing directory table routines
  *
- * Pax requires that extracted directories, by default, have their access/mod
- * times and permissions set to the values specified in the archive. During the
- * actions of extracting (and creating the destination subtree during -rw copy)
- * directories extracted may be modified after being created. Even worse is
- * that these directories may have been created with file permissions which
- * prohibits any descendants of these directories from being extracted. When
- * directories are created by pax, access rights may be added to permit the
- * creation of files in their subtree. Every time pax creates a directory, the
- * times and file permissions specified by the archive are stored. After all
- * files have been extracted (or copied), these directories have their times
- * and file modes reset to the stored values. The directory info is restored in
- * reverse order as entries were added from root to leaf: to restore atime
- * properly, we must go backwards.
+ * When extracting an archive without directory members (or with members
+ * stored out of order) every missing directory sends chk_path() down the
+ * whole path, checking each of the parents with a stat. Directories seen
+ * or created there are remembered, so their descendants only have to check
+ * the components that are new. The table is cleared whenever a directory
+ * (or a symlink) is removed, or the working directory changes.
  */
 
 /*
- * dir_start()
- *	set up the directory time and file mode storage for directories CREATED
- *	by pax.
+ * exdir_len()
+ *	length of a directory name, not counting trailing slashes
+ */
+
+static int
+exdir_len(const char *name)
+{
+	int len;
+
+	len = strlen(name);
+	while (len > 1 && name[len - 1] == '/')
+		--len;
+	return (len);
+}
+
+/*
+ * exdir_chk()
+ *	check if a directory is known to exist
  * Return:
- *	0 if ok, -1 otherwise
+ *	1 if it is, 0 otherwise
  */
 
 int
-dir_start(void)
+exdir_chk(const char *name)
 {
-	if (dirp != NULL)
-		return (0);
+	char *pt;
+	u_int hv;
+	size_t i;
+	int len;
 
-	dirsize = DIRP_SIZE;
-	if ((dirp = reallocarray(NULL, dirsize, sizeof(DIRDATA))) == NULL) {
-		paxwarn(1, "Unable to allocate memory for directory times");
-		return (-1);
+	if (etab.cnt == 0)
+		return (0);
+	len = exdir_len(name);
+	hv = st_hash(name, len);
+	for (i = HT_SLOT(&etab, hv); (pt = etab.slot[i].ent) != NULL;
+	    i = HT_NEXT(&etab, i)) {
+		if ((etab.slot[i].hv == hv) && (strncmp(name, pt, len) == 0) &&
+		    (pt[len] == '\0'))
+			return (1);
 	}
 	return (0);
 }
 
 /*
- * add_dir()
- *	add the mode and times for a newly CREATED directory
- *	name is name of the directory, psb the stat buffer with the data in it,
- *	frc_mode is a flag that says whether to force the setting of the mode
- *	(ignoring the user set values for preserving file mode). Frc_mode is
- *	for the case where we created a file and found that the resulting
- *	directory was not writeable and the user asked for file modes to NOT
- *	be preserved. (we have to preserve what was created by default, so we
- *	have to force the setting at the end. this is stated explicitly in the
- *	pax spec)
+ * exdir_add()
+ *	remember that a directory exists. Failures are silently ignored, the
+ *	table is only a cache.
  */
 
 void
-add_dir(char *name, struct stat *psb, int frc_mode)
+exdir_add(const char *name)
 {
-	DIRDATA *dblk;
-	sigset_t allsigs, savedsigs;
-	char realname[PATH_MAX], *rp;
+	char *pt;
+	u_int hv;
+	size_t i;
+	int len;
 
-	if (dirp == NULL)
+	if ((etab.slot == NULL) && (ht_start(&etab, E_TAB_SZ) < 0))
 		return;
-
-	if (havechd && *name != '/') {
-		if ((rp = realpath(name, realname)) == NULL) {
-			paxwarn(1, "Cannot canonicalize %s", name);
-			return;
-		}
-		name = rp;
-	}
-	if (dircnt == dirsize) {
-		dblk = reallocarray(dirp, dirsize * 2, sizeof(DIRDATA));
-		if (dblk == NULL) {
-			paxwarn(1,
-			    "Unable to store mode and times for created"
-			    " directory: %s",
-			    name);
+	len = exdir_len(name);
+	hv = st_hash(name, len);
+	for (i = HT_SLOT(&etab, hv); (pt = etab.slot[i].ent) != NULL;
+	    i = HT_NEXT(&etab, i)) {
+		if ((etab.slot[i].hv == hv) && (strncmp(name, pt, len) == 0) &&
+		    (pt[len] == '\0'))
 			return;
-		}
-		sigprocmask(SIG_BLOCK, &allsigs, &savedsigs);
-		dirp = dblk;
-		dirsize *= 2;
-		sigprocmask(SIG_SETMASK, &savedsigs, NULL);
 	}
-	dblk = &dirp[dircnt];
-	if ((dblk->ft.ft_name = strdup(name)) == NULL) {
-		paxwarn(1,
-		    "Unable to store mode and times for created"
-		    " directory: %s",
-		    name);
+	if ((pt = strndup(name, len)) == NULL)
 		return;
-	}
-	dblk->ft.ft_mtim = psb->st_mtim;
-	dblk->ft.ft_atim = psb->st_atim;
-	dblk->ft.ft_ino = psb->st_ino;
-	dblk->ft.ft_dev = psb->st_dev;
-	dblk->mode = psb->st_mode & ABITS;
-	dblk->frc_mode = frc_mode;
-	sigprocmask(SIG_BLOCK, &allsigs, &savedsigs);
-	++dircnt;
-	sigprocmask(SIG_SETMASK, &savedsigs, NULL);
+	if (ht_add(&etab, i, hv, pt) < 0)
+		free(pt);
 }
 
 /*
- * delete_dir()
- *	When we rmdir a directory, we may want to make sure we don't
- *	later warn about being unable to set its mode and times.
+ * exdir_clr()
+ *	forget all the directories known to exist
  */
 
 void
-delete_dir(dev_t dev, ino_t ino)
+exdir_clr(void)
 {
-	DIRDATA *dblk;
-	char *name;
 	size_t i;
 
-	if (dirp == NULL)
+	if (etab.cnt == 0)
 		return;
-	for (i = 0; i < dircnt; i++) {
-		dblk = &dirp[i];
+	for (i = 0; i <= etab.mask; i++) {
+		free(etab.slot[i].ent);
+		etab.slot[i].ent = NULL;
+	}
+	etab.cnt = 0;
+}
+
+/*
+ * pattern index routines
+ *
+ * The patterns without wildcards (and those -n narrowed down to a directory,
+ * see pat_sel()) are kept by name, so pat_match() looks a member up by its
+ * name and the names of the directories above it, instead of trying all of
+ * the patterns. Several patterns may have the same name; pat_match() wants
+ * the first of them in the pattern list.
+ */
+
+/*
+ * pidx_add()
+ *	add a pattern to the index
+ * Return:
+ *	0 if ok, -1 if out of memory
+ */
+
+int
+pidx_add(PATTERN *pt)
+{
+	u_int hv;
+	size_t i;
+
+	if ((ptab.slot == NULL) && (ht_start(&ptab, P_TAB_SZ) < 0)) {
+		paxwarn(1, "Unable to allocate memory for pattern index");
+		return (-1);
+	}
+	hv = st_hash(pt->pstr, pt->plen);
+	for (i = HT_SLOT(&ptab, hv); ptab.slot[i].ent != NULL;
+	    i = HT_NEXT(&ptab, i))
+		;
+	if (ht_add(&ptab, i, hv, pt) < 0) {
+		paxwarn(1, "Pattern index table full");
+		return (-1);
+	}
+	return (0);
+}
+
+/*
+ * pidx_del()
+ *	remove a pattern from the index
+ */
+
+void
+pidx_del(PATTERN *pt)
+{
+	size_t i;
+
+	if (ptab.cnt == 0)
+		return;
+	for (i = HT_SLOT(&ptab, st_hash(pt->pstr, pt->plen));
+	    ptab.slot[i].ent != NULL; i = HT_NEXT(&ptab, i)) {
+		if (ptab.slot[i].ent == pt) {
+			ht_del(&ptab, i);
+			return;
+		}
+	}
+}
+
+/*
+ * pidx_get()
+ *	find the pattern named name (of length len) that matches a member of
+ *	that name (sub == 0) or below it (sub != 0), as pat_match() would: a
+ *	pattern matches the name and, without -d, what is below it. One that
+ *	-n narrowed down to a directory only what is below it.
+ * Return:
+ *	the first such pattern in the list, NULL if there is none
+ */
+
+PATTERN *
+pidx_get(const char *name, int len, int sub)
+{
+	PATTERN *pt, *best = NULL;
+	u_int hv;
+	size_t i;
+
+	if (ptab.cnt == 0)
+		return (NULL);
+	hv = st_hash(name, len);
+	for (i = HT_SLOT(&ptab, hv); (pt = ptab.slot[i].ent) != NULL;
+	    i = HT_NEXT(&ptab, i)) {
+		if ((ptab.slot[i].hv != hv) || (pt->plen != (size_t)len) ||
+		    (memcmp(pt->pstr, name, len) != 0))
+			continue;
+		if (sub ? (dflag && !(pt->flgs & DIR_MTCH)) :
+		    (pt->flgs & DIR_MTCH))
+			continue;
+		if ((best == NULL) || (pt->seq < best->seq))
+			best = pt;
+	}
+	return (best);
+}
+
+/*
+ * user and group name cache routines
+ *
+ * The owner names of every member are looked up: to store them in the
+ * header when writing, to find the ids they bind when reading and again to
+ * list them. With remote passwd and group data bases those lookups are
+ * where the time goes, and the small caches of the C library (an entry per
+ * hash value) do not hold many owners. So every answer, found or not, is
+ * kept here for the run, in a table for each direction. They can be filled
+ * from passwd and group files first (-o passwd= and -o group=), whose
+ * entries then take the place of those in the data bases. Only the main
+ * thread looks names up.
+ */
+
+/*
+ * idn_find()
+ *	look up an entry of a name cache with hash value hv, by id (name is
+ *	NULL) or by name. ip is set to the slot the search ended at.
+ * Return:
+ *	the entry, NULL if there is none
+ */
+
+static IDNAME *
+idn_find(HTAB *t, const char *name, u_int id, u_int hv, size_t *ip)
+{
+	IDNAME *pt;
+	size_t i;
+
+	for (i = HT_SLOT(t, hv); (pt = t->slot[i].ent) != NULL;
+	    i = HT_NEXT(t, i)) {
+		if (t->slot[i].hv != hv)
+			continue;
+		if ((name == NULL) ? (pt->id == id) :
+		    (strcmp(pt->name, name) == 0))
+			break;
+	}
+	*ip = i;
+	return (pt);
+}
+
+/*
+ * idn_add()
+ *	add an entry to a name cache, in the slot i a search for it ended at
+ * Return:
+ *	the entry, NULL if out of memory
+ */
+
+static IDNAME *
+idn_add(HTAB *t, size_t i, u_int hv, u_int id, int known, const char *name)
+{
+	IDNAME *pt;
+	size_t len = strlen(name) + 1;
+
+	if ((pt = malloc(sizeof(*pt) + len)) == NULL)
+		return (NULL);
+	pt->id = id;
+	pt->known = known;
+	memcpy(pt->name, name, len);
+	if (ht_add(t, i, hv, pt) < 0) {
+		free(pt);
+		return (NULL);
+	}
+	return (pt);
+}
+
+/*
+ * idn_name()
+ *	the name of a uid or gid (grp set), as user_from_uid() and
+ *	group_from_gid() return it
+ * Return:
+ *	the name, the number if there is none or NULL then if noname is set
+ */
+
+static const char *
+idn_name(HTAB *t, u_int id, int noname, int grp)
+{
+	IDNAME *pt;
+	const char *name;
+	char num[16];
+	u_int hv = id_hash(0, id);
+	size_t i;
+
+	if ((t->slot == NULL) && (ht_start(t, I_TAB_SZ) < 0))
+		return (grp ? group_from_gid(id, noname) :
+		    user_from_uid(id, noname));
+	if ((pt = idn_find(t, NULL, id, hv, &i)) == NULL) {
+		name = grp ? group_from_gid(id, 1) : user_from_uid(id, 1);
+		if (name == NULL)
+			(void)snprintf(num, sizeof(num), "%u", id);
+		if ((pt = idn_add(t, i, hv, id, name != NULL,
+		    (name != NULL) ? name : num)) == NULL)
+			return (grp ? group_from_gid(id, noname) :
+			    user_from_uid(id, noname));
+	}
+	return ((noname && !pt->known) ? NULL : pt->name);
+}
+
+/*
+ * idn_id()
+ *	the id of a user or group (grp set) name, as uid_from_user() and
+ *	gid_from_group() find it
+ * Return:
+ *	0 if found (and stored in idp), -1 otherwise
+ */
+
+static int
+idn_id(HTAB *t, const char *name, u_int *idp, int grp)
+{
+	IDNAME *pt;
+	uid_t uid;
+	gid_t gid;
+	u_int id = 0, hv = st_hash(name, strlen(name));
+	size_t i = 0;
+	int known;
+
+	if (((t->slot != NULL) || (ht_start(t, I_TAB_SZ) == 0)) &&
+	    ((pt = idn_find(t, name, 0, hv, &i)) != NULL)) {
+		if (!pt->known)
+			return (-1);
+		*idp = pt->id;
+		return (0);
+	}
+	if (grp) {
+		if ((known = (gid_from_group(name, &gid) == 0)))
+			id = gid;
+	} else if ((known = (uid_from_user(name, &uid) == 0)))
+		id = uid;
+	if (t->slot != NULL)
+		(void)idn_add(t, i, hv, id, known, name);
+	if (!known)
+		return (-1);
+	*idp = id;
+	return (0);
+}
+
+/*
+ * uid_name(), gid_name()
+ *	user_from_uid() and group_from_gid() through the name caches
+ */
+
+const char *
+uid_name(uid_t uid, int noname)
+{
+	return (idn_name(&uitab, uid, noname, 0));
+}
+
+const char *
+gid_name(gid_t gid, int noname)
+{
+	return (idn_name(&gitab, gid, noname, 1));
+}
+
+/*
+ * name_uid(), name_gid()
+ *	uid_from_user() and gid_from_group() through the name caches
+ * Return:
+ *	0 if the name is known (the id is stored), -1 otherwise
+ */
+
+int
+name_uid(const char *name, uid_t *uid)
+{
+	u_int id;
+
+	if (idn_id(&untab, name, &id, 0) < 0)
+		return (-1);
+	*uid = id;
+	return (0);
+}
+
+int
+name_gid(const char *name, gid_t *gid)
+{
+	u_int id;
+
+	if (idn_id(&gntab, name, &id, 1) < 0)
+		return (-1);
+	*gid = id;
+	return (0);
+}
+
+/*
+ * idn_load()
+ *	fill the user (or with grp set, the group) name caches from a file in
+ *	the format of passwd(5), master.passwd(5) or group(5): the name is
+ *	the first field and the id the third. Comments, NIS entries and lines
+ *	that do not parse are skipped. The first entry of a name or an id is
+ *	the one used, as in the data bases.
+ * Return:
+ *	0 if ok, -1 otherwise
+ */
+
+int
+idn_load(const char *file, int grp)
+{
+	HTAB *it = grp ? &gitab : &uitab;
+	HTAB *nt = grp ? &gntab : &untab;
+	FILE *fp;
+	char *line = NULL, *name, *cp, *ep;
+	size_t lsize = 0, i;
+	ssize_t len;
+	u_long id;
+	u_int hv;
+	int ret = 0;
+
+	if ((fp = fopen(file, "r")) == NULL) {
+		syswarn(1, errno, "Unable to open %s", file);
+		return (-1);
+	}
+	if (((it->slot == NULL) && (ht_start(it, I_TAB_SZ) < 0)) ||
+	    ((nt->slot == NULL) && (ht_start(nt, I_TAB_SZ) < 0))) {
+		paxwarn(1, "Unable to allocate memory for name cache");
+		(void)fclose(fp);
+		return (-1);
+	}
+	while ((len = getline(&line, &lsize, fp)) != -1) {
+		if ((len > 0) && (line[len - 1] == '\n'))
+			line[--len] = '\0';
+		name = line;
+		if ((*name == '\0') || (*name == '#') || (*name == '+') ||
+		    (*name == '-') || ((cp = strchr(name, ':')) == NULL) ||
+		    (cp == name))
+			continue;
+		*cp++ = '\0';
+		if ((cp = strchr(cp, ':')) == NULL)
+			continue;
+		++cp;
+		errno = 0;
+		id = strtoul(cp, &ep, 10);
+		if ((ep == cp) || ((*ep != ':') && (*ep != '\0')) ||
+		    (errno == ERANGE) || (id > UINT_MAX))
+			continue;
+		hv = id_hash(0, id);
+		if ((idn_find(it, NULL, id, hv, &i) == NULL) &&
+		    (idn_add(it, i, hv, id, 1, name) == NULL)) {
+			ret = -1;
+			break;
+		}
+		hv = st_hash(name, strlen(name));
+		if ((idn_find(nt, name, 0, hv, &i) == NULL) &&
+		    (idn_add(nt, i, hv, id, 1, name) == NULL)) {
+			ret = -1;
+			break;
+		}
+	}
+	if (ret < 0)
+		paxwarn(1, "Unable to allocate memory for name cache");
+	else if (ferror(fp)) {
+		syswarn(1, errno, "Unable to read %s", file);
+		ret = -1;
+	}
+	free(line);
+	(void)fclose(fp);
+	return (ret);
+}
+
+/*
+ * directory access mode and time storage routines (for directories CREATED
+ * by pax).
+ *
+ * Pax requires that extracted directories, by default, have their access/mod
+ * times and permissions set to the values specified in the archive. During the
+ * actions of extracting (and creating the destination subtree during -rw copy)
+ * directories extracted may be modified after being created. Even worse is
+ * that these directories may have been created with file permissions which
+ * prohibits any descendants of these directories from being extracted. When
+ * directories are created by pax, access rights may be added to permit the
+ * creation of files in their subtree. Every time pax creates a directory, the
+ * times and file permissions specified by the archive are stored. After all
+ * files have been extracted (or copied), these directories have their times
+ * and file modes reset to the stored values. The directory info is restored in
+ * reverse order as entries were added from root to leaf: to restore atime
+ * properly, we must go backwards.
+ */
+
+/*
+ * dir_start()
+ *	set up the directory time and file mode storage for directories CREATED
+ *	by pax.
+ * Return:
+ *	0 if ok, -1 otherwise
+ */
+
+int
+dir_start(void)
+{
+	if (dirp != NULL)
+		return (0);
+
+	dirsize = DIRP_SIZE;
+	if ((dirp = reallocarray(NULL, dirsize, sizeof(DIRDATA))) == NULL) {
+		paxwarn(1, "Unable to allocate memory for directory times");
+		return (-1);
+	}
+	return (0);
+}
+
+/*
+ * add_dir()
+ *	add the mode and times for a newly CREATED directory
+ *	name is name of the directory, psb the stat buffer with the data in it,
+ *	frc_mode is a flag that says whether to force the setting of the mode
+ *	(ignoring the user set values for preserving file mode). Frc_mode is
+ *	for the case where we created a file and found that the resulting
+ *	directory was not writeable and the user asked for file modes to NOT
+ *	be preserved. (we have to preserve what was created by default, so we
+ *	have to force the setting at the end. this is stated explicitly in the
+ *	pax spec)
+ */
+
+void
+add_dir(char *name, struct stat *psb, int frc_mode)
+{
+	DIRDATA *dblk;
+	sigset_t allsigs, savedsigs;
+	char realname[PATH_MAX], *rp;
+
+	if (dirp == NULL)
+		return;
+
+	if (havechd && *name != '/') {
+		if ((rp = realpath(name, realname)) == NULL) {
+			paxwarn(1, "Cannot canonicalize %s", name);
+			return;
+		}
+		name = rp;
+	}
+	if (dircnt == dirsize) {
+		dblk = reallocarray(dirp, dirsize * 2, sizeof(DIRDATA));
+		if (dblk == NULL) {
+			paxwarn(1,
+			    "Unable to store mode and times for created"
+			    " directory: %s",
+			    name);
+			return;
+		}
+		sigprocmask(SIG_BLOCK, &allsigs, &savedsigs);
+		dirp = dblk;
+		dirsize *= 2;
+		sigprocmask(SIG_SETMASK, &savedsigs, NULL);
+	}
+	dblk = &dirp[dircnt];
+	if ((dblk->ft.ft_name = strdup(name)) == NULL) {
+		paxwarn(1,
+		    "Unable to store mode and times for created"
+		    " directory: %s",
+		    name);
+		return;
+	}
+	dblk->ft.ft_mtim = psb->st_mtim;
+	dblk->ft.ft_atim = psb->st_atim;
+	dblk->ft.ft_ino = psb->st_ino;
+	dblk->ft.ft_dev = psb->st_dev;
+	dblk->mode = psb->st_mode & ABITS;
+	dblk->frc_mode = frc_mode;
+	sigprocmask(SIG_BLOCK, &allsigs, &savedsigs);
+	++dircnt;
+	sigprocmask(SIG_SETMASK, &savedsigs, NULL);
+}
+
+/*
+ * delete_dir()
+ *	When we rmdir a directory, we may want to make sure we don't
+ *	later warn about being unable to set its mode and times.
+ */
+
+void
+delete_dir(dev_t dev, ino_t ino)
+{
+	DIRDATA *dblk;
+	char *name;
+	size_t i;
+
+	if (dirp == NULL)
+		return;
+	for (i = 0; i < dircnt; i++) {
+		dblk = &dirp[i];
 
 		if (dblk->ft.ft_name == NULL)
 			continue;
@@ -1713,80 +2260,602 @@ proc_dir(int in_sig)
 }
 
 /*
- * database independent routines
+ * archive member index routines
+ *
+ * Reading an archive to list or extract a few members normally has to walk
+ * over every header in it. When the user names an index file, its entries
+ * are used to seek straight to the members the patterns can select (and the
+ * listing is produced without reading any further than the format id). When
+ * the index is missing or stale, it is (re)built while the archive is read.
+ * Indexes are only kept for archives that are a single regular file.
  */
 
 /*
- * st_hash()
- *	hashes filenames to a u_int for hashing into a table. Looks at the tail
- *	end of file, as this provides far better distribution than any other
- *	part of the name. For performance reasons we only care about the last
- *	MAXKEYLEN chars (should be at LEAST large enough to pick off the file
- *	name). Was tested on 500,000 name file tree traversal from the root
- *	and gave almost a perfectly uniform distribution of keys when used with
- *	prime sized tables (MAXKEYLEN was 128 in test). Hashes (sizeof int)
- *	chars at a time and pads with 0 for last addition.
+ * idx_start()
+ *	set up the member index for an archive about to be read. A valid
+ *	index file is loaded, otherwise one is built while reading.
  * Return:
- *	the hash value of the string MOD (%) the table size.
+ *	1 if a valid index was loaded, 0 otherwise
  */
 
-static u_int
-st_hash(const char *name, int len, int tabsz)
+int
+idx_start(void)
 {
-	const char *pt;
-	char *dest;
-	const char *end;
-	int i;
-	u_int key = 0;
-	int steps;
-	int res;
-	u_int val;
+	struct stat sb;
+	FILE *fp;
 
-	/*
-	 * only look at the tail up to MAXKEYLEN, we do not need to waste
-	 * time here (remember these are pathnames, the tail is what will
-	 * spread out the keys)
-	 */
-	if (len > MAXKEYLEN) {
-		pt = &(name[len - MAXKEYLEN]);
-		len = MAXKEYLEN;
-	} else
-		pt = name;
+	if (idxfile == NULL)
+		return (0);
+	if ((stat(arcname, &sb) == -1) || !S_ISREG(sb.st_mode)) {
+		paxwarn(0, "Archive index %s ignored, %s is not a file",
+		    idxfile, arcname);
+		idxfile = NULL;
+		return (0);
+	}
 
-	/*
-	 * calculate the number of u_int size steps in the string and if
-	 * there is a runt to deal with
-	 */
-	steps = len / sizeof(u_int);
-	res = len % sizeof(u_int);
+	memset(&ihdr, 0, sizeof(ihdr));
+	memcpy(ihdr.magic, IDX_MAGIC, sizeof(IDX_MAGIC));
+	(void)strlcpy(ihdr.fmt, frmt->name, sizeof(ihdr.fmt));
+	ihdr.recsz = sizeof(IDXREC);
+	ihdr.size = sb.st_size;
+	ihdr.mtime = sb.st_mtim.tv_sec;
+	ihdr.mnsec = sb.st_mtim.tv_nsec;
+	ihdr.ino = sb.st_ino;
+	ipend = 0;
+	igrp = 0;
+	inext = 0;
+
+	if ((fp = fopen(idxfile, "r")) != NULL) {
+		if (idx_load(fp) == 0) {
+			(void)fclose(fp);
+			istate = IDX_USE;
+			idx_want();
+			return (1);
+		}
+		(void)fclose(fp);
+		idx_free();
+	}
+	istate = IDX_BUILD;
+	return (0);
+}
 
-	/*
-	 * add up the value of the string in unsigned integer sized pieces
-	 * too bad we cannot have unsigned int aligned strings, then we
-	 * could avoid the expensive copy.
-	 */
-	for (i = 0; i < steps; ++i) {
-		end = pt + sizeof(u_int);
-		dest = (char *)&val;
-		while (pt < end)
-			*dest++ = *pt++;
-		key += val;
+/*
+ * idx_load()
+ *	read an index file, rejecting it when it does not describe the
+ *	archive as it is now.
+ * Return:
+ *	0 if the index was loaded, -1 otherwise
+ */
+
+static int
+idx_load(FILE *fp)
+{
+	IDXHDR hdr;
+	IDXENT *pt;
+	int64_t off = 0;
+
+	if ((fread(&hdr, sizeof(hdr), 1, fp) != 1) ||
+	    memcmp(hdr.magic, ihdr.magic, sizeof(hdr.magic)) ||
+	    strncmp(hdr.fmt, ihdr.fmt, sizeof(hdr.fmt)) ||
+	    (hdr.recsz != ihdr.recsz) || (hdr.size != ihdr.size) ||
+	    (hdr.mtime != ihdr.mtime) || (hdr.mnsec != ihdr.mnsec) ||
+	    (hdr.ino != ihdr.ino) || (hdr.end < 0) || (hdr.end > hdr.size) ||
+	    (hdr.cnt > (u_int64_t)hdr.size))
+		return (-1);
+	if (hdr.cnt > 0 &&
+	    (itab = reallocarray(NULL, hdr.cnt, sizeof(IDXENT))) == NULL)
+		return (-1);
+	isize = hdr.cnt;
+
+	for (icnt = 0; icnt < isize; ++icnt) {
+		pt = &itab[icnt];
+		if ((fread(&pt->rec, sizeof(IDXREC), 1, fp) != 1) ||
+		    (pt->rec.off < off) || (pt->rec.off > hdr.end) ||
+		    (pt->rec.nlen == 0) || (pt->rec.nlen > PAXNAMEMAX) ||
+		    (pt->rec.lnlen > PAXNAMEMAX))
+			return (-1);
+		off = pt->rec.off;
+		if ((pt->name = malloc(pt->rec.nlen + pt->rec.lnlen + 2)) ==
+		    NULL)
+			return (-1);
+		pt->ln_name = pt->name + pt->rec.nlen + 1;
+		pt->want = 0;
+		if ((fread(pt->name, pt->rec.nlen, 1, fp) != 1) ||
+		    ((pt->rec.lnlen > 0) &&
+		    (fread(pt->ln_name, pt->rec.lnlen, 1, fp) != 1))) {
+			free(pt->name);
+			return (-1);
+		}
+		pt->name[pt->rec.nlen] = '\0';
+		pt->ln_name[pt->rec.lnlen] = '\0';
 	}
+	if (fgetc(fp) != EOF)
+		return (-1);
+	ihdr = hdr;
+	return (0);
+}
+
+/*
+ * idx_want()
+ *	mark the members of a loaded index that one of the user supplied
+ *	patterns may select, so idx_seek() can skip all the others. Patterns
+ *	without wildcards are looked up in a copy of the index sorted by name,
+ *	only the others are tried against every member. With -c, or when
+ *	members depend on headers before them, no member is skipped.
+ */
+
+static void
+idx_want(void)
+{
+	PATTERN *pt;
+	IDXENT **srt = NULL;
+	size_t lo, hi, mid;
+	size_t i;
+
+	iseek = 0;
+	if (cflag || (ihdr.flags & IDX_SEQ) || (pat_next(NULL) == NULL))
+		return;
+
+	for (pt = pat_next(NULL); pt != NULL; pt = pat_next(pt)) {
+		if (!(pt->flgs & NO_WILD)) {
+			for (i = 0; i < icnt; ++i) {
+				if (!itab[i].want &&
+				    (pat_test(pt, itab[i].name) == 0))
+					itab[i].want = 1;
+			}
+			continue;
+		}
+
+		if (srt == NULL) {
+			if ((srt = reallocarray(NULL, icnt, sizeof(IDXENT *)))
+			    == NULL)
+				return;
+			for (i = 0; i < icnt; ++i)
+				srt[i] = &itab[i];
+			qsort(srt, icnt, sizeof(IDXENT *), idx_cmp);
+		}
+
+		/*
+		 * names the pattern matches all start with it, so they are
+		 * found right after where it sorts
+		 */
+		lo = 0;
+		hi = icnt;
+		while (lo < hi) {
+			mid = lo + (hi - lo) / 2;
+			if (strcmp(srt[mid]->name, pt->pstr) < 0)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		for (; (lo < icnt) &&
+		    (strncmp(srt[lo]->name, pt->pstr, pt->plen) == 0); ++lo) {
+			if (pat_test(pt, srt[lo]->name) == 0)
+				srt[lo]->want = 1;
+		}
+	}
+	free(srt);
+	iseek = 1;
+}
+
+static int
+idx_cmp(const void *a, const void *b)
+{
+	return (strcmp((*(IDXENT * const *)a)->name,
+	    (*(IDXENT * const *)b)->name));
+}
+
+/*
+ * idx_mark()
+ *	called before each header is read. Remembers where the header group
+ *	of the next member starts.
+ */
+
+void
+idx_mark(void)
+{
+	if ((istate == IDX_BUILD) && !ipend)
+		igrp = rd_offset();
+}
+
+/*
+ * idx_add()
+ *	called for each header read. Adds the member to an index being built.
+ *	GNU long name headers are part of the group of the member that
+ *	follows them.
+ */
+
+void
+idx_add(ARCHD *arcn)
+{
+	IDXENT *pt;
+	size_t nsize;
+	size_t nlen;
+	size_t lnlen;
+
+	if (istate != IDX_BUILD && istate != IDX_USE)
+		return;
+	if ((arcn->type == PAX_GLL) || (arcn->type == PAX_GLF)) {
+		ipend = 1;
+		return;
+	}
+	ipend = 0;
+	if (istate != IDX_BUILD)
+		return;
 
 	/*
-	 * add in the runt padded with zero to the right
+	 * members skipped by the invalid= policy are not listed, the index
+	 * would have to remember the policy as well
 	 */
-	if (res) {
-		val = 0;
-		end = pt + res;
-		dest = (char *)&val;
-		while (pt < end)
-			*dest++ = *pt++;
-		key += val;
+	if (arcn->invalid == PAX_INVALID_SKIP) {
+		idx_drop();
+		return;
 	}
 
 	/*
-	 * return the result mod the table size
+	 * pax global headers apply to all members after them. Formats that
+	 * find hard links by dev/ino (cpio) only do so when every header
+	 * before the link was read.
 	 */
-	return (key % tabsz);
+	if ((arcn->gattr != NULL) ||
+	    (frmt->udev && PAX_IS_HARDLINK(arcn->type)))
+		ihdr.flags |= IDX_SEQ;
+
+	if (icnt == isize) {
+		nsize = isize ? isize * 2 : IDX_SIZE;
+		if ((pt = reallocarray(itab, nsize, sizeof(IDXENT))) == NULL) {
+			paxwarn(0, "Unable to allocate memory for archive "
+			    "index");
+			idx_drop();
+			return;
+		}
+		itab = pt;
+		isize = nsize;
+	}
+
+	nlen = strlen(arcn->name);
+	lnlen = strlen(arcn->ln_name);
+	pt = &itab[icnt];
+	if ((pt->name = malloc(nlen + lnlen + 2)) == NULL) {
+		paxwarn(0, "Unable to allocate memory for archive index");
+		idx_drop();
+		return;
+	}
+	pt->ln_name = pt->name + nlen + 1;
+	memcpy(pt->name, arcn->name, nlen + 1);
+	memcpy(pt->ln_name, arcn->ln_name, lnlen + 1);
+	pt->want = 0;
+
+	memset(&pt->rec, 0, sizeof(IDXREC));
+	pt->rec.off = igrp;
+	pt->rec.size = arcn->sb.st_size;
+	pt->rec.mtime = arcn->sb.st_mtim.tv_sec;
+	pt->rec.mnsec = arcn->sb.st_mtim.tv_nsec;
+	pt->rec.ctime = arcn->sb.st_ctim.tv_sec;
+	pt->rec.cnsec = arcn->sb.st_ctim.tv_nsec;
+	pt->rec.rdev = arcn->sb.st_rdev;
+	pt->rec.mode = arcn->sb.st_mode;
+	pt->rec.uid = arcn->sb.st_uid;
+	pt->rec.gid = arcn->sb.st_gid;
+	pt->rec.nlink = arcn->sb.st_nlink;
+	pt->rec.type = arcn->type;
+	pt->rec.nlen = nlen;
+	pt->rec.lnlen = lnlen;
+	++icnt;
+}
+
+/*
+ * idx_done()
+ *	called when the archive trailer is found. An index being built is
+ *	complete now.
+ */
+
+void
+idx_done(void)
+{
+	if ((istate == IDX_BUILD) && !ipend) {
+		ihdr.end = igrp;
+		istate = IDX_DONE;
+	}
+}
+
+/*
+ * idx_drop()
+ *	the archive offsets can no longer be trusted (resync after read
+ *	errors, volume change). Stop building the index, or seeking with it.
+ */
+
+void
+idx_drop(void)
+{
+	if ((istate == IDX_BUILD) || (istate == IDX_DONE))
+		istate = IDX_OFF;
+	iseek = 0;
+}
+
+/*
+ * idx_seek()
+ *	called before each header is read. When reading with a loaded index,
+ *	skip forward to the next member a pattern may select (or to the
+ *	trailer when there is none left).
+ * Return:
+ *	0 if ok, -1 when the skip failed
+ */
+
+int
+idx_seek(void)
+{
+	off_t cur;
+	off_t off;
+
+	if ((istate != IDX_USE) || !iseek || ipend)
+		return (0);
+	cur = rd_offset();
+	while ((inext < icnt) &&
+	    ((itab[inext].rec.off < cur) || !itab[inext].want))
+		++inext;
+	off = (inext < icnt) ? itab[inext].rec.off : ihdr.end;
+	if (off <= cur)
+		return (0);
+	return (rd_skip(off - cur) == 0 ? 0 : -1);
+}
+
+/*
+ * idx_next()
+ *	get the next member from a loaded index, to list it without reading
+ *	the archive.
+ * Return:
+ *	0 if there is one, -1 when done
+ */
+
+int
+idx_next(ARCHD *arcn)
+{
+	IDXENT *pt;
+
+	if ((istate != IDX_USE) || (inext >= icnt))
+		return (-1);
+	pt = &itab[inext++];
+
+	memset(&arcn->sb, 0, sizeof(arcn->sb));
+	arcn->sb.st_size = pt->rec.size;
+	arcn->sb.st_mtim.tv_sec = pt->rec.mtime;
+	arcn->sb.st_mtim.tv_nsec = pt->rec.mnsec;
+	arcn->sb.st_ctim.tv_sec = pt->rec.ctime;
+	arcn->sb.st_ctim.tv_nsec = pt->rec.cnsec;
+	arcn->sb.st_atim = arcn->sb.st_mtim;
+	arcn->sb.st_rdev = pt->rec.rdev;
+	arcn->sb.st_mode = pt->rec.mode;
+	arcn->sb.st_uid = pt->rec.uid;
+	arcn->sb.st_gid = pt->rec.gid;
+	arcn->sb.st_nlink = pt->rec.nlink;
+	arcn->type = pt->rec.type;
+	if ((arcn_set(arcn, 0, pt->name, pt->rec.nlen) < 0) ||
+	    (arcn_set(arcn, 1, pt->ln_name, pt->rec.lnlen) < 0))
+		return (-1);
+	arcn->org_name = arcn->name;
+	arcn->pat = NULL;
+	arcn->skip = 0;
+	arcn->pad = 0;
+	++flcnt;
+	return (0);
+}
+
+/*
+ * idx_end()
+ *	done reading the archive. Write out an index that was built and
+ *	release the index.
+ */
+
+void
+idx_end(void)
+{
+	if (istate == IDX_DONE)
+		idx_write();
+	idx_free();
+	istate = IDX_OFF;
+	iseek = 0;
+}
+
+/*
+ * idx_write()
+ *	store the member index just built. A failure only costs the next
+ *	reader the index, so it is just a warning.
+ */
+
+static void
+idx_write(void)
+{
+	FILE *fp;
+	size_t i;
+
+	ihdr.cnt = icnt;
+	if ((fp = fopen(idxfile, "w")) == NULL) {
+		syswarn(0, errno, "Unable to create archive index %s",
+		    idxfile);
+		return;
+	}
+	if (fwrite(&ihdr, sizeof(ihdr), 1, fp) != 1)
+		goto bad;
+	for (i = 0; i < icnt; ++i) {
+		if ((fwrite(&itab[i].rec, sizeof(IDXREC), 1, fp) != 1) ||
+		    (fwrite(itab[i].name, itab[i].rec.nlen, 1, fp) != 1) ||
+		    ((itab[i].rec.lnlen > 0) && (fwrite(itab[i].ln_name,
+		    itab[i].rec.lnlen, 1, fp) != 1)))
+			goto bad;
+	}
+	if (fclose(fp) == EOF) {
+		fp = NULL;
+		goto bad;
+	}
+	return;
+
+bad:
+	syswarn(0, errno, "Unable to write archive index %s", idxfile);
+	if (fp != NULL)
+		(void)fclose(fp);
+	(void)unlink(idxfile);
+}
+
+static void
+idx_free(void)
+{
+	size_t i;
+
+	for (i = 0; i < icnt; ++i)
+		free(itab[i].name);
+	free(itab);
+	itab = NULL;
+	isize = icnt = inext = 0;
+}
+
+/*
+ * database independent routines
+ */
+
+/*
+ * ht_start()
+ *	create an empty hash table with size slots (a power of 2)
+ * Return:
+ *	0 if ok, -1 if out of memory
+ */
+
+static int
+ht_start(HTAB *t, size_t size)
+{
+	if ((t->slot = calloc(size, sizeof(HSLOT))) == NULL)
+		return (-1);
+	t->mask = size - 1;
+	t->cnt = 0;
+	return (0);
+}
+
+/*
+ * ht_add()
+ *	add an entry with hash value hv to a table, in the free slot i a
+ *	search for it ended at. When the table gets 3/4 full it is doubled in
+ *	size first (and the entry goes in the free slot it then hashes to).
+ * Return:
+ *	0 if ok, -1 if the table is full and cannot grow
+ */
+
+static int
+ht_add(HTAB *t, size_t i, u_int hv, void *ent)
+{
+	HSLOT *nslot, *sp;
+	size_t size = t->mask + 1;
+	size_t j;
+
+	if ((t->cnt + 1) > (size / 4) * 3) {
+		if ((size > SIZE_MAX / (2 * sizeof(HSLOT))) ||
+		    ((nslot = calloc(2 * size, sizeof(HSLOT))) == NULL)) {
+			/*
+			 * keep going in the table we have while there is
+			 * room, the probe sequences need one free slot
+			 */
+			if (t->cnt + 1 >= size)
+				return (-1);
+		} else {
+			for (sp = t->slot; sp < t->slot + size; ++sp) {
+				if (sp->ent == NULL)
+					continue;
+				for (j = sp->hv & (2 * size - 1);
+				    nslot[j].ent != NULL;
+				    j = (j + 1) & (2 * size - 1))
+					;
+				nslot[j] = *sp;
+			}
+			free(t->slot);
+			t->slot = nslot;
+			t->mask = 2 * size - 1;
+			for (i = HT_SLOT(t, hv); t->slot[i].ent != NULL;
+			    i = HT_NEXT(t, i))
+				;
+		}
+	}
+	t->slot[i].ent = ent;
+	t->slot[i].hv = hv;
+	++t->cnt;
+	return (0);
+}
+
+/*
+ * ht_del()
+ *	remove the entry in slot i from a table. Entries further down the
+ *	probe sequence that may no longer be found past the now free slot
+ *	are moved back into it, so no deleted markers are needed.
+ */
+
+static void
+ht_del(HTAB *t, size_t i)
+{
+	size_t j, k;
+
+	t->slot[i].ent = NULL;
+	--t->cnt;
+	for (j = HT_NEXT(t, i); t->slot[j].ent != NULL; j = HT_NEXT(t, j)) {
+		/*
+		 * the entry in j stays if it hashes cyclically in (i, j]
+		 */
+		k = HT_SLOT(t, t->slot[j].hv);
+		if ((i <= j) ? ((i < k) && (k <= j)) : ((i < k) || (k <= j)))
+			continue;
+		t->slot[i] = t->slot[j];
+		t->slot[j].ent = NULL;
+		i = j;
+	}
+}
+
+/*
+ * ht_mix()
+ *	mix all the bits of a 64 bit value into the hash value, so the low
+ *	bits the tables use depend on all of it
+ */
+
+static u_int
+ht_mix(u_int64_t x)
+{
+	x ^= x >> 33;
+	x *= 0xff51afd7ed558ccdULL;
+	x ^= x >> 33;
+	x *= 0xc4ceb9fe1a85ec53ULL;
+	x ^= x >> 33;
+	return ((u_int)x);
+}
+
+/*
+ * st_hash()
+ *	hashes filenames to a u_int for the hash tables. All of the name is
+ *	hashed (FNV-1a), since names that share the tail (the same file in
+ *	different trees) are common in large archives.
+ * Return:
+ *	the hash value of the string
+ */
+
+static u_int
+st_hash(const char *name, int len)
+{
+	const u_char *pt = (const u_char *)name;
+	const u_char *end = pt + len;
+	u_int64_t key = 0xcbf29ce484222325ULL;
+
+	while (pt < end) {
+		key ^= *pt++;
+		key *= 0x100000001b3ULL;
+	}
+	return (ht_mix(key));
+}
+
+/*
+ * id_hash()
+ *	hashes a device and inode number to a u_int for the hash tables
+ * Return:
+ *	the hash value of the pair
+ */
+
+static u_int
+id_hash(dev_t dev, ino_t ino)
+{
+	return (ht_mix(((u_int64_t)ino * 0x9e3779b97f4a7c15ULL) ^
+	    (u_int64_t)dev));
 }
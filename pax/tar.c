@@ -43,10 +43,8 @@
 #include <ctype.h>
 #include <errno.h>
 #include <fnmatch.h>
-#include <grp.h>
 #include <libgen.h>
 #include <limits.h>
-#include <pwd.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -78,6 +76,13 @@ static int pax_keywords_prepared;
 #ifndef SMALL
 static int pax_global_written;
 static unsigned int pax_global_seq = 1;
+static char *spmap;     /* sparse map of the file being stored */
+static size_t spmsz;    /* size of spmap */
+static size_t spmlen;   /* length of the map in spmap */
+static char *spname;    /* made up name of the sparse file being stored */
+static size_t spnsz;    /* size of spname */
+static off_t dgstpos = -1;       /* archive position of the digest value */
+static u_char dgsthd[DGSTLEN];   /* digest written in that header */
 #endif
 
 /* shortest possible extended record: "5 a=\n" */
@@ -87,7 +92,7 @@ static unsigned int pax_global_seq = 1;
  * Routines for reading, writing and header identify of various versions of tar
  */
 
-static size_t expandname(char *, size_t, char **, const char *, size_t);
+static int expandname(ARCHD *, int, size_t, char **, const char *, size_t);
 static u_long tar_chksm(char *, int);
 static char *name_split(char *, int);
 static int ul_oct(u_long, char *, int, int);
@@ -98,7 +103,10 @@ static int wr_xheader(const char *, HD_USTAR *, struct xheader *, int,
     const char *, unsigned int);
 static int needs_hdrcharset_binary(const char *);
 static int xheader_contains(const struct xheader *, const char *);
+static int sp_xheader(ARCHD *, struct xheader *, char **, off_t *);
 #endif
+static int sp_num(ARCHD *, char *, int *, off_t *, off_t *);
+static int sp_rdmap(ARCHD *);
 static int pax_store_kv(PAXKEY **, const char *, const char *);
 static int pax_component_too_long(const char *);
 static void pax_apply_global(ARCHD *);
@@ -441,7 +449,8 @@ tar_rd(ARCHD *arcn, char *buf)
 	 */
 	if (tar_id(buf, BLKMULT) < 0)
 		return (-1);
-	memset(arcn, 0, sizeof(*arcn));
+	if (arcn_clear(arcn) < 0)
+		return (-1);
 	arcn->org_name = arcn->name;
 	arcn->sb.st_nlink = 1;
 
@@ -450,12 +459,13 @@ tar_rd(ARCHD *arcn, char *buf)
 	 */
 	hd = (HD_TAR *)buf;
 	if (hd->linkflag != LONGLINKTYPE && hd->linkflag != LONGNAMETYPE) {
-		arcn->nlen = expandname(arcn->name, sizeof(arcn->name),
-		    &gnu_name_string, hd->name, sizeof(hd->name));
+		if ((expandname(arcn, 0, 0, &gnu_name_string, hd->name,
+		    sizeof(hd->name)) < 0) ||
+		    (expandname(arcn, 1, 0, &gnu_link_string, hd->linkname,
+		    sizeof(hd->linkname)) < 0))
+			return (-1);
 		if (pax_component_too_long(arcn->name))
 			(void)pax_handle_invalid_path(arcn, "path", arcn->name);
-		arcn->ln_nlen = expandname(arcn->ln_name, sizeof(arcn->ln_name),
-		    &gnu_link_string, hd->linkname, sizeof(hd->linkname));
 		if (pax_component_too_long(arcn->ln_name))
 			(void)pax_handle_invalid_link(
 			    arcn, "linkpath", arcn->ln_name);
@@ -526,8 +536,7 @@ tar_rd(ARCHD *arcn, char *buf)
 		/*
 		 * If we have a trailing / this is a directory and NOT a file.
 		 */
-		arcn->ln_name[0] = '\0';
-		arcn->ln_nlen = 0;
+		(void)arcn_set(arcn, 1, "", 0);
 		if (*pt == '/') {
 			/*
 			 * it is a directory, set the mode for -v printing
@@ -639,7 +648,7 @@ tar_wr(ARCHD *arcn)
 	 */
 	memset(hdblk, 0, sizeof(hdblk));
 	hd = (HD_TAR *)hdblk;
-	fieldcpy(hd->name, sizeof(hd->name), arcn->name, sizeof(arcn->name));
+	fieldcpy(hd->name, sizeof(hd->name), arcn->name, arcn->nlen + 1);
 	arcn->pad = 0;
 
 	if (arcn->type == PAX_DIR) {
@@ -658,7 +667,7 @@ tar_wr(ARCHD *arcn)
 		 */
 		hd->linkflag = SYMTYPE;
 		fieldcpy(hd->linkname, sizeof(hd->linkname), arcn->ln_name,
-		    sizeof(arcn->ln_name));
+		    arcn->ln_nlen + 1);
 		if (ul_oct(0, hd->size, sizeof(hd->size), 1))
 			goto out;
 	} else if (PAX_IS_HARDLINK(arcn->type)) {
@@ -667,7 +676,7 @@ tar_wr(ARCHD *arcn)
 		 */
 		hd->linkflag = LNKTYPE;
 		fieldcpy(hd->linkname, sizeof(hd->linkname), arcn->ln_name,
-		    sizeof(arcn->ln_name));
+		    arcn->ln_nlen + 1);
 		if (ul_oct(0, hd->size, sizeof(hd->size), 1))
 			goto out;
 	} else {
@@ -782,7 +791,8 @@ ustar_rd(ARCHD *arcn, char *buf)
 	pax_prepare_user_keywords();
 
 reset:
-	memset(arcn, 0, sizeof(*arcn));
+	if (arcn_clear(arcn) < 0)
+		return (-1);
 	pax_apply_global(arcn);
 	arcn->org_name = arcn->name;
 	arcn->sb.st_nlink = 1;
@@ -811,22 +821,24 @@ reset:
 		 * the parts.  We copy the prefix first and add a / between
 		 * the prefix and name.
 		 */
+		if (arcn_room(arcn, 0, sizeof(hd->prefix) + 1) < 0)
+			return (-1);
 		dest = arcn->name;
 		if (*(hd->prefix) != '\0') {
-			cnt = fieldcpy(dest, sizeof(arcn->name) - 1, hd->prefix,
+			cnt = fieldcpy(dest, arcn->nsize - 1, hd->prefix,
 			    sizeof(hd->prefix));
 			dest += cnt;
 			*dest++ = '/';
 			cnt++;
 		} else
 			cnt = 0;
+		*dest = '\0';
 
 		if (hd->typeflag != LONGLINKTYPE &&
 		    hd->typeflag != LONGNAMETYPE) {
-			arcn->nlen =
-			    cnt + expandname(dest, sizeof(arcn->name) - cnt,
-			    &gnu_name_string, hd->name,
-			    sizeof(hd->name));
+			if (expandname(arcn, 0, cnt, &gnu_name_string,
+			    hd->name, sizeof(hd->name)) < 0)
+				return (-1);
 			if (pax_component_too_long(arcn->name))
 				(void)pax_handle_invalid_path(
 				    arcn, "path", arcn->name);
@@ -835,8 +847,9 @@ reset:
 
 	if (!arcn->ln_nlen && hd->typeflag != LONGLINKTYPE &&
 	    hd->typeflag != LONGNAMETYPE) {
-		arcn->ln_nlen = expandname(arcn->ln_name, sizeof(arcn->ln_name),
-		    &gnu_link_string, hd->linkname, sizeof(hd->linkname));
+		if (expandname(arcn, 1, 0, &gnu_link_string, hd->linkname,
+		    sizeof(hd->linkname)) < 0)
+			return (-1);
 	}
 
 	/*
@@ -870,10 +883,10 @@ reset:
 	 * the posix spec wants).
 	 */
 	hd->gname[sizeof(hd->gname) - 1] = '\0';
-	if (Nflag || gid_from_group(hd->gname, &(arcn->sb.st_gid)) == -1)
+	if (Nflag || name_gid(hd->gname, &(arcn->sb.st_gid)) == -1)
 		arcn->sb.st_gid = (gid_t)asc_ul(hd->gid, sizeof(hd->gid), OCT);
 	hd->uname[sizeof(hd->uname) - 1] = '\0';
-	if (Nflag || uid_from_user(hd->uname, &(arcn->sb.st_uid)) == -1)
+	if (Nflag || name_uid(hd->uname, &(arcn->sb.st_uid)) == -1)
 		arcn->sb.st_uid = (uid_t)asc_ul(hd->uid, sizeof(hd->uid), OCT);
 
 	/*
@@ -962,6 +975,8 @@ reset:
 		arcn->pad = TAR_PAD(arcn->sb.st_size);
 		arcn->skip = arcn->sb.st_size;
 		arcn->sb.st_mode |= S_IFREG;
+		if (sp_rdmap(arcn) < 0)
+			return (-1);
 		break;
 	}
 
@@ -1253,6 +1268,87 @@ err:
 	    fname ? fname : "pax header");
 	return -1;
 }
+
+/*
+ * sp_xheader()
+ *	prepare to store a sparse file in GNU sparse format 1.0. The real name
+ *	and size of the file go into the extended header, the ustar header
+ *	gets a made up name (so readers not knowing the format do not replace
+ *	the file with its extents). The data starts with the map of the
+ *	extents, as decimal numbers on lines of their own: the count and then
+ *	offset and length of each extent, padded with zeros to a block.
+ *	name is set to the name for the ustar header (kept until the next
+ *	call), size to the amount of data which follows the header.
+ * Return:
+ *	0 if ok, 1 if the file has to be stored whole, -1 on error
+ */
+
+static int
+sp_xheader(ARCHD *arcn, struct xheader *xhdr, char **name, off_t *size)
+{
+	char *opath = NULL, *odirbuf = NULL;
+	const char *obase = arcn->name;
+	const char *odir = ".";
+	size_t need;
+	char *pt;
+	int i;
+
+	/*
+	 * without the keywords the extents could not be put back together
+	 */
+	if (pax_keyword_deleted("GNU.sparse.major") ||
+	    pax_keyword_deleted("GNU.sparse.minor") ||
+	    pax_keyword_deleted("GNU.sparse.name") ||
+	    pax_keyword_deleted("GNU.sparse.realsize"))
+		return (1);
+
+	/*
+	 * every number takes at most 20 characters and a newline
+	 */
+	need = (2 * (size_t)arcn->spcnt + 1) * 21 + 1;
+	if (need > spmsz) {
+		if ((pt = realloc(spmap, need)) == NULL)
+			return (-1);
+		spmap = pt;
+		spmsz = need;
+	}
+
+	/*
+	 * the made up name adds a directory of at most 36 characters (and
+	 * a . for a file without one) to the name of the file
+	 */
+	need = (size_t)arcn->nlen + 40;
+	if (need > spnsz) {
+		if ((pt = realloc(spname, need)) == NULL)
+			return (-1);
+		spname = pt;
+		spnsz = need;
+	}
+	spmlen = snprintf(spmap, spmsz, "%d\n", arcn->spcnt);
+	for (i = 0; i < arcn->spcnt; i++)
+		spmlen += snprintf(spmap + spmlen, spmsz - spmlen,
+		    "%lld\n%lld\n", (long long)arcn->sp[i].off,
+		    (long long)arcn->sp[i].len);
+	*size = spmlen + TAR_PAD(spmlen) + sp_size(arcn);
+
+	if ((opath = strdup(arcn->name)) != NULL)
+		obase = basename(opath);
+	if ((odirbuf = strdup(arcn->name)) != NULL)
+		odir = dirname(odirbuf);
+	(void)snprintf(spname, spnsz, "%s/GNUSparseFile.%ld/%s",
+	    odir ? odir : ".", (long)getpid(), obase);
+	*name = spname;
+	free(opath);
+	free(odirbuf);
+
+	if (xheader_add(xhdr, "GNU.sparse.major", "1") == -1 ||
+	    xheader_add(xhdr, "GNU.sparse.minor", "0") == -1 ||
+	    xheader_add(xhdr, "GNU.sparse.name", arcn->name) == -1 ||
+	    xheader_add_ull(xhdr, "GNU.sparse.realsize",
+	    arcn->sb.st_size) == -1)
+		return (-1);
+	return (0);
+}
 #endif
 
 static int
@@ -1777,8 +1873,13 @@ wr_ustar_or_pax(ARCHD *arcn, int ustar)
 	HD_USTAR *hd;
 	const char *name;
 	char *pt, hdblk[sizeof(HD_USTAR)];
+	char *nm = arcn->name;
+	int nlen = arcn->nlen;
+	off_t size = arcn->sb.st_size;
 #ifndef SMALL
 	struct xheader xhdr = SLIST_HEAD_INITIALIZER(xhdr);
+	struct xheader_record *drec;
+	char *spnm;
 #endif
 	int bad_mtime;
 	int write_data = 0;
@@ -1825,24 +1926,50 @@ wr_ustar_or_pax(ARCHD *arcn, int ustar)
 #endif
 	}
 
+#ifndef SMALL
+	/*
+	 * of a sparse file only the data extents are stored, behind a map of
+	 * where they go. The header is written under a made up name.
+	 */
+	if (arcn->spcnt > 0) {
+		int ret = 1;
+
+		if (!ustar)
+			ret = sp_xheader(
+			    arcn, &xhdr, &spnm, &size);
+		if (ret < 0) {
+			paxwarn(1, "Unable to store sparse file %s",
+			    arcn->org_name);
+			xheader_free(&xhdr);
+			return (1);
+		}
+		if (ret > 0)
+			arcn->spcnt = 0;
+		else {
+			nm = spnm;
+			nlen = strlen(spnm);
+		}
+	}
+#endif
+
 	/*
 	 * split the path name into prefix and name fields (if needed). if
-	 * pt != arcn->name, the name has to be split
+	 * pt != nm, the name has to be split
 	 */
-	if ((pt = name_split(arcn->name, arcn->nlen)) == NULL) {
+	if ((pt = name_split(nm, nlen)) == NULL) {
 		if (ustar) {
 			paxwarn(
 			    1, "File name too long for ustar %s", arcn->name);
 			return (1);
 		}
 #ifndef SMALL
-		else if (xheader_add(&xhdr, "path", arcn->name) == -1) {
+		else if (xheader_add(&xhdr, "path", nm) == -1) {
 			paxwarn(1, "File name too long for pax %s", arcn->name);
 			xheader_free(&xhdr);
 			return (1);
 		}
 		/* PAX format, we don't need to split the path */
-		pt = arcn->name;
+		pt = nm;
 #endif
 	}
 
@@ -1856,14 +1983,13 @@ wr_ustar_or_pax(ARCHD *arcn, int ustar)
 	/*
 	 * split the name, or zero out the prefix
 	 */
-	if (pt != arcn->name) {
+	if (pt != nm) {
 		/*
 		 * name was split, pt points at the / where the split is to
 		 * occur, we remove the / and copy the first part to the prefix
 		 */
 		*pt = '\0';
-		fieldcpy(hd->prefix, sizeof(hd->prefix), arcn->name,
-		    sizeof(arcn->name));
+		fieldcpy(hd->prefix, sizeof(hd->prefix), nm, nlen + 1);
 		*pt++ = '/';
 	}
 
@@ -1871,8 +1997,7 @@ wr_ustar_or_pax(ARCHD *arcn, int ustar)
 	 * copy the name part. this may be the whole path or the part after
 	 * the prefix
 	 */
-	fieldcpy(hd->name, sizeof(hd->name), pt,
-	    sizeof(arcn->name) - (pt - arcn->name));
+	fieldcpy(hd->name, sizeof(hd->name), pt, nlen + 1 - (pt - nm));
 
 #ifndef SMALL
 	int need_hdrcharset_binary = 0;
@@ -1915,7 +2040,7 @@ wr_ustar_or_pax(ARCHD *arcn, int ustar)
 	case PAX_HLK:
 	case PAX_HRG:
 		fieldcpy(hd->linkname, sizeof(hd->linkname), arcn->ln_name,
-		    sizeof(arcn->ln_name));
+		    arcn->ln_nlen + 1);
 		if (arcn->type == PAX_SLK) {
 			hd->typeflag = SYMTYPE;
 			if (ul_oct(0, hd->size, sizeof(hd->size), 3))
@@ -1946,16 +2071,15 @@ wr_ustar_or_pax(ARCHD *arcn, int ustar)
 			hd->typeflag = CONTTYPE;
 		else
 			hd->typeflag = REGTYPE;
-		arcn->pad = TAR_PAD(arcn->sb.st_size);
-		if (ull_oct(arcn->sb.st_size, hd->size, sizeof(hd->size), 3)) {
+		arcn->pad = TAR_PAD(size);
+		if (ull_oct(size, hd->size, sizeof(hd->size), 3)) {
 			if (ustar) {
 				paxwarn(1, "File is too long for ustar %s",
 				    arcn->org_name);
 				return (1);
 			}
 #ifndef SMALL
-			else if (xheader_add_ull(
-			    &xhdr, "size", arcn->sb.st_size) == -1) {
+			else if (xheader_add_ull(&xhdr, "size", size) == -1) {
 				paxwarn(1, "File is too long for pax %s",
 				    arcn->org_name);
 				xheader_free(&xhdr);
@@ -1976,7 +2100,7 @@ wr_ustar_or_pax(ARCHD *arcn, int ustar)
 	 */
 	if (ul_oct(arcn->sb.st_uid, hd->uid, sizeof(hd->uid), 3)) {
 		if (uid_nobody == 0) {
-			if (uid_from_user("nobody", &uid_nobody) == -1)
+			if (name_uid("nobody", &uid_nobody) == -1)
 				goto out;
 		}
 		if (uid_warn != arcn->sb.st_uid) {
@@ -1991,7 +2115,7 @@ wr_ustar_or_pax(ARCHD *arcn, int ustar)
 	}
 	if (ul_oct(arcn->sb.st_gid, hd->gid, sizeof(hd->gid), 3)) {
 		if (gid_nobody == 0) {
-			if (gid_from_group("nobody", &gid_nobody) == -1)
+			if (name_gid("nobody", &gid_nobody) == -1)
 				goto out;
 		}
 		if (gid_warn != arcn->sb.st_gid) {
@@ -2039,13 +2163,31 @@ wr_ustar_or_pax(ARCHD *arcn, int ustar)
 	if (ul_oct(arcn->sb.st_mode, hd->mode, sizeof(hd->mode), 3))
 		goto out;
 	if (!Nflag) {
-		if ((name = user_from_uid(arcn->sb.st_uid, 1)) != NULL)
+		if ((name = uid_name(arcn->sb.st_uid, 1)) != NULL)
 			strncpy(hd->uname, name, sizeof(hd->uname));
-		if ((name = group_from_gid(arcn->sb.st_gid, 1)) != NULL)
+		if ((name = gid_name(arcn->sb.st_gid, 1)) != NULL)
 			strncpy(hd->gname, name, sizeof(hd->gname));
 	}
 
 #ifndef SMALL
+	/*
+	 * the digest of the file data, if it is not known yet (see set_crc())
+	 * a placeholder is stored and dgst_patch() fills it in later
+	 */
+	drec = NULL;
+	if (!ustar && dodgst && write_data && PAX_IS_REG(arcn->type) &&
+	    (arcn->spcnt == 0) && !pax_keyword_deleted(DGSTKEY)) {
+		char hex[2 * DGSTLEN + 1];
+
+		dgst_hex(arcn->dgst, hex);
+		if (xheader_add(&xhdr, DGSTKEY, hex) == -1) {
+			paxwarn(1, "Unable to store the digest of %s",
+			    arcn->org_name);
+			xheader_free(&xhdr);
+			return (1);
+		}
+		drec = SLIST_FIRST(&xhdr);
+	}
 	pax_option_apply_local_xhdr(&xhdr);
 	if (need_hdrcharset_binary && !xheader_contains(&xhdr, "hdrcharset")) {
 		if (xheader_add(&xhdr, "hdrcharset", "BINARY") == -1) {
@@ -2056,11 +2198,27 @@ wr_ustar_or_pax(ARCHD *arcn, int ustar)
 		}
 	}
 
-	/* write out a pax extended header if needed */
+	/*
+	 * write out a pax extended header if needed. The records go out in
+	 * list order, which tells where the digest value ends up.
+	 */
+	dgstpos = -1;
 	if (!SLIST_EMPTY(&xhdr)) {
+		struct xheader_record *rec;
+		off_t pos;
 		int ret;
 
+		pos = wr_mark() + BLKMULT;
+		SLIST_FOREACH(rec, &xhdr, entry) {
+			if (rec == drec)
+				break;
+			pos += rec->reclen;
+		}
 		ret = wr_xheader(arcn->name, hd, &xhdr, 0, NULL, 0);
+		if ((ret == 0) && (drec != NULL)) {
+			dgstpos = pos + drec->reclen - (2 * DGSTLEN + 1);
+			memcpy(dgsthd, arcn->dgst, sizeof(dgsthd));
+		}
 		xheader_free(&xhdr);
 		if (ret)
 			return (ret);
@@ -2081,6 +2239,17 @@ wr_ustar_or_pax(ARCHD *arcn, int ustar)
 		    1, "Could not write ustar header for %s", arcn->org_name);
 		return (-1);
 	}
+#ifndef SMALL
+	/*
+	 * the sparse map goes in front of the file data
+	 */
+	if ((arcn->spcnt > 0) && ((wr_rdbuf(spmap, (int)spmlen) < 0) ||
+	    (wr_skip(TAR_PAD(spmlen)) < 0))) {
+		paxwarn(1, "Could not write sparse map for %s",
+		    arcn->org_name);
+		return (-1);
+	}
+#endif
 	return (write_data ? 0 : 1);
 
 out:
@@ -2094,6 +2263,29 @@ out:
 	return (1);
 }
 
+/*
+ * dgst_patch()
+ *	after the file data is stored, put the digest computed from it into
+ *	the pax extended header, unless it is there already (set_crc() read
+ *	the file before the header was written).
+ */
+
+void
+dgst_patch(ARCHD *arcn)
+{
+#ifndef SMALL
+	char hex[2 * DGSTLEN + 1];
+	off_t pos = dgstpos;
+
+	dgstpos = -1;
+	if ((pos < 0) || (memcmp(arcn->dgst, dgsthd, sizeof(dgsthd)) == 0))
+		return;
+	dgst_hex(arcn->dgst, hex);
+	if (wr_patch(pos, hex, 2 * DGSTLEN) < 0)
+		paxwarn(1, "Unable to store the digest of %s", arcn->org_name);
+#endif
+}
+
 /*
  * ustar_wr()
  *	Write out a ustar format archive.
@@ -2221,6 +2413,16 @@ pax_opt(void)
 				free(opt);
 				return (-1);
 			}
+		} else if (strcmp(opt->name, "digest") == 0) {
+			if (strcmp(opt->value, "sha256") != 0) {
+				paxwarn(1, "Unknown digest %s, must be sha256",
+				    opt->value);
+				free(opt->name);
+				free(opt->value);
+				free(opt);
+				return (-1);
+			}
+			dodgst = 1;
 		} else if (strcmp(opt->name, "linkdata") == 0) {
 			pax_option_set_linkdata(1);
 		} else if (strcmp(opt->name, "times") == 0) {
@@ -2320,21 +2522,48 @@ name_split(char *name, int len)
 	return (start);
 }
 
-static size_t
-expandname(
-    char *buf, size_t len, char **gnu_name, const char *name, size_t limit)
+/*
+ * expandname()
+ *	store a name read from a header after the off characters already in
+ *	the file name (ln set: the link name) buffer of a member: the GNU long
+ *	name read before the header if there is one, otherwise the header
+ *	field name of limit characters
+ * Return:
+ *	0 if ok, -1 if the name is too long or out of memory
+ */
+
+static int
+expandname(ARCHD *arcn, int ln, size_t off, char **gnu_name, const char *name,
+    size_t limit)
 {
-	size_t nlen;
+	size_t len;
+	char *buf;
+	int ret = 0;
 
 	if (*gnu_name) {
 		/* *gnu_name is NUL terminated */
-		if ((nlen = strlcpy(buf, *gnu_name, len)) >= len)
-			nlen = len - 1;
+		len = strlen(*gnu_name);
+		if (arcn_room(arcn, ln, off + len) < 0)
+			ret = -1;
+		else {
+			buf = ln ? arcn->ln_name : arcn->name;
+			memcpy(buf + off, *gnu_name, len + 1);
+		}
 		free(*gnu_name);
 		*gnu_name = NULL;
-	} else
-		nlen = fieldcpy(buf, len, name, limit);
-	return (nlen);
+	} else if (arcn_room(arcn, ln, off + limit) < 0)
+		ret = -1;
+	else {
+		buf = ln ? arcn->ln_name : arcn->name;
+		len = fieldcpy(buf + off, limit + 1, name, limit);
+	}
+	if (ret == 0) {
+		if (ln)
+			arcn->ln_nlen = (int)(off + len);
+		else
+			arcn->nlen = (int)(off + len);
+	}
+	return (ret);
 }
 
 static int
@@ -2386,42 +2615,156 @@ rd_size(off_t *size, const char *keyword, char *p)
 	return 0;
 }
 
+/*
+ * the keywords of an extended header that set a field of the member. They
+ * are found by a perfect hash of the length and first character of the
+ * keyword (XK_HASH()), so a keyword is compared with one entry at most.
+ */
+#define XK_SIZE 8
+#define XK_HASH(k, l) ((((l) * 4) + (u_char)(k)[0]) & (XK_SIZE - 1))
+
+static int xk_path(ARCHD *, const char *, char *);
+static int xk_linkpath(ARCHD *, const char *, char *);
+static int xk_mtime(ARCHD *, const char *, char *);
+static int xk_atime(ARCHD *, const char *, char *);
+static int xk_ctime(ARCHD *, const char *, char *);
+static int xk_size(ARCHD *, const char *, char *);
+
+static const struct xkw {
+	const char *name;
+	size_t len;
+	int (*fn)(ARCHD *, const char *, char *);
+} xktab[XK_SIZE] = {
+	[0] = { "path", 4, xk_path },
+	[1] = { "mtime", 5, xk_mtime },
+	[3] = { "size", 4, xk_size },
+	[4] = { "linkpath", 8, xk_linkpath },
+	[5] = { "atime", 5, xk_atime },
+	[7] = { "ctime", 5, xk_ctime },
+};
+
+static int
+xk_path(ARCHD *arcn, const char *keyword, char *p)
+{
+	if (arcn_set(arcn, 0, p, strlen(p)) < 0)
+		return (-1);
+	if (pax_component_too_long(arcn->name))
+		(void)pax_handle_invalid_path(arcn, keyword, p);
+	return (0);
+}
+
+static int
+xk_linkpath(ARCHD *arcn, const char *keyword, char *p)
+{
+	if (arcn_set(arcn, 1, p, strlen(p)) < 0)
+		return (-1);
+	if (pax_component_too_long(arcn->ln_name))
+		(void)pax_handle_invalid_link(arcn, keyword, p);
+	return (0);
+}
+
+static int
+xk_mtime(ARCHD *arcn, const char *keyword, char *p)
+{
+	return (rd_time(&arcn->sb.st_mtim, keyword, p));
+}
+
+static int
+xk_atime(ARCHD *arcn, const char *keyword, char *p)
+{
+	return (rd_time(&arcn->sb.st_atim, keyword, p));
+}
+
+static int
+xk_ctime(ARCHD *arcn, const char *keyword, char *p)
+{
+	return (rd_time(&arcn->sb.st_ctim, keyword, p));
+}
+
+static int
+xk_size(ARCHD *arcn, const char *keyword, char *p)
+{
+	return (rd_size(&arcn->sb.st_size, keyword, p));
+}
+
+/*
+ * the records of an extended header are read into xbuf, which grows to
+ * hold the largest record seen. Records are parsed where they were read
+ * to, only what is left of a record at the end of the buffer is moved
+ * down for the next read.
+ */
+#define XBUFSZ 4096		/* initial size of xbuf */
+#define XLENSZ 24		/* longest record length (with the blank) */
+
+static char *xbuf;
+static size_t xbufsz;
+
+/*
+ * xh_fill()
+ *	make sure at least want bytes of the records of an extended header
+ *	(or all that are left of them) are in [*pp, *endp) of xbuf, reading
+ *	as much of the size bytes that are left as fit.
+ * Return:
+ *	0 if ok, -1 if out of memory or the archive cannot be read
+ */
+
+static int
+xh_fill(char **pp, char **endp, off_t *size, size_t want)
+{
+	size_t have = *endp - *pp;
+	size_t nsz;
+	char *nbuf;
+	int rdlen;
+
+	if ((have >= want) || (*size == 0))
+		return (0);
+	if (*pp > xbuf) {
+		memmove(xbuf, *pp, have);
+		*pp = xbuf;
+		*endp = xbuf + have;
+	}
+	if (want > xbufsz) {
+		nsz = MAXIMUM(want, MAXIMUM(2 * xbufsz, XBUFSZ));
+		if ((nbuf = realloc(xbuf, nsz)) == NULL) {
+			paxwarn(1, "Unable to allocate memory for extended "
+			    "header record");
+			return (-1);
+		}
+		xbuf = *pp = nbuf;
+		*endp = xbuf + have;
+		xbufsz = nsz;
+	}
+	while ((have < want) && (*size > 0)) {
+		rdlen = (int)MINIMUM(MINIMUM(*size, xbufsz - have), INT_MAX);
+		if (rd_wrbuf(*endp, rdlen) != rdlen)
+			return (-1);
+		*size -= rdlen;
+		*endp += rdlen;
+		have += rdlen;
+	}
+	return (0);
+}
+
 static int
 rd_xheader(ARCHD *arcn, int global, off_t size)
 {
-	/*
-	 * The pax format supposedly supports arbitrarily sized extended
-	 * record headers, this implementation doesn't.
-	 */
-	char buf[sizeof("30xx linkpath=") - 1 + PAXPATHLEN + sizeof("\n")];
+	const struct xkw *xk;
 	long len;
+	size_t dlen, klen;
 	char *delim, *keyword;
 	char *nextp, *p, *end;
+	const char *spval;
 	int pad, ret = 0;
 
 	/* before we alter size, make note of how much we have to skip */
 	pad = TAR_PAD((unsigned)size);
 
-	p = end = buf;
+	p = end = xbuf;
 	while (size > 0 || p < end) {
-		if (size > 0) {
-			int rdlen;
-
-			/* shift stuff down */
-			if (p > buf) {
-				memmove(buf, p, end - p);
-				end -= p - buf;
-				p = buf;
-			}
-
-			/* fill starting at end */
-			rdlen = MINIMUM(size, (buf + sizeof buf) - end);
-			if (rd_wrbuf(end, rdlen) != rdlen) {
-				ret = -1;
-				break;
-			}
-			size -= rdlen;
-			end += rdlen;
+		/* the length of the next record, and then all of it */
+		if (xh_fill(&p, &end, &size, XLENSZ) < 0) {
+			ret = -1;
+			break;
 		}
 
 		/* [p, end) is good */
@@ -2439,24 +2782,28 @@ rd_xheader(ARCHD *arcn, int global, off_t size)
 			ret = -1;
 			break;
 		}
-		if (len > end - p) {
+		if (len > (end - p) + size) {
 			paxwarn(1,
 			    "Extended header record length %lu is "
 			    "out of range",
 			    len);
-			/* if we can just toss this record, do so */
-			len -= end - p;
-			if (len <= size && rd_skip(len) == 0) {
-				size -= len;
-				p = end = buf;
-				continue;
-			}
 			ret = -1;
 			break;
 		}
+		dlen = delim - p;
+		if ((size_t)len <= dlen + 1) {
+			paxwarn(1, "Malformed extended header record");
+			ret = -1;
+			break;
+		}
+		if (xh_fill(&p, &end, &size, len) < 0) {
+			ret = -1;
+			break;
+		}
+		delim = p + dlen;
 		nextp = p + len;
-		keyword = p = delim + 1;
-		p = memchr(p, '=', len);
+		keyword = delim + 1;
+		p = memchr(keyword, '=', nextp - keyword);
 		if (!p || nextp[-1] != '\n') {
 			paxwarn(1, "Malformed extended header record");
 			ret = -1;
@@ -2475,46 +2822,130 @@ rd_xheader(ARCHD *arcn, int global, off_t size)
 			break;
 		}
 		if (!global) {
-			if (!strcmp(keyword, "path")) {
-				size_t copied =
-				    strlcpy(arcn->name, p, sizeof(arcn->name));
-				arcn->nlen =
-				    MINIMUM(copied, sizeof(arcn->name) - 1);
-				if (copied >= sizeof(arcn->name) ||
-				    pax_component_too_long(arcn->name))
-					(void)pax_handle_invalid_path(
-					    arcn, keyword, p);
-			} else if (!strcmp(keyword, "linkpath")) {
-				size_t copied = strlcpy(
-				    arcn->ln_name, p, sizeof(arcn->ln_name));
-				arcn->ln_nlen =
-				    MINIMUM(copied, sizeof(arcn->ln_name) - 1);
-				if (copied >= sizeof(arcn->ln_name) ||
-				    pax_component_too_long(arcn->ln_name))
-					(void)pax_handle_invalid_link(
-					    arcn, keyword, p);
-			} else if (!strcmp(keyword, "mtime")) {
-				ret = rd_time(&arcn->sb.st_mtim, keyword, p);
-				if (ret < 0)
-					break;
-			} else if (!strcmp(keyword, "atime")) {
-				ret = rd_time(&arcn->sb.st_atim, keyword, p);
-				if (ret < 0)
-					break;
-			} else if (!strcmp(keyword, "ctime")) {
-				ret = rd_time(&arcn->sb.st_ctim, keyword, p);
-				if (ret < 0)
-					break;
-			} else if (!strcmp(keyword, "size")) {
-				ret = rd_size(&arcn->sb.st_size, keyword, p);
-				if (ret < 0)
-					break;
-			}
+			klen = p - keyword - 1;
+			xk = &xktab[XK_HASH(keyword, klen)];
+			if ((xk->fn != NULL) && (xk->len == klen) &&
+			    (memcmp(xk->name, keyword, klen) == 0) &&
+			    ((ret = (*xk->fn)(arcn, keyword, p)) < 0))
+				break;
 		}
 		p = nextp;
 	}
 
 	if (rd_skip(size + pad) < 0)
 		return (-1);
+
+	/*
+	 * GNU sparse format 1.0 stores the file under a made up name
+	 */
+	if (!global && (ret == 0) &&
+	    ((spval = pax_kv_lookup(arcn, "GNU.sparse.major")) != NULL) &&
+	    (strcmp(spval, "1") == 0) &&
+	    ((spval = pax_kv_lookup(arcn, "GNU.sparse.name")) != NULL)) {
+		if (arcn_set(arcn, 0, spval, strlen(spval)) < 0)
+			return (-1);
+		if (pax_component_too_long(arcn->name))
+			(void)pax_handle_invalid_path(
+			    arcn, "GNU.sparse.name", spval);
+	}
 	return (ret);
 }
+
+/*
+ * sp_num()
+ *	read the next number of a GNU sparse map. blk holds the current block
+ *	of the map, *pos the read position in it and *used the bytes of data
+ *	taken for the map so far.
+ * Return:
+ *	0 if ok, -1 if the map is not valid or cannot be read
+ */
+
+static int
+sp_num(ARCHD *arcn, char *blk, int *pos, off_t *used, off_t *val)
+{
+	int digits = 0;
+	int c;
+
+	*val = 0;
+	for (;;) {
+		if (*pos == BLKMULT) {
+			if ((*used + BLKMULT > arcn->skip) ||
+			    (rd_wrbuf(blk, BLKMULT) != BLKMULT))
+				return (-1);
+			*used += BLKMULT;
+			*pos = 0;
+		}
+		c = (unsigned char)blk[(*pos)++];
+		if (c == '\n')
+			break;
+		if (!isdigit(c) || (*val > (LLONG_MAX - 9) / 10))
+			return (-1);
+		*val = *val * 10 + (c - '0');
+		++digits;
+	}
+	return (digits > 0 ? 0 : -1);
+}
+
+/*
+ * sp_rdmap()
+ *	read the map of a file stored in GNU sparse format 1.0 from the front
+ *	of its data and set up arcn->sp. st_size becomes the real size of the
+ *	file, skip what is left of the data after the map.
+ * Return:
+ *	0 if ok (also when the file is not sparse), -1 if the map is invalid
+ */
+
+static int
+sp_rdmap(ARCHD *arcn)
+{
+	char blk[BLKMULT];
+	const char *p;
+	const char *errstr;
+	off_t realsize, cnt, end = 0, used = 0;
+	off_t val;
+	SPARSE *sp;
+	int pos = BLKMULT;
+	int i;
+
+	arcn->sp = NULL;
+	arcn->spcnt = 0;
+	if (((p = pax_kv_lookup(arcn, "GNU.sparse.major")) == NULL) ||
+	    (strcmp(p, "1") != 0) ||
+	    ((p = pax_kv_lookup(arcn, "GNU.sparse.realsize")) == NULL))
+		return (0);
+	realsize = strtonum(p, 0, LLONG_MAX, &errstr);
+	if (errstr != NULL) {
+		paxwarn(1, "GNU.sparse.realsize is %s: %s", errstr, p);
+		return (-1);
+	}
+
+	/*
+	 * every extent takes at least four bytes of the data
+	 */
+	if ((sp_num(arcn, blk, &pos, &used, &cnt) < 0) ||
+	    (cnt == 0) || (cnt > arcn->skip / 4) || (cnt > INT_MAX) ||
+	    ((sp = sp_alloc((int)cnt)) == NULL))
+		goto bad;
+	for (i = 0; i < cnt; i++) {
+		if ((sp_num(arcn, blk, &pos, &used, &sp[i].off) < 0) ||
+		    (sp_num(arcn, blk, &pos, &used, &sp[i].len) < 0) ||
+		    (sp[i].off < end) || (sp[i].len > realsize - sp[i].off))
+			goto bad;
+		end = sp[i].off + sp[i].len;
+	}
+	arcn->sp = sp;
+	arcn->spcnt = (int)cnt;
+	arcn->skip -= used;
+	val = sp_size(arcn);
+	if (val != arcn->skip)
+		goto bad;
+	arcn->sb.st_size = realsize;
+	return (0);
+
+bad:
+	paxwarn(1, "Invalid sparse map for %s", arcn->name);
+	sp_free();
+	arcn->sp = NULL;
+	arcn->spcnt = 0;
+	return (-1);
+}
@@ -137,6 +137,10 @@ paxwarn(int set, const char *fmt, ...)
 
 	if (set)
 		exit_val = 1;
+	/*
+	 * the extract threads warn too, keep each message in one piece
+	 */
+	flockfile(stderr);
 	/*
 	 * when vflag we better ship out an extra \n to get this message on a
 	 * line by itself
@@ -152,6 +156,7 @@ paxwarn(int set, const char *fmt, ...)
 	va_end(ap);
 	safe_print(buf, stderr);
 	(void)fputc('\n', stderr);
+	funlockfile(stderr);
 }
 
 /*
@@ -168,6 +173,7 @@ syswarn(int set, int errnum, const char *fmt, ...)
 
 	if (set)
 		exit_val = 1;
+	flockfile(stderr);
 	/*
 	 * when vflag we better ship out an extra \n to get this message on a
 	 * line by itself
@@ -189,4 +195,5 @@ syswarn(int set, int errnum, const char *fmt, ...)
 	if (errnum > 0)
 		(void)fprintf(stderr, ": %s", strerror(errnum));
 	(void)fputc('\n', stderr);
+	funlockfile(stderr);
 }